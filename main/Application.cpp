@@ -44,6 +44,26 @@ void Application::do_begin() {
         cJSON_AddNumberToObject(audio_formats_out, "sample_rate", CONFIG_DEVICE_I2S_SAMPLE_RATE);
         cJSON_AddNumberToObject(audio_formats_out, "bit_rate", CONFIG_DEVICE_I2S_BITS_PER_SAMPLE);
 
+        // The codecs, frame durations and transports we support in both
+        // directions. The ones in use are selected through the audio
+        // configuration.
+
+        for (const auto audio_format : {audio_formats_in, audio_formats_out}) {
+            auto codecs = cJSON_AddArrayToObject(audio_format, "codecs");
+            cJSON_AddItemToArray(codecs, cJSON_CreateString(audio_codec_type_to_string(AudioCodecType::PCM)));
+            cJSON_AddItemToArray(codecs, cJSON_CreateString(audio_codec_type_to_string(AudioCodecType::Opus)));
+
+            auto frame_ms = cJSON_AddArrayToObject(audio_format, "frame_ms");
+            for (const auto supported_frame_ms : AUDIO_FRAME_MS) {
+                cJSON_AddItemToArray(frame_ms, cJSON_CreateNumber(supported_frame_ms));
+            }
+
+            auto transports = cJSON_AddArrayToObject(audio_format, "transports");
+            cJSON_AddItemToArray(transports,
+                                 cJSON_CreateString(audio_transport_type_to_string(AudioTransportType::Native)));
+            cJSON_AddItemToArray(transports, cJSON_CreateString(audio_transport_type_to_string(AudioTransportType::RTP)));
+        }
+
         cJSON_AddStringToObject(
             json, "endpoint",
             strformat("%s:%d", get_network_connection().get_ip_address(), _udp_server.get_port()).c_str());
@@ -176,10 +196,22 @@ void Application::register_mqtt_callbacks() {
         _device.remove_endpoint(value);
     });
 
+    get_mqtt_connection().register_callback("join_group", [this](const string& value) {
+        ESP_LOGI(TAG, "Joining multicast group %s", value.c_str());
+
+        _udp_server.join_group(value);
+    });
+
+    get_mqtt_connection().register_callback("leave_group", [this](const string& value) {
+        ESP_LOGI(TAG, "Leaving multicast group %s", value.c_str());
+
+        _udp_server.leave_group(value);
+    });
+
     get_mqtt_connection().register_callback("audio_config", [this](const string& value) {
         ESP_LOGI(TAG, "Received audio configuration %s", value.c_str());
 
-        AudioConfiguration config;
+        auto config = _device.get_audio_configuration();
         if (parse_audio_configuration(value, config)) {
             _device.set_audio_configuration(config);
         } else {
@@ -271,6 +303,71 @@ bool Application::parse_audio_configuration(const string& json, AudioConfigurati
     }
     config.playback_target_db = (float)item->valuedouble;
 
+    // Settings below are optional. If they're missing, the current value is kept.
+
+    item = cJSON_GetObjectItem(*root, "jitter_buffer_adaptive");
+    if (cJSON_IsBool(item)) {
+        config.jitter_buffer_adaptive = cJSON_IsTrue(item);
+    }
+
+    item = cJSON_GetObjectItem(*root, "jitter_buffer_percentile");
+    if (cJSON_IsNumber(item)) {
+        config.jitter_buffer_percentile = (float)item->valuedouble;
+    }
+
+    item = cJSON_GetObjectItem(*root, "codec");
+    if (cJSON_IsString(item)) {
+        if (!parse_audio_codec_type(item->valuestring, config.codec)) {
+            return false;
+        }
+    }
+
+    item = cJSON_GetObjectItem(*root, "frame_ms");
+    if (cJSON_IsNumber(item)) {
+        if (!is_valid_audio_frame_ms((uint32_t)item->valueint)) {
+            return false;
+        }
+        config.frame_ms = (uint32_t)item->valueint;
+    }
+
+    // Raw PCM frames must fit in a single packet.
+    if (config.codec == AudioCodecType::PCM && AUDIO_BUFFER_LEN(config.frame_ms) > FEC_MAX_PAYLOAD_LEN) {
+        ESP_LOGE(TAG, "Frames of %d ms don't fit in a packet", (int)config.frame_ms);
+        return false;
+    }
+
+    item = cJSON_GetObjectItem(*root, "transport");
+    if (cJSON_IsString(item)) {
+        if (!parse_audio_transport_type(item->valuestring, config.transport)) {
+            return false;
+        }
+    }
+
+    item = cJSON_GetObjectItem(*root, "fec_group_size");
+    if (cJSON_IsNumber(item)) {
+        if (item->valueint != 0 && (item->valueint < 2 || item->valueint > 16)) {
+            return false;
+        }
+        config.fec_group_size = (uint8_t)item->valueint;
+    }
+
+    item = cJSON_GetObjectItem(*root, "mix_normalized");
+    if (cJSON_IsBool(item)) {
+        config.mix_normalized = cJSON_IsTrue(item);
+    }
+
+    item = cJSON_GetObjectItem(*root, "dtx_enabled");
+    if (cJSON_IsBool(item)) {
+        config.dtx_enabled = cJSON_IsTrue(item);
+    }
+
+    item = cJSON_GetObjectItem(*root, "latency_profile");
+    if (cJSON_IsString(item)) {
+        if (!parse_latency_profile(item->valuestring, config.latency_profile)) {
+            return false;
+        }
+    }
+
     return true;
 }
 
@@ -320,4 +417,4 @@ LedAction* Application::parse_led_action(const string& data) {
     }
 
     return new LedAction{.state = state, .duration = duration, .on = on, .off = off};
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,130 @@
+#include "support.h"
+
+#include "AudioCodec.h"
+
+#include <algorithm>
+
+#include "AudioFrame.h"
+#include "OpusCodec.h"
+#include "UDPServer.h"
+#include "esp_random.h"
+
+LOG_TAG(AudioCodec);
+
+const char* audio_codec_type_to_string(AudioCodecType type) {
+    switch (type) {
+        case AudioCodecType::PCM:
+            return "pcm";
+        case AudioCodecType::Opus:
+            return "opus";
+        default:
+            return "unknown";
+    }
+}
+
+bool parse_audio_codec_type(const char* value, AudioCodecType& type) {
+    if (iequals(value, "pcm")) {
+        type = AudioCodecType::PCM;
+        return true;
+    }
+    if (iequals(value, "opus")) {
+        type = AudioCodecType::Opus;
+        return true;
+    }
+
+    return false;
+}
+
+AudioEncoder* AudioEncoder::create(AudioCodecType type, uint32_t frame_ms) {
+    switch (type) {
+        case AudioCodecType::Opus:
+            return new OpusAudioEncoder(frame_ms);
+        default:
+            return nullptr;
+    }
+}
+
+AudioDecoder* AudioDecoder::create(AudioCodecType type, uint32_t frame_ms) {
+    switch (type) {
+        case AudioCodecType::Opus:
+            return new OpusAudioDecoder(frame_ms);
+        default:
+            return nullptr;
+    }
+}
+
+#ifdef CONFIG_DEVICE_BENCHMARK_CODEC
+
+static void benchmark_audio_codec(AudioCodecType type, uint32_t frame_ms) {
+    const auto encoder = AudioEncoder::create(type, frame_ms);
+    const auto decoder = AudioDecoder::create(type, frame_ms);
+    ESP_ERROR_ASSERT(encoder && decoder);
+
+    const auto frame_samples = US_TO_SAMPLES(frame_ms * 1000);
+    const auto frame = (int16_t*)malloc(frame_samples * sizeof(int16_t));
+    const auto samples = (int16_t*)malloc(frame_samples * sizeof(int16_t));
+    const auto buffer = (uint8_t*)malloc(UDPServer::PAYLOAD_LEN);
+    ESP_ERROR_ASSERT(frame && samples && buffer);
+
+    // Two seconds of a voiced sound with some noise, so the encoder has
+    // about as much work as with speech.
+
+    const auto frames = 2000 / frame_ms;
+    int64_t encode_us = 0;
+    int64_t max_encode_us = 0;
+    int64_t decode_us = 0;
+    int64_t max_decode_us = 0;
+    size_t encoded_len = 0;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        for (size_t j = 0; j < frame_samples; j++) {
+            const auto t = (float)(i * frame_samples + j) / CONFIG_DEVICE_I2S_SAMPLE_RATE;
+            const auto voice = 6000 * sinf(2 * (float)M_PI * 150 * t) + 3000 * sinf(2 * (float)M_PI * 450 * t) +
+                               1500 * sinf(2 * (float)M_PI * 1200 * t);
+
+            frame[j] = (int16_t)(voice + (float)(esp_random() % 1000) - 500);
+        }
+
+        auto start = esp_timer_get_time();
+        const auto len = encoder->encode((uint8_t*)frame, buffer, UDPServer::PAYLOAD_LEN);
+        auto elapsed = esp_timer_get_time() - start;
+        ESP_ERROR_ASSERT(len > 0);
+
+        encode_us += elapsed;
+        max_encode_us = max(max_encode_us, elapsed);
+        encoded_len += len;
+
+        start = esp_timer_get_time();
+        const auto decoded = decoder->decode(buffer, len, samples, frame_samples);
+        elapsed = esp_timer_get_time() - start;
+        ESP_ERROR_ASSERT(decoded == (int)frame_samples);
+
+        decode_us += elapsed;
+        max_decode_us = max(max_decode_us, elapsed);
+    }
+
+    const auto frame_us = frame_ms * 1000.0f;
+
+    ESP_LOGI(TAG,
+             "%s %d ms: encode %d us (max %d, %.1f%% of real time), decode %d us (max %d, %.1f%% of real time), "
+             "%d bytes per frame",
+             audio_codec_type_to_string(type), (int)frame_ms, (int)(encode_us / frames), (int)max_encode_us,
+             encode_us / frames / frame_us * 100, (int)(decode_us / frames), (int)max_decode_us,
+             decode_us / frames / frame_us * 100, (int)(encoded_len / frames));
+
+    free(buffer);
+    free(samples);
+    free(frame);
+    delete decoder;
+    delete encoder;
+}
+
+void benchmark_audio_codecs() {
+    ESP_LOGI(TAG, "Benchmarking audio codecs");
+
+    for (const auto frame_ms : AUDIO_FRAME_MS) {
+        benchmark_audio_codec(AudioCodecType::Opus, frame_ms);
+    }
+}
+
+#endif
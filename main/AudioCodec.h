@@ -0,0 +1,40 @@
+#pragma once
+
+enum class AudioCodecType : uint8_t { PCM, Opus };
+
+const char* audio_codec_type_to_string(AudioCodecType type);
+bool parse_audio_codec_type(const char* value, AudioCodecType& type);
+
+/**
+ * Encoder for a frame based audio codec. Raw PCM doesn't go through an
+ * encoder; it's sent as is.
+ */
+class AudioEncoder {
+public:
+    virtual ~AudioEncoder() {}
+
+    /** Number of PCM bytes that make up one frame. */
+    virtual size_t get_frame_len() = 0;
+
+    /** Encode one frame. Returns the number of bytes written to buffer, or -1 on failure. */
+    virtual int encode(uint8_t* frame, uint8_t* buffer, size_t buffer_len) = 0;
+
+    /** Create an encoder for the codec, or nullptr for raw PCM. */
+    static AudioEncoder* create(AudioCodecType type, uint32_t frame_ms);
+};
+
+class AudioDecoder {
+public:
+    virtual ~AudioDecoder() {}
+
+    /** Decode one packet. Returns the number of samples written, or -1 on failure. */
+    virtual int decode(uint8_t* buffer, size_t buffer_len, int16_t* samples, size_t max_samples) = 0;
+
+    /** Create a decoder for the codec, or nullptr for raw PCM. */
+    static AudioDecoder* create(AudioCodecType type, uint32_t frame_ms);
+};
+
+#ifdef CONFIG_DEVICE_BENCHMARK_CODEC
+/** Log the time it takes to encode and decode a frame, for every codec and frame length. */
+void benchmark_audio_codecs();
+#endif
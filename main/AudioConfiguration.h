@@ -1,13 +1,31 @@
 #pragma once
 
+#include "AudioCodec.h"
+#include "AudioFrame.h"
+#include "LatencyProfile.h"
+
 struct AudioConfiguration {
     float volume_scale_low{};
     float volume_scale_high{};
     bool enable_audio_processing{};
+    // Mixer prebuffer; 0 takes it from the latency profile.
     uint32_t audio_buffer_ms{};
     uint8_t microphone_gain_bits{};
     bool recording_auto_volume_enabled{};
     float recording_smoothing_factor{};
     bool playback_auto_volume_enabled{};
     float playback_target_db{};
+    bool jitter_buffer_adaptive{};
+    float jitter_buffer_percentile{};
+    AudioCodecType codec{};
+    uint32_t frame_ms{};
+    AudioTransportType transport{};
+    // Number of packets protected by a parity packet; 0 disables FEC.
+    uint8_t fec_group_size{};
+    // Mix in 32 bits with per-source gain and a limiter instead of
+    // saturating int16.
+    bool mix_normalized{};
+    // Stop sending audio during silence, except for comfort noise.
+    bool dtx_enabled{};
+    LatencyProfile latency_profile{};
 };
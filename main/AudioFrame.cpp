@@ -0,0 +1,29 @@
+#include "support.h"
+
+#include "AudioFrame.h"
+
+LOG_TAG(AudioFrame);
+
+const char* audio_transport_type_to_string(AudioTransportType type) {
+    switch (type) {
+        case AudioTransportType::Native:
+            return "native";
+        case AudioTransportType::RTP:
+            return "rtp";
+        default:
+            return "unknown";
+    }
+}
+
+bool parse_audio_transport_type(const char* value, AudioTransportType& type) {
+    if (iequals(value, "native")) {
+        type = AudioTransportType::Native;
+        return true;
+    }
+    if (iequals(value, "rtp")) {
+        type = AudioTransportType::RTP;
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// How audio frames are framed on the wire: with our own header, or as
+// RTP (RFC 3550) for interoperability with VoIP equipment.
+enum class AudioTransportType : uint8_t { Native, RTP };
+
+const char* audio_transport_type_to_string(AudioTransportType type);
+bool parse_audio_transport_type(const char* value, AudioTransportType& type);
+
+/**
+ * Header of an audio frame on the wire with the native transport.
+ *
+ * Every packet holds one frame of a fixed, configurable duration. The
+ * packet index increments by one for every packet and is used to detect
+ * loss and reordering. The timestamp is the sample clock of the first
+ * sample of the frame, so the receiver can place audio in time regardless
+ * of the packet size or codec. Both are big endian.
+ */
+struct AudioFrameHeader {
+    uint32_t packet_index;
+    uint32_t timestamp;
+};
+
+static_assert(sizeof(AudioFrameHeader) == 8);
+
+// Comfort noise frames have the two high bits of the packet index set and
+// the rest cleared. Their timestamp is that of the frame they replace and
+// the payload is a single byte with the noise level, as in RFC 3389. They
+// don't take a packet index. Receivers that don't know about comfort noise
+// take them for parity packets and drop them.
+static constexpr uint32_t AUDIO_FRAME_COMFORT_NOISE = 0xC0000000;
+
+// Frame durations we support. Raw PCM frames must also fit in a single datagram.
+static constexpr uint32_t AUDIO_FRAME_MS[] = {10, 20, 40, 60};
+
+static constexpr bool is_valid_audio_frame_ms(uint32_t frame_ms) {
+    for (const auto supported_frame_ms : AUDIO_FRAME_MS) {
+        if (frame_ms == supported_frame_ms) {
+            return true;
+        }
+    }
+    return false;
+}
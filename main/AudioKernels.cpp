@@ -0,0 +1,112 @@
+#include "support.h"
+
+#include "AudioKernels.h"
+
+#include <algorithm>
+
+LOG_TAG(AudioKernels);
+
+static inline int16_t saturate_int16(int32_t value) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    // CLAMPS saturates to the int16 range in a single instruction.
+    int32_t result;
+    asm("clamps %0, %1, 15" : "=a"(result) : "a"(value));
+    return (int16_t)result;
+#else
+    return (int16_t)clamp<int32_t>(value, INT16_MIN, INT16_MAX);
+#endif
+}
+
+static void mix_audio_saturate_scalar(const int16_t* source, int16_t* target, size_t samples) {
+    for (size_t i = 0; i < samples; i++) {
+        target[i] = saturate_int16((int32_t)target[i] + (int32_t)source[i]);
+    }
+}
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+
+typedef int16_t mix_vector_t __attribute__((vector_size(16)));
+typedef uint16_t mix_vector_unsigned_t __attribute__((vector_size(16)));
+
+static constexpr size_t VECTOR_SAMPLES = sizeof(mix_vector_t) / sizeof(int16_t);
+
+static inline mix_vector_t add_saturate(mix_vector_t a, mix_vector_t b) {
+    // Add wrapping around, then replace the lanes that overflowed. Those
+    // have operands of the same sign and a sum of the other sign, and
+    // saturate towards the sign of the operands.
+
+    const auto sum = (mix_vector_t)((mix_vector_unsigned_t)a + (mix_vector_unsigned_t)b);
+    const auto overflow = (mix_vector_t)(((a ^ sum) & (b ^ sum)) < 0);
+    const auto saturated = (mix_vector_t)((a >> 15) ^ INT16_MAX);
+
+    return (overflow & saturated) | (~overflow & sum);
+}
+
+void mix_audio_saturate(const int16_t* source, int16_t* target, size_t samples) {
+    // The buffers needn't be aligned; the loads and stores go through memcpy.
+
+    const auto blocks = samples / VECTOR_SAMPLES;
+
+    for (size_t i = 0; i < blocks; i++) {
+        mix_vector_t a, b;
+        memcpy(&a, target, sizeof(a));
+        memcpy(&b, source, sizeof(b));
+
+        const auto sum = add_saturate(a, b);
+        memcpy(target, &sum, sizeof(sum));
+
+        source += VECTOR_SAMPLES;
+        target += VECTOR_SAMPLES;
+    }
+
+    mix_audio_saturate_scalar(source, target, samples % VECTOR_SAMPLES);
+}
+
+#else
+
+void mix_audio_saturate(const int16_t* source, int16_t* target, size_t samples) {
+    mix_audio_saturate_scalar(source, target, samples);
+}
+
+#endif
+
+void mix_audio_accumulate(const int16_t* source, int32_t* target, size_t samples, int32_t gain) {
+    if (gain == MIX_GAIN_UNITY) {
+        for (size_t i = 0; i < samples; i++) {
+            target[i] += source[i];
+        }
+    } else {
+        for (size_t i = 0; i < samples; i++) {
+            target[i] += ((int32_t)source[i] * gain) >> 15;
+        }
+    }
+}
+
+int32_t mix_audio_accumulate_ramp(const int16_t* source, int32_t* target, size_t samples, int32_t gain,
+                                  int32_t target_gain, int32_t step) {
+    size_t i = 0;
+
+    for (; i < samples && gain != target_gain; i++) {
+        gain = step > 0 ? min(gain + step, target_gain) : max(gain + step, target_gain);
+        target[i] += ((int32_t)source[i] * gain) >> 15;
+    }
+
+    if (i < samples) {
+        mix_audio_accumulate(source + i, target + i, samples - i, gain);
+    }
+
+    return gain;
+}
+
+void convert_microphone_audio(const int32_t* source, int16_t* target, size_t samples, int shift) {
+    for (size_t i = 0; i < samples; i++) {
+        target[i] = saturate_int16((source[i] << 1) >> shift);
+    }
+}
+
+void interleave_audio(const int16_t* left, const int16_t* right, int16_t* target, size_t samples) {
+    for (size_t i = 0; i < samples; i++) {
+        target[i * 2] = left[i];
+        target[i * 2 + 1] = right[i];
+    }
+}
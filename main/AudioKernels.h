@@ -0,0 +1,36 @@
+#pragma once
+
+/**
+ * Sample processing kernels for the audio hot paths.
+ *
+ * These are plain loops the compiler can optimize. On the ESP32-S3,
+ * saturation uses the CLAMPS instruction. Where the compiler has native
+ * 128 bit vectors, the saturating mix adds eight samples at a time. Both
+ * are bit exact with each other.
+ */
+
+/** Add source to target, saturating at the int16 range. */
+void mix_audio_saturate(const int16_t* source, int16_t* target, size_t samples);
+
+// Unity gain for mix_audio_accumulate.
+static constexpr int32_t MIX_GAIN_UNITY = 1 << 15;
+
+/** Add source, scaled by a Q15 gain, to a 32 bit mix. */
+void mix_audio_accumulate(const int16_t* source, int32_t* target, size_t samples, int32_t gain);
+
+/**
+ * Add source to a 32 bit mix, moving the Q15 gain by step every sample until
+ * it reaches target_gain. Returns the gain after the last sample.
+ */
+int32_t mix_audio_accumulate_ramp(const int16_t* source, int32_t* target, size_t samples, int32_t gain,
+                                  int32_t target_gain, int32_t step);
+
+/**
+ * Convert raw 32 bit I2S microphone samples to int16. The bit below the
+ * sign bit becomes the sign bit, then the sample is shifted right by the
+ * given number of bits and saturated.
+ */
+void convert_microphone_audio(const int32_t* source, int16_t* target, size_t samples, int shift);
+
+/** Interleave two mono channels into a stereo buffer. */
+void interleave_audio(const int16_t* left, const int16_t* right, int16_t* target, size_t samples);
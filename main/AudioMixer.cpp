@@ -4,66 +4,431 @@
 
 #include <algorithm>
 
+#include "AudioKernels.h"
+
 LOG_TAG(AudioMixer);
 
-AudioMixer::~AudioMixer() { free(_buffer); }
+AudioMixer::~AudioMixer() { release(); }
+
+void AudioMixer::release() {
+    free(_buffer);
+    _buffer = nullptr;
+    free(_mix_buffer);
+    _mix_buffer = nullptr;
+    free(_decode_buffer);
+    _decode_buffer = nullptr;
+    _decode_buffer_samples = 0;
+    free(_resample_buffer);
+    _resample_buffer = nullptr;
+    delete[] _sources;
+    _sources = nullptr;
+    _sources_len = 0;
+    delete[] _hole_plcs;
+    _hole_plcs = nullptr;
+    _free_hole_plcs_len = 0;
+}
+
+void AudioMixer::initialize(const AudioConfiguration& audio_config) {
+    // We may be reconfigured; this starts from scratch, including the
+    // history of the sources.
+    release();
 
-void AudioMixer::initialize(uint32_t buffer_len_ms) {
-    _audio_buffer_len = AUDIO_BUFFER_LEN(buffer_len_ms);
+    const auto latency_settings = get_latency_settings(audio_config);
+
+    _audio_buffer_len = AUDIO_BUFFER_LEN(latency_settings.audio_buffer_ms);
+    _chunk_len = AUDIO_BUFFER_LEN(latency_settings.chunk_ms);
     _buffer_len = _audio_buffer_len * 2;
-    _buffer = (uint8_t*)heap_caps_malloc(_buffer_len, MALLOC_CAP_INTERNAL);
-    ESP_ERROR_ASSERT(_buffer);
+    _mix_normalized = audio_config.mix_normalized;
+    if (_mix_normalized) {
+        _mix_buffer = (int32_t*)heap_caps_malloc(_buffer_len / sizeof(int16_t) * sizeof(int32_t), MALLOC_CAP_INTERNAL);
+        ESP_ERROR_ASSERT(_mix_buffer);
+    } else {
+        _buffer = (uint8_t*)heap_caps_malloc(_buffer_len, MALLOC_CAP_INTERNAL);
+        ESP_ERROR_ASSERT(_buffer);
+    }
+
+    _jitter_buffer_adaptive = audio_config.jitter_buffer_adaptive;
+    _jitter_buffer_percentile = clamp(audio_config.jitter_buffer_percentile, 0.0f, 1.0f);
+
+    _codec = audio_config.codec;
+    _frame_ms = audio_config.frame_ms;
+    _transport = audio_config.transport;
+    _rtp_payload_type = get_rtp_payload_type(_codec);
+    _rtp_timestamp_scale = get_rtp_timestamp_scale(_codec);
+
+    if (_codec != AudioCodecType::PCM) {
+        _decode_buffer_samples = US_TO_SAMPLES(_frame_ms * 1000);
+        _decode_buffer = (int16_t*)heap_caps_malloc(_decode_buffer_samples * sizeof(int16_t), MALLOC_CAP_INTERNAL);
+        ESP_ERROR_ASSERT(_decode_buffer);
+    }
+
+    // Drift compensation may stretch a packet by a little.
+
+    _resample_buffer_samples = FractionalResampler::get_max_output_len(
+        max(_decode_buffer_samples, UDPServer::PAYLOAD_LEN / sizeof(int16_t)));
+    _resample_buffer = (int16_t*)heap_caps_malloc(_resample_buffer_samples * sizeof(int16_t), MALLOC_CAP_INTERNAL);
+    ESP_ERROR_ASSERT(_resample_buffer);
+
+    _sources_len = CONFIG_DEVICE_AUDIO_MAX_SOURCES;
+    _sources = new Source[_sources_len];
+    ESP_ERROR_ASSERT(_sources);
+    for (size_t i = 0; i < _sources_len; i++) {
+        _sources[i].drift.begin(latency_settings.chunk_ms);
+    }
+
+    _hole_plcs = new PacketLossConcealment[MAX_HOLE_PLCS];
+    ESP_ERROR_ASSERT(_hole_plcs);
+
+    _concealed_samples = 0;
+    _dropped_samples = 0;
 
     reset();
 }
 
-bool AudioMixer::has_data() { return _write_offsets.size() > 0; }
+bool AudioMixer::get_drift(sockaddr_in* source_addr, float& drift_ppm, int32_t& fill_error) {
+    for (size_t i = 0; i < _sources_len; i++) {
+        auto& source = _sources[i];
+
+        if (source.active && source.addr == source_addr->sin_addr.s_addr && source.port == source_addr->sin_port) {
+            drift_ppm = source.drift.get_drift_ppm();
+            fill_error = get_buffered_samples(source, esp_timer_get_time()) -
+                         (int32_t)(get_playout_delay_len(source) / sizeof(int16_t));
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool AudioMixer::has_data() {
+    return any_of(_sources, _sources + _sources_len, [](const auto& source) { return source.active; });
+}
 
 void AudioMixer::reset() {
     _read_offset = 0;
-    _write_offsets.clear();
+    _last_take_time = 0;
+    _last_take_len = 0;
 
-    memset(_buffer, 0, _buffer_len);
+    // Keep the sources around so their jitter history carries over into the
+    // next playback session.
+
+    for (size_t i = 0; i < _sources_len; i++) {
+        _sources[i].active = false;
+        _sources[i].hole_count = 0;
+        _sources[i].comfort_noise_active = false;
+    }
+
+    for (size_t i = 0; i < MAX_HOLE_PLCS; i++) {
+        _free_hole_plcs[i] = &_hole_plcs[i];
+    }
+    _free_hole_plcs_len = MAX_HOLE_PLCS;
+
+    if (_mix_normalized) {
+        memset(_mix_buffer, 0, _buffer_len / sizeof(int16_t) * sizeof(int32_t));
+        _limiter.reset();
+    } else {
+        memset(_buffer, 0, _buffer_len);
+    }
 }
 
-void AudioMixer::append(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len) {
-    if (buffer_len < 4) {
+void AudioMixer::append(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len, int64_t arrival_time) {
+    const auto source_ptr = find_source(source_addr, arrival_time);
+    if (!source_ptr) {
+        ESP_LOGW(TAG, "Dropping incoming packet; no room for another source");
+        return;
+    }
+
+    auto& source = *source_ptr;
+
+    if (_transport == AudioTransportType::RTP) {
+        append_rtp(source, buffer, buffer_len, arrival_time);
+        return;
+    }
+
+    if (buffer_len < sizeof(AudioFrameHeader)) {
         ESP_LOGW(TAG, "Invalid incoming buffer length");
         return;
     }
 
-    // If we don't have a write offset for this topic, we need to
-    // start buffering.
+    const auto header = (AudioFrameHeader*)buffer;
+    const auto header_packet_index = ntohl(header->packet_index);
+    const auto timestamp = ntohl(header->timestamp);
+
+    buffer += sizeof(AudioFrameHeader);
+    buffer_len -= sizeof(AudioFrameHeader);
+
+    if (header_packet_index == AUDIO_FRAME_COMFORT_NOISE) {
+        append_comfort_noise(source, buffer, buffer_len, arrival_time);
+        return;
+    }
+
+    if (header_packet_index & FEC_PARITY_FLAG) {
+        append_parity(source, (int32_t)(header_packet_index & ~FEC_PARITY_FLAG), buffer, buffer_len, arrival_time);
+        return;
+    }
+
+    if (!source.active) {
+        restart(source);
+    }
+
+    auto packet_index = (int32_t)header_packet_index;
+    if (packet_index <= source.packet_index) {
+        append_late(source, packet_index, timestamp, buffer, buffer_len);
+        return;
+    }
+
+    source.fec.add(packet_index, timestamp, buffer, buffer_len);
+
+    append_packet(source, packet_index, timestamp, buffer, buffer_len, arrival_time);
+}
+
+AudioMixer::Source* AudioMixer::find_source(sockaddr_in* source_addr, int64_t now) {
+    const auto addr = source_addr->sin_addr.s_addr;
+    const auto port = source_addr->sin_port;
+
+    Source* free_source = nullptr;
+
+    for (size_t i = 0; i < _sources_len; i++) {
+        auto& source = _sources[i];
+
+        if (!source.in_use) {
+            if (!free_source) {
+                free_source = &source;
+            }
+        } else if (source.addr == addr && source.port == port) {
+            return &source;
+        }
+    }
+
+    // Without a free slot, take over the source that's been quiet the longest.
+
+    if (!free_source) {
+        for (size_t i = 0; i < _sources_len; i++) {
+            auto& source = _sources[i];
+
+            if (!source.active && (!free_source || source.last_arrival < free_source->last_arrival)) {
+                free_source = &source;
+            }
+        }
+
+        if (!free_source) {
+            return nullptr;
+        }
+
+        evict(*free_source);
+    }
+
+    free_source->in_use = true;
+    free_source->addr = addr;
+    free_source->port = port;
+    free_source->last_arrival = now;
+
+    return free_source;
+}
+
+void AudioMixer::evict(Source& source) {
+    // The slot is reused by another source, so forget everything we know
+    // about this one. The decoder is kept to not reallocate it.
+
+    source.in_use = false;
+    source.active = false;
+    clear_holes(source);
+    source.comfort_noise_active = false;
+    source.jitter.reset();
+    source.drift.reset();
+}
+
+void AudioMixer::append_rtp(Source& source, uint8_t* buffer, size_t buffer_len, int64_t now) {
+    RTPPacket packet;
+    if (!parse_rtp_packet(buffer, buffer_len, packet)) {
+        ESP_LOGW(TAG, "Invalid incoming RTP packet");
+        return;
+    }
+
+    if (packet.payload_type == RTP_PAYLOAD_TYPE_CN) {
+        // Comfort noise takes a sequence number, so it isn't taken for a
+        // lost packet.
+
+        if (source.active && packet.ssrc == source.ssrc) {
+            const auto packet_index =
+                source.packet_index + (int16_t)(packet.sequence - (uint16_t)source.packet_index);
+            if (packet_index > source.packet_index) {
+                source.packet_index = packet_index;
+
+                append_comfort_noise(source, packet.payload, packet.payload_len, now);
+            }
+        }
+        return;
+    }
+
+    if (packet.payload_type != _rtp_payload_type) {
+        ESP_LOGW(TAG, "Dropping incoming packet; unexpected payload type %d", packet.payload_type);
+        return;
+    }
+
+    if (source.active && packet.ssrc != source.ssrc) {
+        ESP_LOGI(TAG, "Source changed SSRC; start buffering again");
+        source.active = false;
+    }
+
+    // RTP timestamps are taken relative to the start of the stream, and
+    // converted to samples.
+
+    if (!source.active) {
+        restart(source);
+
+        source.ssrc = packet.ssrc;
+        source.rtp_timestamp_base = packet.timestamp;
+    }
+
+    // Extend the 16 bit sequence number to a packet index.
+
+    int32_t packet_index = packet.sequence;
+    if (source.packet_index >= 0) {
+        packet_index = source.packet_index + (int16_t)(packet.sequence - (uint16_t)source.packet_index);
+    }
 
-    const auto key = make_tuple(source_addr->sin_addr.s_addr, source_addr->sin_port);
+    const auto timestamp =
+        (uint32_t)((int32_t)(packet.timestamp - source.rtp_timestamp_base) / (int32_t)_rtp_timestamp_scale);
+
+    if (_codec == AudioCodecType::PCM) {
+        // L16 is big endian.
+        swap_l16((int16_t*)packet.payload, (int16_t*)packet.payload, packet.payload_len / sizeof(int16_t));
+    }
 
-    WriteOffset write_offset;
-    if (auto entry = _write_offsets.find(key); entry != _write_offsets.end()) {
-        write_offset = entry->second;
+    if (packet_index <= source.packet_index) {
+        append_late(source, packet_index, timestamp, packet.payload, packet.payload_len);
     } else {
-        write_offset = {
-            .offset = _read_offset + _audio_buffer_len,
-            .packet_index = -1,
-        };
+        append_packet(source, packet_index, timestamp, packet.payload, packet.payload_len, now);
     }
+}
 
-    auto packet_index = (int32_t)ntohl(*(uint32_t*)buffer);
-    if (packet_index < write_offset.packet_index) {
-        ESP_LOGW(TAG, "Dropping incoming packet; packet index %d, write offset packet index %d", (int)packet_index,
-                 (int)write_offset.packet_index);
+void AudioMixer::restart(Source& source) {
+    // The source isn't active, so we need to start buffering.
+
+    source.packet_index = -1;
+    source.jitter.restart();
+    source.drift.restart();
+    source.resampler.reset();
+    source.plc.reset();
+    source.fec.reset();
+    clear_holes(source);
+    source.comfort_noise_active = false;
+}
+
+void AudioMixer::append_packet(Source& source, int32_t packet_index, uint32_t timestamp, uint8_t* buffer,
+                               size_t buffer_len, int64_t now) {
+    if (!decode(source, buffer, buffer_len)) {
         return;
     }
 
-    buffer += sizeof(int32_t);
-    buffer_len -= sizeof(int32_t);
+    // Timestamps follow the clock of the sender; the resampled audio follows ours.
+
+    const auto samples = buffer_len / sizeof(int16_t);
+
+    resample(source, buffer, buffer_len);
+
+    source.jitter.add(now, SAMPLES_TO_US((int64_t)timestamp));
+    source.last_arrival = now;
+    source.comfort_noise_active = false;
+
+    const auto playout_delay_len = get_playout_delay_len(source);
+
+    if (!source.active) {
+        ESP_LOGI(TAG, "Start buffering source with a playout delay of %d ms",
+                 (int)(SAMPLES_TO_US(playout_delay_len / sizeof(int16_t)) / 1000));
+
+        source.offset = _read_offset + playout_delay_len;
+        source.active = true;
+    } else {
+        source.drift.add(now, get_buffered_samples(source, now), (int32_t)(playout_delay_len / sizeof(int16_t)));
+
+        // Place the packet based on its timestamp. Audio that went missing
+        // in between is concealed.
+
+        const auto missing = packet_index - source.packet_index - 1;
+        const auto gap = (int32_t)(timestamp - source.expected_timestamp);
+        const auto position = source.expected_offset + (ptrdiff_t)gap * (ptrdiff_t)sizeof(int16_t);
+
+        if (position > source.offset && position - _read_offset > _buffer_len) {
+            ESP_LOGW(TAG, "Missed %d ms of audio; start buffering again", (int)(SAMPLES_TO_US(gap) / 1000));
+
+            conceal_holes(source, SIZE_MAX);
+
+            source.plc.reset();
+            source.offset = max(source.offset, _read_offset + playout_delay_len);
+        } else if (position > source.offset) {
+            if (missing > 0) {
+                // The missing packets may still arrive late, or be recovered
+                // from a parity packet.
+
+                open_hole(source, missing, source.expected_timestamp, position, (int16_t*)buffer,
+                          buffer_len / sizeof(int16_t));
+            } else {
+                conceal(source, position);
+            }
+        } else if (position < source.offset) {
+            // The start of the packet has already been concealed.
+
+            const auto overlap = min(source.offset - position, buffer_len);
+
+            buffer += overlap;
+            buffer_len -= overlap;
+        } else {
+            // If we've buffered more than we need, shrink the playout delay by
+            // dropping quiet samples from the head of the packet.
+            //
+            // If the jitter went up, grow it by repeating them instead, so
+            // the packets that are now late don't have to be concealed. The
+            // playout delay we have is what this packet would've found
+            // buffered had it arrived on time. The drift compensation holds
+            // that half a chunk below the target, so it's only grown once
+            // it falls a chunk behind, and back up to where it's held.
+
+            const auto buffered = source.offset - _read_offset;
+            const auto on_time_buffered = (ptrdiff_t)buffered - (ptrdiff_t)get_played_len(now) +
+                                          (ptrdiff_t)(US_TO_SAMPLES(source.jitter.get_last_lateness_us()) *
+                                                      sizeof(int16_t));
+
+            if (buffered > playout_delay_len + _chunk_len) {
+                const auto drop = get_quiet_len((int16_t*)buffer, min(buffered - playout_delay_len, buffer_len));
+
+                buffer += drop;
+                buffer_len -= drop;
+            } else if (on_time_buffered + (ptrdiff_t)_chunk_len < (ptrdiff_t)playout_delay_len) {
+                const auto stretch_target = (ptrdiff_t)(playout_delay_len - _chunk_len / 2);
+                const auto max_stretch = min((size_t)(stretch_target - on_time_buffered),
+                                             playout_delay_len + _chunk_len - buffered);
+                const auto stretch = get_quiet_len((int16_t*)buffer, min(max_stretch, buffer_len));
+
+                if (stretch) {
+                    source.plc.add((int16_t*)buffer, stretch / sizeof(int16_t));
+
+                    mix_at(source, source.offset, buffer, stretch);
+
+                    source.offset += stretch;
+                }
+            }
+        }
+    }
+
+    source.packet_index = packet_index;
+    source.expected_timestamp = timestamp + samples;
+    source.expected_offset = source.offset + buffer_len;
 
-    auto available = _buffer_len - (write_offset.offset - _read_offset);
+    if (!buffer_len) {
+        return;
+    }
+
+    auto available = _buffer_len - (source.offset - _read_offset);
     if (available <= 0) {
         ESP_LOGW(TAG, "Dropping incoming packet; no buffer available");
+        _dropped_samples += buffer_len / sizeof(int16_t);
         return;
     }
     if (available < buffer_len) {
         ESP_LOGW(TAG, "Dropping part of incoming sample available %d buffer_len %d", (int)available, (int)buffer_len);
+        _dropped_samples += (buffer_len - available) / sizeof(int16_t);
     }
 
     ESP_ERROR_ASSERT(available > 0 && available <= _buffer_len);
@@ -71,41 +436,440 @@ void AudioMixer::append(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer
     ESP_ERROR_ASSERT(copy > 0 && copy <= buffer_len);
     auto buffer_offset = buffer_len - copy;
 
-    auto write_offset_mod = write_offset.offset % _buffer_len;
+    // This also cross-fades out of concealment.
+    source.plc.add((int16_t*)(buffer + buffer_offset), copy / sizeof(int16_t));
+
+    mix_at(source, source.offset, buffer + buffer_offset, copy);
+
+    source.offset += copy;
+}
+
+void AudioMixer::append_late(Source& source, int32_t packet_index, uint32_t timestamp, uint8_t* buffer,
+                             size_t buffer_len) {
+    // A late packet is only of use if its audio hasn't been concealed yet.
+
+    const auto index = find_hole(source, packet_index);
+    if (index < 0) {
+        ESP_LOGW(TAG, "Dropping incoming packet; packet index %d, write offset packet index %d", (int)packet_index,
+                 (int)source.packet_index);
+        return;
+    }
+
+    // This is ignored if the parity of its group has already been processed.
+    source.fec.add(packet_index, timestamp, buffer, buffer_len);
+
+    if (decode(source, buffer, buffer_len)) {
+        fill_hole(source, index, packet_index, timestamp, buffer, buffer_len);
+    }
+}
+
+void AudioMixer::append_parity(Source& source, int32_t first_packet_index, uint8_t* buffer, size_t buffer_len,
+                               int64_t now) {
+    int32_t packet_index;
+    uint32_t timestamp;
+    auto payload_len = source.fec.recover(first_packet_index, buffer, buffer_len, packet_index, timestamp);
+    if (!payload_len) {
+        return;
+    }
+
+    if (!source.active) {
+        return;
+    }
 
-    auto chunk1 = min(_buffer_len - write_offset_mod, copy);
-    ESP_ERROR_ASSERT(chunk1 > 0 && chunk1 <= buffer_len + buffer_offset);
-    ESP_ERROR_ASSERT(chunk1 > 0 && chunk1 <= _buffer_len + write_offset_mod);
+    auto payload = source.fec.get_payload();
 
-    mix_audio((int16_t*)(buffer + buffer_offset), (int16_t*)(_buffer + write_offset_mod), chunk1 / sizeof(int16_t));
+    // If the last packet of the group went missing, we haven't noticed yet
+    // and the recovered packet is simply the next one. Otherwise we can only
+    // use it if it's in a hole that hasn't been played yet.
+
+    if (packet_index == source.packet_index + 1) {
+        append_packet(source, packet_index, timestamp, payload, payload_len, now);
+    } else {
+        const auto index = find_hole(source, packet_index);
+        if (index >= 0 && decode(source, payload, payload_len)) {
+            fill_hole(source, index, packet_index, timestamp, payload, payload_len);
+        }
+    }
+}
 
-    if (chunk1 < copy) {
-        auto chunk2 = copy - chunk1;
+void AudioMixer::append_comfort_noise(Source& source, uint8_t* buffer, size_t buffer_len, int64_t now) {
+    // Comfort noise only continues a stream we're playing; it doesn't
+    // start one.
+
+    if (!source.active || buffer_len < 1) {
+        return;
+    }
+
+    source.last_arrival = now;
+    source.comfort_noise_active = true;
+    source.comfort_noise.set_level(buffer[0]);
+}
+
+bool AudioMixer::decode(Source& source, uint8_t*& buffer, size_t& buffer_len) {
+    if (_codec == AudioCodecType::PCM) {
+        return true;
+    }
+
+    if (!source.decoder) {
+        source.decoder.reset(AudioDecoder::create(_codec, _frame_ms));
+    }
+
+    // A packet we can't decode is treated as lost.
+
+    const auto samples = source.decoder->decode(buffer, buffer_len, _decode_buffer, _decode_buffer_samples);
+    if (samples <= 0) {
+        return false;
+    }
+
+    buffer = (uint8_t*)_decode_buffer;
+    buffer_len = samples * sizeof(int16_t);
+
+    return true;
+}
+
+void AudioMixer::resample(Source& source, uint8_t*& buffer, size_t& buffer_len) {
+    const auto samples = source.resampler.process((int16_t*)buffer, buffer_len / sizeof(int16_t), _resample_buffer,
+                                                  _resample_buffer_samples, source.drift.get_ratio());
+
+    buffer = (uint8_t*)_resample_buffer;
+    buffer_len = samples * sizeof(int16_t);
+}
+
+size_t AudioMixer::get_played_len(int64_t now) {
+    // The read offset jumps ahead a chunk at a time. Interpolate how far the
+    // playback device got into the last chunk, so the fill level doesn't
+    // depend on when the packet arrived relative to the chunk boundary.
+
+    return min((size_t)US_TO_SAMPLES(max(now - _last_take_time, (int64_t)0)) * sizeof(int16_t), _last_take_len);
+}
+
+int32_t AudioMixer::get_buffered_samples(Source& source, int64_t now) {
+    return (int32_t)((ptrdiff_t)(source.offset - _read_offset) / (ptrdiff_t)sizeof(int16_t)) -
+           (int32_t)(get_played_len(now) / sizeof(int16_t)) +
+           // Hold the fill level half a chunk below the playout delay,
+           // keeping it clear of the threshold for dropping samples.
+           (int32_t)(_chunk_len / sizeof(int16_t) / 2);
+}
+
+void AudioMixer::conceal(Source& source, size_t end_offset) {
+    int16_t samples[CONCEAL_CHUNK_SAMPLES];
+
+    while (source.offset < end_offset) {
+        const auto len = min(end_offset - source.offset, sizeof(samples));
+
+        if (!source.plc.is_exhausted()) {
+            source.plc.conceal(samples, len / sizeof(int16_t));
+
+            mix_at(source, source.offset, (uint8_t*)samples, len);
+        }
+
+        source.offset += len;
+        _concealed_samples += len / sizeof(int16_t);
+    }
+}
+
+void AudioMixer::play_comfort_noise(Source& source, size_t end_offset) {
+    int16_t samples[CONCEAL_CHUNK_SAMPLES];
+
+    while (source.offset < end_offset) {
+        const auto len = min(end_offset - source.offset, sizeof(samples));
+
+        source.comfort_noise.generate(samples, len / sizeof(int16_t));
+
+        // If audio resumes with a gap, it's concealed from the noise.
+        source.plc.add(samples, len / sizeof(int16_t));
+
+        mix_at(source, source.offset, (uint8_t*)samples, len);
+
+        source.offset += len;
+    }
+}
+
+void AudioMixer::open_hole(Source& source, int32_t packet_count, uint32_t timestamp, size_t end_offset,
+                           int16_t* samples, size_t samples_len) {
+    // Make room by concealing the hole that will be played first.
+
+    if (source.hole_count == MAX_HOLES) {
+        conceal_hole(source, 0);
+    }
+
+    const auto plc = take_hole_plc(nullptr);
+
+    auto& hole = source.holes[source.hole_count++];
+
+    hole.offset = source.offset;
+    hole.len = end_offset - source.offset;
+    hole.packet_index = source.packet_index + 1;
+    hole.packet_count = packet_count;
+    hole.timestamp = timestamp;
+    hole.plc = plc;
+    *hole.plc = source.plc;
+
+    // Fade in the audio following the hole. The original is kept to
+    // restore it when the hole is filled.
+
+    hole.fade_len = min(samples_len, PacketLossConcealment::OVERLAP);
+    memcpy(hole.fade, samples, hole.fade_len * sizeof(int16_t));
+    PacketLossConcealment::apply_fade_in(samples, hole.fade_len);
+
+    source.offset = end_offset;
+}
+
+int AudioMixer::find_hole(Source& source, int32_t packet_index) {
+    for (size_t i = 0; i < source.hole_count; i++) {
+        const auto& hole = source.holes[i];
+
+        if (packet_index >= hole.packet_index && packet_index < hole.packet_index + hole.packet_count) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+void AudioMixer::fill_hole(Source& source, int index, int32_t packet_index, uint32_t timestamp, uint8_t* buffer,
+                           size_t buffer_len) {
+    // The audio around the hole went through the drift resampler, so this
+    // packet does too. It doesn't continue the audio before it, so it gets a
+    // resampler of its own. This also leaves the packet alone, which may be a
+    // queue slot, a pbuf or the recovered payload; the copy is ours to fade.
+
+    const auto ratio = source.drift.get_ratio();
+    FractionalResampler resampler;
+    const auto samples = _resample_buffer;
+    const auto resampled = resampler.process((int16_t*)buffer, buffer_len / sizeof(int16_t), samples,
+                                             _resample_buffer_samples, ratio);
+
+    auto hole = &source.holes[index];
+
+    // Place the packet in the hole based on its timestamp. What remains of
+    // the hole before and after it stays open.
+
+    const auto hole_end = hole->offset + hole->len;
+    const auto gap = (int32_t)lroundf((float)(int32_t)(timestamp - hole->timestamp) / ratio);
+    const auto position =
+        clamp(hole->offset + (ptrdiff_t)gap * (ptrdiff_t)sizeof(int16_t), hole->offset, hole_end);
+    const auto len = min(resampled * sizeof(int16_t), hole_end - position);
+    const auto samples_len = len / sizeof(int16_t);
+
+    if (position + len < hole_end) {
+        if (source.hole_count == MAX_HOLES) {
+            conceal_hole(source, index == 0 ? 1 : 0);
+        }
+
+        // Taking a concealment state may conceal another hole, which moves
+        // this one.
+        const auto plc = take_hole_plc(&source.holes[find_hole(source, packet_index)]);
+
+        index = find_hole(source, packet_index);
+        hole = &source.holes[index];
+
+        for (auto i = (int)source.hole_count; i > index + 1; i--) {
+            source.holes[i] = source.holes[i - 1];
+        }
+        source.hole_count++;
+
+        auto& after = source.holes[index + 1];
+
+        after = *hole;
+        after.offset = position + len;
+        after.len = hole_end - after.offset;
+        after.packet_index = packet_index + 1;
+        after.packet_count = hole->packet_index + hole->packet_count - after.packet_index;
+        after.timestamp = timestamp + buffer_len / sizeof(int16_t);
+        after.plc = plc;
+        *after.plc = *hole->plc;
+        after.plc->add(samples, samples_len);
+    } else if (hole->fade_len) {
+        // Complete the faded in audio following the hole.
+
+        PacketLossConcealment::apply_fade_out(hole->fade, hole->fade_len);
+
+        mix_at(source, hole_end, (uint8_t*)hole->fade, hole->fade_len * sizeof(int16_t));
+    }
+
+    if (position > hole->offset) {
+        hole->len = position - hole->offset;
+        hole->packet_count = packet_index - hole->packet_index;
+
+        hole->fade_len = min(samples_len, PacketLossConcealment::OVERLAP);
+        memcpy(hole->fade, samples, hole->fade_len * sizeof(int16_t));
+        PacketLossConcealment::apply_fade_in(samples, hole->fade_len);
+    } else {
+        remove_hole(source, index);
+    }
+
+    if (len) {
+        mix_at(source, position, (uint8_t*)samples, len);
+    }
+}
+
+void AudioMixer::conceal_holes(Source& source, size_t end_offset) {
+    while (source.hole_count && source.holes[0].offset < end_offset) {
+        conceal_hole(source, 0);
+    }
+}
+
+void AudioMixer::conceal_hole(Source& source, int index) {
+    auto& hole = source.holes[index];
+
+    int16_t samples[CONCEAL_CHUNK_SAMPLES];
+
+    for (size_t offset = 0; offset < hole.len;) {
+        const auto len = min(hole.len - offset, sizeof(samples));
+
+        hole.plc->conceal(samples, len / sizeof(int16_t));
+
+        mix_at(source, hole.offset + offset, (uint8_t*)samples, len);
+
+        offset += len;
+    }
+
+    _concealed_samples += hole.len / sizeof(int16_t);
+
+    // Cross-fade into the audio following the hole.
+
+    if (hole.fade_len) {
+        hole.plc->fade_out(samples, hole.fade_len);
+
+        mix_at(source, hole.offset + hole.len, (uint8_t*)samples, hole.fade_len * sizeof(int16_t));
+    }
+
+    remove_hole(source, index);
+}
+
+void AudioMixer::remove_hole(Source& source, int index) {
+    _free_hole_plcs[_free_hole_plcs_len++] = source.holes[index].plc;
+
+    for (auto i = (size_t)index + 1; i < source.hole_count; i++) {
+        source.holes[i - 1] = source.holes[i];
+    }
+    source.hole_count--;
+}
+
+void AudioMixer::clear_holes(Source& source) {
+    while (source.hole_count) {
+        remove_hole(source, (int)source.hole_count - 1);
+    }
+}
+
+PacketLossConcealment* AudioMixer::take_hole_plc(const Hole* keep) {
+    // If they're all taken, conceal the hole of any source that will be
+    // played first, other than the one we're splitting.
+
+    if (!_free_hole_plcs_len) {
+        Source* first_source = nullptr;
+        int first_index = -1;
+
+        for (size_t i = 0; i < _sources_len; i++) {
+            auto& source = _sources[i];
+
+            for (size_t j = 0; j < source.hole_count; j++) {
+                if (&source.holes[j] != keep &&
+                    (!first_source || source.holes[j].offset < first_source->holes[first_index].offset)) {
+                    first_source = &source;
+                    first_index = (int)j;
+                }
+            }
+        }
+
+        ESP_ERROR_ASSERT(first_source);
+
+        conceal_hole(*first_source, first_index);
+    }
+
+    return _free_hole_plcs[--_free_hole_plcs_len];
+}
+
+void AudioMixer::mix_at(Source& source, size_t offset, uint8_t* buffer, size_t buffer_len) {
+    ESP_ERROR_ASSERT(buffer_len > 0 && buffer_len <= _buffer_len);
+
+    auto offset_mod = offset % _buffer_len;
+
+    auto chunk1 = min(_buffer_len - offset_mod, buffer_len);
+    ESP_ERROR_ASSERT(chunk1 > 0 && chunk1 <= buffer_len);
+
+    mix_chunk(source, offset_mod, (int16_t*)buffer, chunk1 / sizeof(int16_t));
+
+    if (chunk1 < buffer_len) {
+        auto chunk2 = buffer_len - chunk1;
 
-        ESP_ERROR_ASSERT(chunk2 > 0 && chunk2 <= buffer_len);
         ESP_ERROR_ASSERT(chunk2 > 0 && chunk2 <= _buffer_len);
 
-        mix_audio((int16_t*)(buffer + buffer_offset + chunk1), (int16_t*)_buffer, chunk2 / sizeof(int16_t));
+        mix_chunk(source, 0, (int16_t*)(buffer + chunk1), chunk2 / sizeof(int16_t));
     }
+}
 
-    _write_offsets[key] = {
-        .offset = write_offset.offset + copy,
-        .packet_index = packet_index,
-    };
+void AudioMixer::mix_chunk(Source& source, size_t offset_mod, int16_t* samples, size_t len) {
+    if (_mix_normalized) {
+        source.gain = mix_audio_accumulate_ramp(samples, _mix_buffer + offset_mod / sizeof(int16_t), len, source.gain,
+                                                source.target_gain, source.gain_step);
+    } else {
+        mix_audio_saturate(samples, (int16_t*)(_buffer + offset_mod), len);
+    }
 }
 
-void AudioMixer::mix_audio(int16_t* source, int16_t* target, size_t samples) {
-    for (int i = 0; i < samples; i++) {
-        auto source_sample = (int32_t)source[i];
-        auto target_sample = (int32_t)target[i];
+size_t AudioMixer::get_playout_delay_len(Source& source) {
+    if (!_jitter_buffer_adaptive) {
+        return _audio_buffer_len;
+    }
+
+    // Without enough history we fall back to the configured buffer length.
 
-        target[i] = clamp<int32_t>(target_sample + source_sample, INT16_MIN, INT16_MAX);
+    const auto lateness_us = source.jitter.get_lateness_us(_jitter_buffer_percentile);
+    if (lateness_us < 0) {
+        return _audio_buffer_len;
     }
+
+    // The playout delay must cover the lateness of the packets, plus the chunk
+    // the playback device takes from us in one go.
+
+    const auto delay_len = (size_t)(US_TO_SAMPLES(lateness_us) * sizeof(int16_t)) + _chunk_len;
+
+    return min(max(delay_len, _chunk_len * 2), _audio_buffer_len);
+}
+
+size_t AudioMixer::get_quiet_len(int16_t* samples, size_t max_len) {
+    const auto max_samples = min(max_len / sizeof(int16_t), MAX_DROP_SAMPLES);
+
+    size_t quiet = 0;
+    while (quiet < max_samples && abs(samples[quiet]) < MAX_DROP_LEVEL) {
+        quiet++;
+    }
+
+    return quiet * sizeof(int16_t);
 }
 
 void AudioMixer::take(uint8_t* buffer, size_t buffer_len) {
     ESP_ERROR_ASSERT(buffer_len <= _buffer_len);
 
+    // Conceal sources that don't have enough audio buffered for this read.
+
+    const auto now = esp_timer_get_time();
+    const auto end_offset = _read_offset + buffer_len;
+
+    for (size_t i = 0; i < _sources_len; i++) {
+        auto& source = _sources[i];
+
+        if (source.active) {
+            conceal_holes(source, end_offset);
+        }
+
+        // A silent sender keeps the source alive with comfort noise until it
+        // stops repeating it.
+
+        if (source.comfort_noise_active && now - source.last_arrival > COMFORT_NOISE_TIMEOUT_US) {
+            source.comfort_noise_active = false;
+        }
+
+        if (source.active && source.comfort_noise_active) {
+            play_comfort_noise(source, end_offset);
+        } else if (source.active && source.offset < end_offset && source.plc.has_history() &&
+                   !source.plc.is_exhausted()) {
+            conceal(source, end_offset);
+        }
+    }
+
     auto read_offset_mod = (int)(_read_offset % _buffer_len);
     auto chunk1 = min(_buffer_len - read_offset_mod, buffer_len);
 
@@ -113,23 +877,86 @@ void AudioMixer::take(uint8_t* buffer, size_t buffer_len) {
     ESP_ERROR_ASSERT(chunk1 <= buffer_len);
     ESP_ERROR_ASSERT(chunk1 + read_offset_mod <= _buffer_len);
 
-    memcpy(buffer, _buffer + read_offset_mod, chunk1);
-    memset(_buffer + read_offset_mod, 0, chunk1);
+    take_chunk(read_offset_mod, buffer, chunk1);
 
     if (chunk1 < buffer_len) {
         auto chunk2 = buffer_len - chunk1;
 
         ESP_ERROR_ASSERT(chunk2 > 0 && chunk2 <= buffer_len && chunk2 <= _buffer_len);
 
-        memcpy(buffer + chunk1, _buffer, chunk2);
-        memset(_buffer, 0, chunk2);
+        take_chunk(0, buffer + chunk1, chunk2);
     }
 
     _read_offset += buffer_len;
 
-    // If any of the topics write offsets is less than what we've
+    _last_take_time = now;
+    _last_take_len = buffer_len;
+
+    // If any of the sources write offsets is less than what we've
     // read, it means we didn't have enough buffered. Start
-    // buffering again.
+    // buffering again. Sources that have been quiet for a long
+    // time are forgotten.
+
+    for (size_t i = 0; i < _sources_len; i++) {
+        auto& source = _sources[i];
 
-    erase_if(_write_offsets, [this](const auto& pair) { return pair.second.offset < _read_offset; });
+        if (source.active && source.offset < _read_offset) {
+            source.active = false;
+        }
+
+        if (source.in_use && !source.active && now - source.last_arrival > SOURCE_EVICT_US) {
+            evict(source);
+        }
+    }
+
+    if (_mix_normalized) {
+        update_gains();
+    }
+}
+
+void AudioMixer::take_chunk(size_t offset_mod, uint8_t* buffer, size_t buffer_len) {
+    if (_mix_normalized) {
+        const auto samples = _mix_buffer + offset_mod / sizeof(int16_t);
+        const auto len = buffer_len / sizeof(int16_t);
+
+        _limiter.process(samples, (int16_t*)buffer, len);
+        memset(samples, 0, len * sizeof(int32_t));
+    } else {
+        memcpy(buffer, _buffer + offset_mod, buffer_len);
+        memset(_buffer + offset_mod, 0, buffer_len);
+    }
+}
+
+void AudioMixer::update_gains() {
+    // Scale the sources down as more of them play at the same time, keeping
+    // the loudness of uncorrelated speech about the same. The limiter takes
+    // care of what's left. Every source ramps to its new gain over the next
+    // chunk it writes, like the recording gain does.
+
+    size_t active = 0;
+    for (size_t i = 0; i < _sources_len; i++) {
+        if (_sources[i].active) {
+            active++;
+        }
+    }
+
+    const auto target_gain = active > 1 ? (int32_t)((float)MIX_GAIN_UNITY / sqrtf((float)active)) : MIX_GAIN_UNITY;
+    const auto chunk_samples = (int32_t)(_chunk_len / sizeof(int16_t));
+
+    for (size_t i = 0; i < _sources_len; i++) {
+        auto& source = _sources[i];
+
+        if (source.target_gain == target_gain) {
+            continue;
+        }
+
+        const auto delta = target_gain - source.gain;
+        auto step = delta / chunk_samples;
+        if (step == 0) {
+            step = delta > 0 ? 1 : -1;
+        }
+
+        source.target_gain = target_gain;
+        source.gain_step = step;
+    }
 }
@@ -1,30 +1,181 @@
 #pragma once
 
-#include <map>
-#include <tuple>
+#include <memory>
+
+#include "AudioConfiguration.h"
+#include "AudioKernels.h"
+#include "AudioFrame.h"
+#include "ComfortNoise.h"
+#include "DriftCompensator.h"
+#include "ForwardErrorCorrection.h"
+#include "FractionalResampler.h"
+#include "JitterEstimator.h"
+#include "PacketLossConcealment.h"
+#include "RTPSession.h"
+#include "SoftLimiter.h"
 
 class AudioMixer {
-    struct WriteOffset {
+    // Sources that have been quiet for this long are forgotten, including
+    // their jitter history.
+    static constexpr int64_t SOURCE_EVICT_US = ESP_TIMER_SECONDS(30);
+    // Maximum number of samples dropped from or repeated in a single packet.
+    static constexpr size_t MAX_DROP_SAMPLES = US_TO_SAMPLES(2000);
+    // Samples louder than this aren't dropped or repeated to adapt the
+    // playout delay.
+    static constexpr int16_t MAX_DROP_LEVEL = 328;  // -40 dBFS
+    // Number of samples concealed in one go.
+    static constexpr size_t CONCEAL_CHUNK_SAMPLES = 160;
+    // Number of runs of missing packets per source that are kept open for
+    // late or recovered packets.
+    static constexpr size_t MAX_HOLES = 4;
+    // Number of holes over all sources that are kept open. Each takes a
+    // copy of the concealment history, so these are shared.
+    static constexpr size_t MAX_HOLE_PLCS = 4;
+    // Comfort noise stops when the sender hasn't repeated it for this long.
+    static constexpr int64_t COMFORT_NOISE_TIMEOUT_US = COMFORT_NOISE_INTERVAL_US * 3;
+
+    // Audio of missing packets that may still arrive late or be recovered.
+    // It's concealed when it's about to be played.
+    struct Hole {
         size_t offset;
+        size_t len;
         int32_t packet_index;
+        int32_t packet_count;
+        uint32_t timestamp;
+        // Concealment state from before the hole, taken from the shared pool.
+        PacketLossConcealment* plc;
+        // Head of the audio following the hole. It's written faded in, and
+        // cross-faded with whatever ends up filling the hole.
+        int16_t fade[PacketLossConcealment::OVERLAP];
+        size_t fade_len;
+    };
+
+    struct Source {
+        // Whether this slot of the source table is taken, and by whom.
+        bool in_use{};
+        in_addr_t addr{};
+        in_port_t port{};
+        // End of the audio written for this source, including concealment.
+        size_t offset{};
+        // Where the packet following the last received one should be written,
+        // and its timestamp.
+        size_t expected_offset{};
+        uint32_t expected_timestamp{};
+        int32_t packet_index{-1};
+        bool active{};
+        int64_t last_arrival{};
+        JitterEstimator jitter;
+        PacketLossConcealment plc;
+        DriftCompensator drift;
+        FractionalResampler resampler;
+        unique_ptr<AudioDecoder> decoder;
+        FECDecoder fec;
+        uint32_t ssrc{};
+        uint32_t rtp_timestamp_base{};
+        // Q15 gain the source is mixed with. It moves towards the target gain
+        // over a chunk, so a source joining or leaving the mix doesn't click.
+        int32_t gain{MIX_GAIN_UNITY};
+        int32_t target_gain{MIX_GAIN_UNITY};
+        int32_t gain_step{};
+        // Ordered by offset.
+        Hole holes[MAX_HOLES];
+        size_t hole_count{};
+        // Whether the sender is silent and we're playing comfort noise.
+        bool comfort_noise_active{};
+        ComfortNoise comfort_noise;
     };
 
     size_t _audio_buffer_len;
+    // Audio the playback device takes from us in one go. The playout delay
+    // of a source is at least two chunks. Once the buffered audio of a source
+    // exceeds its target playout delay by more than a chunk, it's shrunk by
+    // dropping quiet samples. When it falls behind the target by more than a
+    // chunk, it's grown by repeating them.
+    size_t _chunk_len{};
+    // The mix is either kept as int16 and saturated on every mix, or kept as
+    // int32 and limited once when it's taken. Offsets and lengths are in
+    // int16 bytes either way.
+    bool _mix_normalized{};
     uint8_t* _buffer{};
+    int32_t* _mix_buffer{};
     size_t _buffer_len{};
+    SoftLimiter _limiter;
     size_t _read_offset;
-    map<tuple<in_addr_t, in_port_t>, WriteOffset> _write_offsets;
+    // When the playback device last took audio from us, and how much.
+    int64_t _last_take_time{};
+    size_t _last_take_len{};
+    bool _jitter_buffer_adaptive{};
+    float _jitter_buffer_percentile{};
+    AudioCodecType _codec{};
+    uint32_t _frame_ms{};
+    AudioTransportType _transport{};
+    uint8_t _rtp_payload_type{};
+    uint32_t _rtp_timestamp_scale{1};
+    int16_t* _decode_buffer{};
+    size_t _decode_buffer_samples{};
+    int16_t* _resample_buffer{};
+    size_t _resample_buffer_samples{};
+    PacketLossConcealment* _hole_plcs{};
+    PacketLossConcealment* _free_hole_plcs[MAX_HOLE_PLCS]{};
+    size_t _free_hole_plcs_len{};
+    // Fixed capacity table, so sources can come and go without touching the heap.
+    Source* _sources{};
+    size_t _sources_len{};
+    uint32_t _concealed_samples{};
+    uint32_t _dropped_samples{};
 
 public:
     AudioMixer() {}
     ~AudioMixer();
 
-    void initialize(uint32_t buffer_len_ms);
+    /** Allocate buffers for the configuration. May be called again to reconfigure. */
+    void initialize(const AudioConfiguration& audio_config);
     bool has_data();
     void reset();
-    void append(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len);
+    /** Mix in a received packet. The arrival time is when it came off the network. */
+    void append(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len, int64_t arrival_time);
     void take(uint8_t* buffer, size_t buffer_len);
+    /** Number of samples concealed since initialization, over all sources. */
+    uint32_t get_concealed_samples() { return _concealed_samples; }
+    /** Number of received samples dropped because the buffer was full, over all sources. */
+    uint32_t get_dropped_samples() { return _dropped_samples; }
+    /**
+     * Clock drift estimate of an active source in ppm, and how far its buffer
+     * fill level is off the target in samples.
+     */
+    bool get_drift(sockaddr_in* source_addr, float& drift_ppm, int32_t& fill_error);
 
 private:
-    void mix_audio(int16_t* source, int16_t* target, size_t samples);
+    void release();
+    Source* find_source(sockaddr_in* source_addr, int64_t now);
+    void evict(Source& source);
+    void append_rtp(Source& source, uint8_t* buffer, size_t buffer_len, int64_t now);
+    void restart(Source& source);
+    void append_packet(Source& source, int32_t packet_index, uint32_t timestamp, uint8_t* buffer, size_t buffer_len,
+                       int64_t now);
+    void append_late(Source& source, int32_t packet_index, uint32_t timestamp, uint8_t* buffer, size_t buffer_len);
+    void append_parity(Source& source, int32_t first_packet_index, uint8_t* buffer, size_t buffer_len, int64_t now);
+    void append_comfort_noise(Source& source, uint8_t* buffer, size_t buffer_len, int64_t now);
+    bool decode(Source& source, uint8_t*& buffer, size_t& buffer_len);
+    void resample(Source& source, uint8_t*& buffer, size_t& buffer_len);
+    size_t get_played_len(int64_t now);
+    int32_t get_buffered_samples(Source& source, int64_t now);
+    size_t get_playout_delay_len(Source& source);
+    size_t get_quiet_len(int16_t* samples, size_t max_len);
+    void conceal(Source& source, size_t end_offset);
+    void play_comfort_noise(Source& source, size_t end_offset);
+    void open_hole(Source& source, int32_t packet_count, uint32_t timestamp, size_t end_offset, int16_t* samples,
+                   size_t samples_len);
+    int find_hole(Source& source, int32_t packet_index);
+    void fill_hole(Source& source, int index, int32_t packet_index, uint32_t timestamp, uint8_t* buffer,
+                   size_t buffer_len);
+    void conceal_holes(Source& source, size_t end_offset);
+    void conceal_hole(Source& source, int index);
+    void remove_hole(Source& source, int index);
+    void clear_holes(Source& source);
+    PacketLossConcealment* take_hole_plc(const Hole* keep);
+    void mix_at(Source& source, size_t offset, uint8_t* buffer, size_t buffer_len);
+    void mix_chunk(Source& source, size_t offset_mod, int16_t* samples, size_t len);
+    void take_chunk(size_t offset_mod, uint8_t* buffer, size_t buffer_len);
+    void update_gains();
 };
@@ -0,0 +1,42 @@
+#include "support.h"
+
+#include "ComfortNoise.h"
+
+#include <algorithm>
+
+LOG_TAG(ComfortNoise);
+
+static constexpr float FULL_SCALE = 32767.0f;
+static constexpr uint8_t MAX_LEVEL = 127;
+
+uint8_t ComfortNoise::get_level(float mean_square) {
+    if (mean_square < 1) {
+        return MAX_LEVEL;
+    }
+
+    const auto level = -10.0f * log10f(mean_square / (FULL_SCALE * FULL_SCALE));
+
+    return (uint8_t)clamp(lroundf(level), 0l, (long)MAX_LEVEL);
+}
+
+void ComfortNoise::set_level(uint8_t level) {
+    // The noise is low-pass filtered by averaging every sample with the
+    // previous output, which takes out two thirds of its power. Uniform
+    // noise of amplitude a has an RMS of a / sqrt(3), so the amplitude for
+    // a target RMS works out at three times that RMS.
+
+    const auto rms = level >= MAX_LEVEL ? 0 : FULL_SCALE * powf(10, -(float)level / 20);
+
+    _amplitude = (int32_t)min(rms * 3, FULL_SCALE);
+}
+
+void ComfortNoise::generate(int16_t* samples, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        _seed = _seed * 1664525 + 1013904223;
+
+        const auto noise = ((int32_t)(_seed >> 16) - 32768) * _amplitude / 32768;
+
+        _last = (noise + _last) / 2;
+        samples[i] = (int16_t)_last;
+    }
+}
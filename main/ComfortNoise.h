@@ -0,0 +1,29 @@
+#pragma once
+
+/**
+ * Comfort noise, after RFC 3389.
+ *
+ * With discontinuous transmission, a sender stops sending audio during
+ * silence and only sends the level of the background noise now and then.
+ * The receiver fills the silence with noise of that level, so the stream
+ * doesn't sound like it dropped. The level is in -dBov: 0 is a full scale
+ * square wave, 127 is silence.
+ */
+
+// Payload type of comfort noise packets with the RTP transport.
+static constexpr uint8_t RTP_PAYLOAD_TYPE_CN = 13;
+// How often a sender repeats the noise level during silence.
+static constexpr int64_t COMFORT_NOISE_INTERVAL_US = ESP_TIMER_MS(500);
+
+class ComfortNoise {
+    int32_t _amplitude{};
+    uint32_t _seed{1};
+    int32_t _last{};
+
+public:
+    /** Noise level of audio with the given mean square. */
+    static uint8_t get_level(float mean_square);
+
+    void set_level(uint8_t level);
+    void generate(int16_t* samples, size_t len);
+};
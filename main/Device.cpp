@@ -4,6 +4,7 @@
 
 #include <algorithm>
 
+#include "ComfortNoise.h"
 #include "NVSProperty.h"
 
 LOG_TAG(Device);
@@ -19,19 +20,32 @@ static NVSPropertyI1 nvs_recording_auto_volume_enabled("rec_autovol_en");
 static NVSPropertyF32 nvs_recording_smoothing_factor("rec_smooth_fac");
 static NVSPropertyI1 nvs_playback_auto_volume_enabled("play_autovol_en");
 static NVSPropertyF32 nvs_playback_target_db("play_target_db");
+static NVSPropertyI1 nvs_jitter_buffer_adaptive("jb_adaptive");
+static NVSPropertyF32 nvs_jitter_buffer_percentile("jb_percentile");
+static NVSPropertyU8 nvs_codec("codec");
+static NVSPropertyU32 nvs_frame_ms("frame_ms");
+static NVSPropertyU8 nvs_fec_group_size("fec_group_size");
+static NVSPropertyU8 nvs_transport("transport");
+static NVSPropertyI1 nvs_mix_normalized("mix_normalized");
+static NVSPropertyI1 nvs_dtx_enabled("dtx_enabled");
+static NVSPropertyU8 nvs_latency_profile("latency_prof");
 
 Device::Device(MQTTConnection& mqtt_connection, UDPServer& udp_server, Controls& controls)
     : _mqtt_connection(mqtt_connection),
       _udp_server(udp_server),
       _controls(controls),
       _recording_device(_udp_server),
-      _playback_device(_recording_device) {
-    _send_buffer = (uint8_t*)malloc(UDPServer::PAYLOAD_LEN);
-}
+      _playback_device(_recording_device) {}
 
 void Device::begin() {
     load_state();
 
+#ifdef CONFIG_DEVICE_BENCHMARK_CODEC
+    benchmark_audio_codecs();
+#endif
+
+    begin_sender();
+
     _playback_device.on_buffer_exhausted([this]() { _playback_device.stop(); });
 
     _recording_device.on_data_available([this](auto data) { send_audio(data); });
@@ -64,12 +78,41 @@ void Device::begin() {
             save_state();
         }
     });
-    _udp_server.on_received([this](auto packet) {
+    _udp_server.on_received([this](auto packets) {
+        // Audio packets are compacted to the front of the batch.
+        const auto audio = packets.buffer();
+        size_t audio_len = 0;
+
+        for (size_t i = 0; i < packets.len(); i++) {
+            const auto& packet = packets.buffer()[i];
+
+            if (_transport == AudioTransportType::RTP) {
+                const auto buffer = (uint8_t*)packet.buffer;
+
+                if (is_rtcp_packet(buffer, packet.buffer_len)) {
+                    _rtp_session.process_rtcp(packet.source_addr, buffer, packet.buffer_len);
+                    continue;
+                }
+
+                const auto report_len = _rtp_session.packet_received(packet.source_addr, buffer, packet.buffer_len);
+                if (report_len) {
+                    _udp_server.send((sockaddr*)packet.source_addr, sizeof(*packet.source_addr),
+                                     _rtp_session.get_receiver_report(), report_len);
+                }
+            }
+
+            audio[audio_len++] = packet;
+        }
+
+        if (!audio_len) {
+            return;
+        }
+
         if (!_playback_device.is_playing()) {
             _playback_device.start();
         }
 
-        _playback_device.add_samples(packet.source_addr, (uint8_t*)packet.buffer, packet.buffer_len);
+        _playback_device.add_samples(Span<UDPPacket>(audio, audio_len));
     });
 
     _controls.on_red_led_active_changed([this](bool active) {
@@ -93,6 +136,60 @@ void Device::begin() {
     });
 }
 
+void Device::begin_sender() {
+    _frame_len = AUDIO_BUFFER_LEN(_state.audio_config.frame_ms);
+    _frame_buffer = (uint8_t*)malloc(_frame_len);
+    ESP_ERROR_ASSERT(_frame_buffer);
+    _frame_buffer_offset = 0;
+
+    const auto rtp = _state.audio_config.transport == AudioTransportType::RTP;
+
+    _encoder = AudioEncoder::create(_state.audio_config.codec, _state.audio_config.frame_ms);
+    if (_encoder) {
+        ESP_ERROR_ASSERT(_encoder->get_frame_len() == _frame_len);
+    }
+
+    if (rtp) {
+        _rtp_session.begin(_state.audio_config.codec);
+    }
+
+    // Parity packets are specific to the native transport.
+    _fec_encoder.initialize(rtp ? 0 : _state.audio_config.fec_group_size);
+
+    _transport = _state.audio_config.transport;
+    _dtx_enabled = _state.audio_config.dtx_enabled;
+}
+
+bool Device::reconfigure_sender(const AudioConfiguration& previous) {
+    const auto& config = _state.audio_config;
+
+    if (config.codec == previous.codec && config.frame_ms == previous.frame_ms &&
+        config.transport == previous.transport && config.fec_group_size == previous.fec_group_size &&
+        config.dtx_enabled == previous.dtx_enabled) {
+        return false;
+    }
+
+    ESP_LOGI(TAG, "Rebuilding sender");
+
+    auto guard = _send_lock.take();
+
+    free(_frame_buffer);
+    _frame_buffer = nullptr;
+    delete _encoder;
+    _encoder = nullptr;
+
+    begin_sender();
+
+    _vad.reset();
+    _silent = false;
+
+    if (config.transport == AudioTransportType::RTP && _recording_device.is_recording()) {
+        _rtp_session.start_talk_spurt();
+    }
+
+    return true;
+}
+
 void Device::send_action(DeviceAction action) {
     const auto data = action == DeviceAction::Click ? "click" : "long_click";
 
@@ -119,8 +216,22 @@ void Device::set_volume(float volume) { _playback_device.set_volume(volume); }
 
 void Device::set_recording(bool recording) {
     if (recording) {
-        // Reset the packet index to prevent wrap around.
-        _next_packet_index = 0;
+        {
+            // The read task of a previous recording may still be sending.
+            auto guard = _send_lock.take();
+
+            // Reset the packet index and timestamp to prevent wrap around.
+            _next_packet_index = 0;
+            _next_timestamp = 0;
+            _frame_buffer_offset = 0;
+            _fec_encoder.reset();
+            _vad.reset();
+            _silent = false;
+
+            if (_transport == AudioTransportType::RTP) {
+                _rtp_session.start_talk_spurt();
+            }
+        }
 
         _recording_device.start();
     } else {
@@ -133,37 +244,63 @@ void Device::set_red_led(LedAction* action) { _controls.set_red_led(action); }
 void Device::set_green_led(LedAction* action) { _controls.set_green_led(action); }
 
 void Device::add_endpoint(const string& endpoint) {
-    auto it = find_if(_remote_endpoints.begin(), _remote_endpoints.end(),
-                      [&endpoint](const Endpoint& ep) { return ep.endpoint == endpoint; });
-
-    if (it == _remote_endpoints.end()) {
-        Endpoint ep = {
+    if (!_remote_endpoints.contains(endpoint)) {
+        RemoteEndpoints::Endpoint ep = {
             .endpoint = endpoint,
         };
 
         ESP_ERROR_CHECK(parse_endpoint(&ep.addr, endpoint.c_str()));
 
-        _remote_endpoints.push_back(ep);
+        _remote_endpoints.add(ep);
     }
 }
 
-void Device::remove_endpoint(const string& endpoint) {
-    auto it = find_if(_remote_endpoints.begin(), _remote_endpoints.end(),
-                      [&endpoint](const Endpoint& ep) { return ep.endpoint == endpoint; });
-
-    if (it != _remote_endpoints.end()) {
-        _remote_endpoints.erase(it);
-    }
-}
+void Device::remove_endpoint(const string& endpoint) { _remote_endpoints.remove(endpoint); }
 
 void Device::set_audio_configuration(const AudioConfiguration& config) {
+    const auto previous = _state.audio_config;
+
     _state.audio_config = config;
 
     save_state();
 
-    ESP_LOGI(TAG, "Audio configuration changed; restarting device");
+    // The DMA buffers of the I2S channels are sized when they're created.
+    // Tearing down and recreating the channels while the tasks that read
+    // and write them are running isn't supported, so the new profile is
+    // applied by restarting with the saved configuration.
+
+    if (config.latency_profile != previous.latency_profile) {
+        ESP_LOGI(TAG, "Latency profile changed from %s to %s; restarting device to resize the I2S DMA buffers",
+                 latency_profile_to_string(previous.latency_profile),
+                 latency_profile_to_string(config.latency_profile));
 
-    esp_restart();
+        esp_restart();
+    }
+
+    // Only the components affected by the changed settings are rebuilt.
+
+    _reconfiguration = {};
+
+    auto start = esp_timer_get_time();
+    if (_playback_device.reconfigure(config)) {
+        _reconfiguration.playback_us = esp_timer_get_time() - start;
+    }
+
+    start = esp_timer_get_time();
+    if (_recording_device.reconfigure(config)) {
+        _reconfiguration.recording_us = esp_timer_get_time() - start;
+    }
+
+    start = esp_timer_get_time();
+    if (reconfigure_sender(previous)) {
+        _reconfiguration.sender_us = esp_timer_get_time() - start;
+    }
+
+    ESP_LOGI(TAG, "Audio configuration changed; reconfigured playback %" PRId64 " us, recording %" PRId64
+             " us, sender %" PRId64 " us",
+             _reconfiguration.playback_us, _reconfiguration.recording_us, _reconfiguration.sender_us);
+
+    _state_changed.call();
 }
 
 cJSON* Device::get_state() {
@@ -189,6 +326,94 @@ cJSON* Device::get_state() {
     cJSON_AddBoolToObject(audio_config, "playback_auto_volume_enabled",
                           _state.audio_config.playback_auto_volume_enabled);
     cJSON_AddNumberToObject(audio_config, "playback_target_db", _state.audio_config.playback_target_db);
+    cJSON_AddBoolToObject(audio_config, "jitter_buffer_adaptive", _state.audio_config.jitter_buffer_adaptive);
+    cJSON_AddNumberToObject(audio_config, "jitter_buffer_percentile", _state.audio_config.jitter_buffer_percentile);
+    cJSON_AddStringToObject(audio_config, "codec", audio_codec_type_to_string(_state.audio_config.codec));
+    cJSON_AddNumberToObject(audio_config, "frame_ms", _state.audio_config.frame_ms);
+    cJSON_AddNumberToObject(audio_config, "fec_group_size", _state.audio_config.fec_group_size);
+    cJSON_AddStringToObject(audio_config, "transport", audio_transport_type_to_string(_state.audio_config.transport));
+    cJSON_AddBoolToObject(audio_config, "mix_normalized", _state.audio_config.mix_normalized);
+    cJSON_AddBoolToObject(audio_config, "dtx_enabled", _state.audio_config.dtx_enabled);
+    cJSON_AddStringToObject(audio_config, "latency_profile",
+                            latency_profile_to_string(_state.audio_config.latency_profile));
+
+    cJSON_AddItemToObject(root, "latency", get_latency_state());
+
+    const auto reconfiguration = cJSON_AddObjectToObject(root, "reconfiguration");
+    if (_reconfiguration.playback_us >= 0) {
+        cJSON_AddNumberToObject(reconfiguration, "playback_us", _reconfiguration.playback_us);
+    }
+    if (_reconfiguration.recording_us >= 0) {
+        cJSON_AddNumberToObject(reconfiguration, "recording_us", _reconfiguration.recording_us);
+    }
+    if (_reconfiguration.sender_us >= 0) {
+        cJSON_AddNumberToObject(reconfiguration, "sender_us", _reconfiguration.sender_us);
+    }
+    cJSON_AddItemToObject(root, "udp", _udp_server.get_state());
+
+    if (_state.audio_config.transport == AudioTransportType::RTP) {
+        cJSON_AddItemToObject(root, "rtp", _rtp_session.get_state());
+    }
+
+    return root;
+}
+
+cJSON* Device::get_latency_state() {
+    // Nominal latency of every stage of the audio pipeline. Capture runs
+    // from the microphone to the network, playback from the network to
+    // the speaker.
+
+    const auto latency_settings = get_latency_settings(_state.audio_config);
+
+    auto root = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(root, "profile", latency_profile_to_string(_state.audio_config.latency_profile));
+
+    // A DMA buffer is handed to the read task once it's filled, and the read
+    // task waits for a block of the size the AFE is fed with. Audio is sent
+    // once a frame is complete.
+
+    const auto capture_dma_ms = latency_settings.dma_frame_ms;
+    const auto block_ms = _recording_device.get_block_ms();
+    const auto processing_ms = _recording_device.get_processing_ms();
+    const auto frame_ms = _state.audio_config.frame_ms;
+    const auto capture_ms = capture_dma_ms + block_ms + processing_ms + frame_ms;
+
+    const auto capture = cJSON_AddObjectToObject(root, "capture");
+    cJSON_AddNumberToObject(capture, "dma_ms", capture_dma_ms);
+    cJSON_AddNumberToObject(capture, "block_ms", block_ms);
+    cJSON_AddNumberToObject(capture, "processing_ms", processing_ms);
+    cJSON_AddNumberToObject(capture, "frame_ms", frame_ms);
+    cJSON_AddNumberToObject(capture, "total_ms", capture_ms);
+
+    // Drift of the I2S sample clocks against the timer, in ppm. The AEC
+    // reference follows the difference between the two.
+
+    cJSON_AddNumberToObject(root, "playback_clock_ppm", _playback_device.get_clock_drift() * 1000000);
+    cJSON_AddNumberToObject(root, "recording_clock_ppm", _recording_device.get_clock_drift() * 1000000);
+
+    // Alignment of the AEC reference with the echo at the microphone.
+
+    if (_state.audio_config.enable_audio_processing) {
+        cJSON_AddNumberToObject(root, "echo_delay_ms", (double)_recording_device.get_echo_delay_us() / 1000);
+        cJSON_AddNumberToObject(root, "echo_correlation", _recording_device.get_echo_correlation());
+    }
+
+    // The mixer holds at most the prebuffer; the adaptive jitter buffer
+    // usually needs less. The write task keeps every DMA buffer filled.
+
+    const auto playout_ms = latency_settings.audio_buffer_ms;
+    const auto chunk_ms = latency_settings.chunk_ms;
+    const auto playback_dma_ms = latency_settings.dma_desc_num * latency_settings.dma_frame_ms;
+    const auto playback_ms = playout_ms + chunk_ms + playback_dma_ms;
+
+    const auto playback = cJSON_AddObjectToObject(root, "playback");
+    cJSON_AddNumberToObject(playback, "max_playout_ms", playout_ms);
+    cJSON_AddNumberToObject(playback, "chunk_ms", chunk_ms);
+    cJSON_AddNumberToObject(playback, "dma_ms", playback_dma_ms);
+    cJSON_AddNumberToObject(playback, "total_ms", playback_ms);
+
+    cJSON_AddNumberToObject(root, "total_ms", capture_ms + playback_ms);
 
     return root;
 }
@@ -203,12 +428,25 @@ void Device::load_state() {
     _state.audio_config.volume_scale_low = nvs_volume_scale_low.get(handle, -30);
     _state.audio_config.volume_scale_high = nvs_volume_scale_high.get(handle, -8);
     _state.audio_config.enable_audio_processing = nvs_enable_audio_processing.get(handle, true);
-    _state.audio_config.audio_buffer_ms = nvs_audio_buffer_ms.get(handle, 200);
+    _state.audio_config.audio_buffer_ms = nvs_audio_buffer_ms.get(handle, 0);
     _state.audio_config.microphone_gain_bits = nvs_microphone_gain_bits.get(handle, 3);
     _state.audio_config.recording_auto_volume_enabled = nvs_recording_auto_volume_enabled.get(handle, false);
     _state.audio_config.recording_smoothing_factor = nvs_recording_smoothing_factor.get(handle, 0.1);
     _state.audio_config.playback_auto_volume_enabled = nvs_playback_auto_volume_enabled.get(handle, true);
     _state.audio_config.playback_target_db = nvs_playback_target_db.get(handle, -14);
+    _state.audio_config.jitter_buffer_adaptive = nvs_jitter_buffer_adaptive.get(handle, true);
+    _state.audio_config.jitter_buffer_percentile = nvs_jitter_buffer_percentile.get(handle, 0.95);
+    _state.audio_config.codec = (AudioCodecType)nvs_codec.get(handle, (uint8_t)AudioCodecType::PCM);
+    _state.audio_config.frame_ms = nvs_frame_ms.get(handle, 20);
+    _state.audio_config.fec_group_size = nvs_fec_group_size.get(handle, 0);
+    _state.audio_config.transport =
+        (AudioTransportType)nvs_transport.get(handle, (uint8_t)AudioTransportType::Native);
+    _state.audio_config.mix_normalized = nvs_mix_normalized.get(handle, true);
+    _state.audio_config.dtx_enabled = nvs_dtx_enabled.get(handle, false);
+    _state.audio_config.latency_profile =
+        (LatencyProfile)nvs_latency_profile.get(handle, (uint8_t)LatencyProfile::Balanced);
+
+    migrate_audio_buffer_ms(handle);
 
     nvs_close(handle);
 
@@ -224,6 +462,39 @@ void Device::load_state() {
     ESP_LOGI(TAG, "  Playback auto volume enabled: %s",
              _state.audio_config.playback_auto_volume_enabled ? "true" : "false");
     ESP_LOGI(TAG, "  Playback target Db: %f", _state.audio_config.playback_target_db);
+    ESP_LOGI(TAG, "  Jitter buffer adaptive: %s", _state.audio_config.jitter_buffer_adaptive ? "true" : "false");
+    ESP_LOGI(TAG, "  Jitter buffer percentile: %f", _state.audio_config.jitter_buffer_percentile);
+    ESP_LOGI(TAG, "  Codec: %s", audio_codec_type_to_string(_state.audio_config.codec));
+    ESP_LOGI(TAG, "  Frame (ms): %" PRIu32, _state.audio_config.frame_ms);
+    ESP_LOGI(TAG, "  FEC group size: %d", _state.audio_config.fec_group_size);
+    ESP_LOGI(TAG, "  Transport: %s", audio_transport_type_to_string(_state.audio_config.transport));
+    ESP_LOGI(TAG, "  Mix normalized: %s", _state.audio_config.mix_normalized ? "true" : "false");
+    ESP_LOGI(TAG, "  DTX enabled: %s", _state.audio_config.dtx_enabled ? "true" : "false");
+    ESP_LOGI(TAG, "  Latency profile: %s", latency_profile_to_string(_state.audio_config.latency_profile));
+}
+
+void Device::migrate_audio_buffer_ms(nvs_handle_t handle) {
+    // Before latency profiles, the audio buffer defaulted to 200 ms and was
+    // saved like any other setting. An explicit audio buffer length overrides
+    // that of the profile, so this would pin the prebuffer for every
+    // profile. Devices that haven't saved a profile yet get the default back.
+    // Saving the profile makes sure this happens only once, so an explicit
+    // 200 ms set later is kept.
+
+    uint8_t latency_profile;
+    if (nvs_get_u8(handle, "latency_prof", &latency_profile) != ESP_ERR_NVS_NOT_FOUND) {
+        return;
+    }
+
+    if (_state.audio_config.audio_buffer_ms == LEGACY_AUDIO_BUFFER_MS) {
+        ESP_LOGI(TAG, "Migrating audio buffer of %" PRIu32 " ms to the default of the latency profile",
+                 _state.audio_config.audio_buffer_ms);
+
+        _state.audio_config.audio_buffer_ms = 0;
+        nvs_audio_buffer_ms.set(handle, _state.audio_config.audio_buffer_ms);
+    }
+
+    nvs_latency_profile.set(handle, (uint8_t)_state.audio_config.latency_profile);
 }
 
 void Device::save_state() {
@@ -242,23 +513,183 @@ void Device::save_state() {
     nvs_recording_smoothing_factor.set(handle, _state.audio_config.recording_smoothing_factor);
     nvs_playback_auto_volume_enabled.set(handle, _state.audio_config.playback_auto_volume_enabled);
     nvs_playback_target_db.set(handle, _state.audio_config.playback_target_db);
+    nvs_jitter_buffer_adaptive.set(handle, _state.audio_config.jitter_buffer_adaptive);
+    nvs_jitter_buffer_percentile.set(handle, _state.audio_config.jitter_buffer_percentile);
+    nvs_codec.set(handle, (uint8_t)_state.audio_config.codec);
+    nvs_frame_ms.set(handle, _state.audio_config.frame_ms);
+    nvs_fec_group_size.set(handle, _state.audio_config.fec_group_size);
+    nvs_transport.set(handle, (uint8_t)_state.audio_config.transport);
+    nvs_mix_normalized.set(handle, _state.audio_config.mix_normalized);
+    nvs_dtx_enabled.set(handle, _state.audio_config.dtx_enabled);
+    nvs_latency_profile.set(handle, (uint8_t)_state.audio_config.latency_profile);
 
     nvs_close(handle);
 }
 
 void Device::send_audio(Span<uint8_t> data) {
-    const size_t chunk_len = UDPServer::PAYLOAD_LEN - 4;
+    auto guard = _send_lock.take();
 
-    for (size_t offset = 0; offset < data.len(); offset += chunk_len) {
-        auto packet_index = _next_packet_index++;
-        *(uint32_t*)_send_buffer = htonl((uint32_t)packet_index);
+    // Audio is sent in frames of a fixed duration. Whole frames are encoded
+    // straight from the recording buffer; audio that doesn't fill a frame
+    // is collected in the frame buffer first.
 
-        auto this_chunk_len = min(chunk_len, data.len() - offset);
+    for (size_t offset = 0; offset < data.len();) {
+        if (_frame_buffer_offset == 0 && data.len() - offset >= _frame_len) {
+            send_frame(data.buffer() + offset);
 
-        memcpy(_send_buffer + 4, data.buffer() + offset, this_chunk_len);
+            offset += _frame_len;
+            continue;
+        }
+
+        const auto copy = min(_frame_len - _frame_buffer_offset, data.len() - offset);
+
+        memcpy(_frame_buffer + _frame_buffer_offset, data.buffer() + offset, copy);
+
+        _frame_buffer_offset += copy;
+        offset += copy;
+
+        if (_frame_buffer_offset == _frame_len) {
+            _frame_buffer_offset = 0;
 
-        for (const auto& endpoint : _remote_endpoints) {
-            _udp_server.send((sockaddr*)&endpoint.addr, sizeof(endpoint.addr), _send_buffer, this_chunk_len + 4);
+            send_frame(_frame_buffer);
         }
     }
 }
+
+void Device::send_frame(uint8_t* frame) {
+    if (_dtx_enabled && !is_voice_active(frame)) {
+        // During silence, only the noise level goes out now and then.
+
+        const auto now = esp_timer_get_time();
+        if (!_silent || now - _last_comfort_noise_time >= COMFORT_NOISE_INTERVAL_US) {
+            send_comfort_noise();
+
+            _last_comfort_noise_time = now;
+        }
+
+        _silent = true;
+        _next_timestamp += _frame_len / sizeof(int16_t);
+        return;
+    }
+
+    _silent = false;
+
+    // The payload is written into a send slot behind room for the header,
+    // so the packet is queued without copying it again.
+
+    const auto packet = _udp_server.allocate_packet();
+    const auto payload = packet + get_header_len();
+
+    if (_encoder) {
+        const auto encoded = _encoder->encode(frame, payload, get_max_payload_len());
+        if (encoded > 0) {
+            send_packet(packet, encoded);
+        } else {
+            _udp_server.release_packet(packet);
+        }
+    } else {
+        // RTP carries L16 in network byte order.
+        if (_transport == AudioTransportType::RTP) {
+            swap_l16((int16_t*)payload, (int16_t*)frame, _frame_len / sizeof(int16_t));
+        } else {
+            memcpy(payload, frame, _frame_len);
+        }
+
+        send_packet(packet, _frame_len);
+    }
+
+    // The timestamp advances even if the frame couldn't be encoded, so the
+    // receiver conceals it.
+    _next_timestamp += _frame_len / sizeof(int16_t);
+}
+
+size_t Device::get_header_len() {
+    return _transport == AudioTransportType::RTP ? RTP_HEADER_LEN : sizeof(AudioFrameHeader);
+}
+
+size_t Device::get_max_payload_len() {
+    if (_transport == AudioTransportType::RTP) {
+        return UDPServer::PAYLOAD_LEN - RTP_HEADER_LEN;
+    }
+
+    // Leave room for the parity header, so parity packets fit in a datagram too.
+    return _fec_encoder.is_enabled() ? FEC_MAX_PAYLOAD_LEN : UDPServer::PAYLOAD_LEN - sizeof(AudioFrameHeader);
+}
+
+void Device::send_packet(uint8_t* packet, size_t payload_len) {
+    if (_transport == AudioTransportType::RTP) {
+        send_rtp_packet(packet, payload_len);
+        return;
+    }
+
+    auto packet_index = _next_packet_index++;
+
+    AudioFrameHeader header = {
+        .packet_index = htonl((uint32_t)packet_index),
+        .timestamp = htonl(_next_timestamp),
+    };
+
+    memcpy(packet, &header, sizeof(header));
+
+    // The send task may reuse the packet once it's queued, so the parity is
+    // updated first.
+
+    size_t parity_len = 0;
+    if (_fec_encoder.is_enabled()) {
+        parity_len = _fec_encoder.add(packet_index, _next_timestamp, packet + sizeof(header), payload_len);
+    }
+
+    const auto endpoints = _remote_endpoints.read();
+
+    _udp_server.send_packet(packet, sizeof(header) + payload_len, endpoints.get_addrs(), endpoints.size());
+
+    if (parity_len) {
+        _udp_server.send(endpoints.get_addrs(), endpoints.size(), nullptr, 0, _fec_encoder.get_packet(), parity_len);
+    }
+}
+
+bool Device::is_voice_active(uint8_t* frame) {
+    const auto samples = (int16_t*)frame;
+    const auto len = _frame_len / sizeof(int16_t);
+
+    if (_recording_device.has_voice_activity_detection()) {
+        return _vad.process(samples, len, _recording_device.is_voice_active());
+    }
+
+    return _vad.process(samples, len);
+}
+
+void Device::send_comfort_noise() {
+    auto level = _vad.get_noise_level();
+
+    if (_transport == AudioTransportType::RTP) {
+        const auto packet = _udp_server.allocate_packet();
+        memcpy(packet + RTP_HEADER_LEN, &level, sizeof(level));
+
+        send_rtp_packet(packet, sizeof(level), true);
+        return;
+    }
+
+    AudioFrameHeader header = {
+        .packet_index = htonl(AUDIO_FRAME_COMFORT_NOISE),
+        .timestamp = htonl(_next_timestamp),
+    };
+
+    const auto endpoints = _remote_endpoints.read();
+
+    _udp_server.send(endpoints.get_addrs(), endpoints.size(), &header, sizeof(header), &level, sizeof(level));
+}
+
+void Device::send_rtp_packet(uint8_t* packet, size_t payload_len, bool comfort_noise) {
+    _rtp_session.write_header(packet, _next_timestamp, comfort_noise);
+
+    const auto endpoints = _remote_endpoints.read();
+
+    _udp_server.send_packet(packet, RTP_HEADER_LEN + payload_len, endpoints.get_addrs(), endpoints.size());
+
+    const auto report_len = _rtp_session.packet_sent(payload_len);
+    if (report_len) {
+        _udp_server.send(endpoints.get_addrs(), endpoints.size(), nullptr, 0, _rtp_session.get_sender_report(),
+                         report_len);
+    }
+}
@@ -1,18 +1,31 @@
 #pragma once
 
+#include <atomic>
+
+#include "AudioCodec.h"
 #include "Controls.h"
 #include "DeviceState.h"
+#include "ForwardErrorCorrection.h"
 #include "I2SPlaybackDevice.h"
 #include "I2SRecordingDevice.h"
 #include "MQTTConnection.h"
+#include "RTPSession.h"
+#include "RemoteEndpoints.h"
 #include "UDPServer.h"
+#include "VoiceActivityDetector.h"
 
 enum class DeviceAction { Click, LongClick };
 
 class Device {
-    struct Endpoint {
-        string endpoint;
-        sockaddr_in addr;
+    // Default of audio_buffer_ms before latency profiles.
+    static constexpr uint32_t LEGACY_AUDIO_BUFFER_MS = 200;
+
+    // Time the components took to rebuild on the last reconfiguration, or -1
+    // if they didn't need to.
+    struct ReconfigurationTimes {
+        int64_t playback_us{-1};
+        int64_t recording_us{-1};
+        int64_t sender_us{-1};
     };
 
     MQTTConnection& _mqtt_connection;
@@ -21,10 +34,26 @@ class Device {
     DeviceState _state;
     I2SRecordingDevice _recording_device;
     I2SPlaybackDevice _playback_device;
-    vector<Endpoint> _remote_endpoints;
-    uint8_t* _send_buffer;
+    RemoteEndpoints _remote_endpoints;
+    // Guards the sender state below against reconfiguration.
+    Mutex _send_lock;
+    // The UDP receive task reads the transport without taking the lock.
+    // It's published once the RTP session is set up.
+    atomic<AudioTransportType> _transport{};
+    bool _dtx_enabled{};
+    AudioEncoder* _encoder{};
+    uint8_t* _frame_buffer{};
+    size_t _frame_len{};
+    size_t _frame_buffer_offset{};
+    FECEncoder _fec_encoder;
+    RTPSession _rtp_session;
     int32_t _next_packet_index{};
+    uint32_t _next_timestamp{};
+    VoiceActivityDetector _vad;
+    bool _silent{};
+    int64_t _last_comfort_noise_time{};
     Callback<void> _state_changed;
+    ReconfigurationTimes _reconfiguration;
 
 public:
     Device(MQTTConnection& mqtt_connection, UDPServer& udp_server, Controls& controls);
@@ -38,14 +67,26 @@ public:
     void set_green_led(LedAction* action);
     void add_endpoint(const string& endpoint);
     void remove_endpoint(const string& endpoint);
+    const AudioConfiguration& get_audio_configuration() { return _state.audio_config; }
     void set_audio_configuration(const AudioConfiguration& config);
     void on_state_changed(function<void()> func) { _state_changed.add(func); }
     cJSON* get_state();
 
 private:
+    void begin_sender();
+    bool reconfigure_sender(const AudioConfiguration& previous);
+    cJSON* get_latency_state();
     void send_action(DeviceAction action);
     void state_changed();
     void load_state();
+    void migrate_audio_buffer_ms(nvs_handle_t handle);
     void save_state();
     void send_audio(Span<uint8_t> data);
+    void send_frame(uint8_t* frame);
+    size_t get_header_len();
+    size_t get_max_payload_len();
+    void send_packet(uint8_t* packet, size_t payload_len);
+    void send_rtp_packet(uint8_t* packet, size_t payload_len, bool comfort_noise = false);
+    bool is_voice_active(uint8_t* frame);
+    void send_comfort_noise();
 };
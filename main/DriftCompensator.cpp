@@ -0,0 +1,52 @@
+#include "support.h"
+
+#include "DriftCompensator.h"
+
+#include <algorithm>
+
+LOG_TAG(DriftCompensator);
+
+void DriftCompensator::begin(uint32_t chunk_ms) {
+    _max_drift_error = (int32_t)US_TO_SAMPLES(ESP_TIMER_MS(chunk_ms) / 2);
+
+    reset();
+}
+
+void DriftCompensator::reset() {
+    _drift = 0;
+
+    restart();
+}
+
+void DriftCompensator::restart() {
+    _window_start = 0;
+    _window_max = INT32_MIN;
+    _ratio = 1 + _drift;
+}
+
+void DriftCompensator::add(int64_t now, int32_t buffered, int32_t target) {
+    if (!_window_start) {
+        _window_start = now;
+    }
+
+    _window_max = max(_window_max, buffered);
+
+    if (now - _window_start < WINDOW_US) {
+        return;
+    }
+
+    // If we have more buffered than we want, we need to consume the source
+    // faster, i.e. resample it to fewer samples.
+
+    const auto error = _window_max - target;
+
+    if (abs(error) <= _max_drift_error) {
+        _drift = clamp(_drift + (float)error * INTEGRAL_GAIN, -MAX_DRIFT, MAX_DRIFT);
+    }
+    _ratio = 1 + clamp(_drift + (float)error * PROPORTIONAL_GAIN, -MAX_DRIFT, MAX_DRIFT);
+
+    ESP_LOGD(TAG, "Fill level error %d samples, drift %.1f ppm, ratio %.6f", (int)error, get_drift_ppm(), _ratio);
+
+    _window_start = now;
+    _window_max = INT32_MIN;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+/**
+ * Per-source clock drift estimator.
+ *
+ * The sender and receiver sample clocks run off different crystals, so a
+ * source slowly fills up or drains its part of the mixer buffer. The buffer
+ * fill level is tracked over windows of a second; the highest fill level of
+ * a window is that of the packets that arrived on time, which is compared
+ * against the target playout delay. A PI controller on that error gives the
+ * ratio the source has to be resampled with to hold the fill level at the
+ * target. The integral term converges on the actual drift between the clocks.
+ */
+class DriftCompensator {
+    static constexpr int64_t WINDOW_US = ESP_TIMER_SECONDS(1);
+    // Correct a fill level error over roughly ten seconds.
+    static constexpr float PROPORTIONAL_GAIN = 1.0f / (float)US_TO_SAMPLES(ESP_TIMER_SECONDS(10));
+    // The drift estimate settles over roughly a minute.
+    static constexpr float INTEGRAL_GAIN = PROPORTIONAL_GAIN / 60.0f;
+    // Crystals are well within this; it also limits the audible pitch change.
+    static constexpr float MAX_DRIFT = 0.001f;
+
+    // Errors larger than half a chunk come from a change in the playout delay
+    // rather than from drift, and aren't taken into the drift estimate.
+    int32_t _max_drift_error{};
+    int64_t _window_start{};
+    int32_t _window_max{INT32_MIN};
+    float _drift{};
+    float _ratio{1};
+
+public:
+    /** Set the length of the chunks the mixer is taken in. */
+    void begin(uint32_t chunk_ms);
+
+    /** Forget the drift estimate. */
+    void reset();
+
+    /** Start of a new stream; keeps the drift estimate. */
+    void restart();
+
+    /** Record the buffer fill level and the target fill level in samples. */
+    void add(int64_t now, int32_t buffered, int32_t target);
+
+    /** Number of input samples per output sample the source must be resampled with. */
+    float get_ratio() { return _ratio; }
+
+    float get_drift_ppm() { return _drift * 1e6f; }
+};
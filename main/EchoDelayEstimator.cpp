@@ -0,0 +1,144 @@
+#include "support.h"
+
+#include "EchoDelayEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+LOG_TAG(EchoDelayEstimator);
+
+void EchoDelayEstimator::reset() {
+    _window_len = 0;
+    _microphone_sum = 0;
+    _reference_sum = 0;
+    _decimation_offset = 0;
+    _has_last_lag = false;
+}
+
+void EchoDelayEstimator::process(const int16_t* microphone, const int16_t* reference, size_t samples) {
+    for (size_t i = 0; i < samples; i++) {
+        _microphone_sum += abs(microphone[i]);
+        _reference_sum += abs(reference[i]);
+
+        if (++_decimation_offset < DECIMATION) {
+            continue;
+        }
+
+        _microphone[_window_len] = (float)_microphone_sum / DECIMATION;
+        _reference[_window_len] = (float)_reference_sum / DECIMATION;
+        _window_len++;
+
+        _microphone_sum = 0;
+        _reference_sum = 0;
+        _decimation_offset = 0;
+
+        if (_window_len == WINDOW) {
+            estimate();
+
+            _window_len = 0;
+        }
+    }
+}
+
+void EchoDelayEstimator::estimate() {
+    auto microphone_mean = 0.0f;
+    auto reference_mean = 0.0f;
+
+    for (size_t i = 0; i < WINDOW; i++) {
+        microphone_mean += _microphone[i];
+        reference_mean += _reference[i];
+    }
+
+    microphone_mean /= WINDOW;
+    reference_mean /= WINDOW;
+
+    // Without playback, there's no echo to measure.
+
+    if (reference_mean < MIN_REFERENCE_LEVEL) {
+        _has_last_lag = false;
+        return;
+    }
+
+    for (size_t i = 0; i < WINDOW; i++) {
+        _microphone[i] -= microphone_mean;
+        _reference[i] -= reference_mean;
+    }
+
+    // The microphone envelope is correlated over a fixed range, so every lag
+    // finds reference samples within the window. The energy of the reference
+    // range slides along with the lag.
+
+    const auto begin = (size_t)MAX_LAG;
+    const auto end = WINDOW + MIN_LAG;
+
+    auto microphone_energy = 0.0f;
+    for (auto i = begin; i < end; i++) {
+        microphone_energy += _microphone[i] * _microphone[i];
+    }
+
+    auto reference_energy = 0.0f;
+    for (auto i = begin - MIN_LAG; i < end - MIN_LAG; i++) {
+        reference_energy += _reference[i] * _reference[i];
+    }
+
+    auto best_lag = 0;
+    auto best_correlation = -1.0f;
+
+    for (auto lag = MIN_LAG; lag <= MAX_LAG; lag++) {
+        if (lag > MIN_LAG) {
+            const auto added = _reference[begin - lag];
+            const auto removed = _reference[end - lag];
+            reference_energy += added * added - removed * removed;
+        }
+
+        const auto reference = _reference - lag;
+
+        auto sum = 0.0f;
+        for (auto i = begin; i < end; i++) {
+            sum += _microphone[i] * reference[i];
+        }
+
+        const auto energy = microphone_energy * reference_energy;
+        if (energy <= 0) {
+            continue;
+        }
+
+        const auto correlation = sum / sqrtf(energy);
+        if (correlation > best_correlation) {
+            best_correlation = correlation;
+            best_lag = lag;
+        }
+    }
+
+    if (best_correlation < MIN_CORRELATION) {
+        _has_last_lag = false;
+        return;
+    }
+
+    _correlation = best_correlation;
+
+    // Only act on a lag two windows agree on, so near end speech or a
+    // sudden noise doesn't move the reference around.
+
+    const auto agreed = _has_last_lag && abs(best_lag - _last_lag) <= MAX_LAG_DEVIATION;
+
+    _last_lag = best_lag;
+    _has_last_lag = true;
+
+    if (!agreed || best_lag == TARGET_LAG) {
+        return;
+    }
+
+    const int64_t delay_us = _delay_us;
+    const auto new_delay_us =
+        clamp(delay_us + ESP_TIMER_MS(best_lag - TARGET_LAG), (int64_t)0, (int64_t)ESP_TIMER_MS(MAX_DELAY_MS));
+
+    if (new_delay_us != delay_us) {
+        ESP_LOGI(TAG, "Echo delay %" PRId64 " ms, correlation %.2f", new_delay_us / 1000, best_correlation);
+
+        _delay_us = new_delay_us;
+
+        // The next window is measured with the new alignment.
+        _has_last_lag = false;
+    }
+}
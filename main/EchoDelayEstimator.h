@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+
+/**
+ * Estimator of the echo path delay, for aligning the AEC reference.
+ *
+ * The reference channel is aligned with the microphone by timestamps, which
+ * don't account for the DMA and amplifier latencies. This measures what's
+ * left. Both signals are reduced to their envelope, averaged over a
+ * millisecond, and the envelopes are cross-correlated over windows of about a
+ * second. A window only counts when playback was audible. When two windows
+ * in a row agree on a lag with a strong enough correlation, the delay is
+ * adjusted so the reference leads the echo by a little; the AEC filter can't
+ * model an echo that comes before its reference.
+ */
+class EchoDelayEstimator {
+    // Envelope samples are averaged over this many samples (1 ms).
+    static constexpr size_t DECIMATION = US_TO_SAMPLES(1000);
+    // Range of lags searched, in envelope samples (ms). The lag is how far
+    // the echo trails the reference as it's currently aligned.
+    static constexpr int MIN_LAG = -20;
+    static constexpr int MAX_LAG = 200;
+    // Envelope samples correlated per window, including the lag range.
+    static constexpr size_t WINDOW = 1000 + MAX_LAG - MIN_LAG;
+    // Windows where the reference envelope averages below this are skipped
+    // (-50 dBFS).
+    static constexpr float MIN_REFERENCE_LEVEL = 104;
+    // Minimum normalized correlation of the best lag.
+    static constexpr float MIN_CORRELATION = 0.4f;
+    // Lags of consecutive windows within this many ms agree.
+    static constexpr int MAX_LAG_DEVIATION = 2;
+    // Lag we keep between the reference and the echo.
+    static constexpr int TARGET_LAG = 2;
+
+    float _microphone[WINDOW];
+    float _reference[WINDOW];
+    size_t _window_len{};
+    int32_t _microphone_sum{};
+    int32_t _reference_sum{};
+    size_t _decimation_offset{};
+    int _last_lag{};
+    bool _has_last_lag{};
+    atomic<int64_t> _delay_us{};
+    atomic<float> _correlation{};
+
+public:
+    static constexpr uint32_t MAX_DELAY_MS = 250;
+
+    /** Forget the current window; keeps the delay. */
+    void reset();
+
+    /** Take a block of microphone and aligned reference audio. */
+    void process(const int16_t* microphone, const int16_t* reference, size_t samples);
+
+    /** Delay the reference should be read with, on top of the timestamps. */
+    int64_t get_delay_us() { return _delay_us; }
+    /** Correlation of the last window that counted. */
+    float get_correlation() { return _correlation; }
+
+private:
+    void estimate();
+};
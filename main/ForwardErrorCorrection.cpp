@@ -0,0 +1,194 @@
+#include "support.h"
+
+#include "ForwardErrorCorrection.h"
+
+#include <algorithm>
+
+LOG_TAG(ForwardErrorCorrection);
+
+FECEncoder::~FECEncoder() { free(_packet); }
+
+void FECEncoder::initialize(uint8_t group_size) {
+    free(_packet);
+    _packet = nullptr;
+
+    _group_size = group_size;
+
+    if (_group_size) {
+        _packet = (uint8_t*)malloc(UDPServer::PAYLOAD_LEN);
+        ESP_ERROR_ASSERT(_packet);
+    }
+
+    reset();
+}
+
+void FECEncoder::reset() {
+    _count = 0;
+    _parity_len = 0;
+    _len_xor = 0;
+    _timestamp_xor = 0;
+}
+
+size_t FECEncoder::add(int32_t packet_index, uint32_t timestamp, uint8_t* payload, size_t payload_len) {
+    if (!_group_size) {
+        return 0;
+    }
+
+    ESP_ERROR_ASSERT(payload_len <= FEC_MAX_PAYLOAD_LEN);
+
+    auto parity = _packet + sizeof(AudioFrameHeader) + FEC_HEADER_LEN;
+
+    if (_count == 0) {
+        _first_packet_index = packet_index;
+        _first_timestamp = timestamp;
+    }
+
+    // Extend the parity with zeros if this payload is longer than the ones before it.
+
+    if (payload_len > _parity_len) {
+        memset(parity + _parity_len, 0, payload_len - _parity_len);
+        _parity_len = payload_len;
+    }
+
+    for (size_t i = 0; i < payload_len; i++) {
+        parity[i] ^= payload[i];
+    }
+
+    _len_xor ^= (uint16_t)payload_len;
+    _timestamp_xor ^= timestamp;
+
+    if (++_count < _group_size) {
+        return 0;
+    }
+
+    auto header = (AudioFrameHeader*)_packet;
+    header->packet_index = htonl(FEC_PARITY_FLAG | (uint32_t)_first_packet_index);
+    header->timestamp = htonl(_first_timestamp);
+
+    auto fec_header = _packet + sizeof(AudioFrameHeader);
+    fec_header[0] = _count;
+    fec_header[1] = (uint8_t)(_len_xor >> 8);
+    fec_header[2] = (uint8_t)_len_xor;
+    fec_header[3] = (uint8_t)(_timestamp_xor >> 24);
+    fec_header[4] = (uint8_t)(_timestamp_xor >> 16);
+    fec_header[5] = (uint8_t)(_timestamp_xor >> 8);
+    fec_header[6] = (uint8_t)_timestamp_xor;
+
+    const auto packet_len = sizeof(AudioFrameHeader) + FEC_HEADER_LEN + _parity_len;
+
+    reset();
+
+    return packet_len;
+}
+
+FECDecoder::~FECDecoder() { free(_parity); }
+
+void FECDecoder::reset() {
+    start_group();
+
+    _next_packet_index = INT32_MIN;
+}
+
+void FECDecoder::start_group() {
+    _parity_len = 0;
+    _len_xor = 0;
+    _timestamp_xor = 0;
+    _count = 0;
+    _packet_index_sum = 0;
+    _min_packet_index = INT32_MAX;
+    _max_packet_index = INT32_MIN;
+}
+
+void FECDecoder::add(int32_t packet_index, uint32_t timestamp, uint8_t* payload, size_t payload_len) {
+    // A late packet of a group we're done with would otherwise end up in
+    // the parity of the group being collected.
+
+    if (!_parity || packet_index < _next_packet_index) {
+        return;
+    }
+
+    // The parity buffer may still hold a recovered payload. Clear it on
+    // the first packet of the next group.
+
+    if (_count == 0) {
+        memset(_parity, 0, _parity_len);
+        start_group();
+    }
+
+    payload_len = min(payload_len, FEC_MAX_PAYLOAD_LEN);
+
+    for (size_t i = 0; i < payload_len; i++) {
+        _parity[i] ^= payload[i];
+    }
+
+    _parity_len = max(_parity_len, payload_len);
+    _len_xor ^= (uint16_t)payload_len;
+    _timestamp_xor ^= timestamp;
+    _count++;
+    _packet_index_sum += packet_index;
+    _min_packet_index = min(_min_packet_index, packet_index);
+    _max_packet_index = max(_max_packet_index, packet_index);
+}
+
+size_t FECDecoder::recover(int32_t first_packet_index, uint8_t* buffer, size_t buffer_len, int32_t& packet_index,
+                           uint32_t& timestamp) {
+    if (buffer_len < FEC_HEADER_LEN || buffer_len - FEC_HEADER_LEN > FEC_MAX_PAYLOAD_LEN) {
+        ESP_LOGW(TAG, "Invalid parity packet length %d", (int)buffer_len);
+        return 0;
+    }
+
+    if (!_parity) {
+        // Start tracking parity from the next group.
+
+        _parity = (uint8_t*)calloc(1, FEC_MAX_PAYLOAD_LEN);
+        ESP_ERROR_ASSERT(_parity);
+
+        reset();
+
+        return 0;
+    }
+
+    const auto count = (int32_t)buffer[0];
+
+    _next_packet_index = max(_next_packet_index, first_packet_index + count);
+
+    if (_count == 0) {
+        return 0;
+    }
+
+    const auto len_xor = (uint16_t)((buffer[1] << 8) | buffer[2]);
+    const auto timestamp_xor =
+        ((uint32_t)buffer[3] << 24) | ((uint32_t)buffer[4] << 16) | ((uint32_t)buffer[5] << 8) | buffer[6];
+    const auto parity = buffer + FEC_HEADER_LEN;
+    const auto parity_len = buffer_len - FEC_HEADER_LEN;
+
+    size_t recovered_len = 0;
+
+    // We can only recover if exactly one packet of this group is missing,
+    // and all packets we've seen belong to this group.
+
+    if (count == _count + 1 && _min_packet_index >= first_packet_index &&
+        _max_packet_index < first_packet_index + count) {
+        const auto expected_sum = (int64_t)count * first_packet_index + (int64_t)count * (count - 1) / 2;
+
+        packet_index = (int32_t)(expected_sum - _packet_index_sum);
+        timestamp = timestamp_xor ^ _timestamp_xor;
+        recovered_len = len_xor ^ _len_xor;
+
+        if (recovered_len > parity_len) {
+            ESP_LOGW(TAG, "Invalid recovered packet length %d", (int)recovered_len);
+            recovered_len = 0;
+        } else {
+            for (size_t i = 0; i < recovered_len; i++) {
+                _parity[i] ^= parity[i];
+            }
+
+            // Bytes past the recovered length must be cleared on the next group.
+            _parity_len = max(_parity_len, recovered_len);
+        }
+    }
+
+    _count = 0;
+
+    return recovered_len;
+}
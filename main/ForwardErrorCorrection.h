@@ -0,0 +1,94 @@
+#pragma once
+
+#include "AudioFrame.h"
+#include "UDPServer.h"
+
+/**
+ * XOR parity over groups of audio packets.
+ *
+ * After every group of packets, a parity packet is sent that holds the XOR
+ * of the payloads of the group. A receiver that lost a single packet of a
+ * group can recover it from the parity packet and the other packets.
+ *
+ * Parity packets have the high bit of the packet index set, followed by the
+ * index of the first packet of the group. The timestamp is that of the first
+ * packet of the group. Receivers that don't know about parity packets drop
+ * them because their packet index is negative. The payload of a parity
+ * packet is:
+ *
+ *   uint8_t  number of packets in the group
+ *   uint16_t XOR of the payload lengths of the group (big endian)
+ *   uint32_t XOR of the timestamps of the group (big endian)
+ *   uint8_t  XOR of the payloads of the group, as long as the longest payload
+ */
+
+static constexpr uint32_t FEC_PARITY_FLAG = 0x80000000;
+static constexpr size_t FEC_HEADER_LEN = 7;
+// Maximum payload of an audio packet that's protected by parity.
+static constexpr size_t FEC_MAX_PAYLOAD_LEN = UDPServer::PAYLOAD_LEN - sizeof(AudioFrameHeader) - FEC_HEADER_LEN;
+
+class FECEncoder {
+    uint8_t* _packet{};
+    size_t _parity_len{};
+    uint16_t _len_xor{};
+    uint32_t _timestamp_xor{};
+    uint8_t _group_size{};
+    uint8_t _count{};
+    int32_t _first_packet_index{};
+    uint32_t _first_timestamp{};
+
+public:
+    FECEncoder() {}
+    FECEncoder(const FECEncoder& other) = delete;
+    FECEncoder& operator=(const FECEncoder& other) = delete;
+    ~FECEncoder();
+
+    void initialize(uint8_t group_size);
+    bool is_enabled() { return _group_size > 0; }
+    void reset();
+
+    /**
+     * Add a sent audio packet. Returns the length of the parity packet that
+     * must be sent if this completes a group, or 0 otherwise.
+     */
+    size_t add(int32_t packet_index, uint32_t timestamp, uint8_t* payload, size_t payload_len);
+    uint8_t* get_packet() { return _packet; }
+};
+
+class FECDecoder {
+    uint8_t* _parity{};
+    size_t _parity_len{};
+    uint16_t _len_xor{};
+    uint32_t _timestamp_xor{};
+    uint8_t _count{};
+    int64_t _packet_index_sum{};
+    int32_t _min_packet_index{};
+    int32_t _max_packet_index{};
+    // Packets before this belong to a group whose parity has been processed.
+    int32_t _next_packet_index{INT32_MIN};
+
+public:
+    FECDecoder() {}
+    FECDecoder(const FECDecoder& other) = delete;
+    FECDecoder& operator=(const FECDecoder& other) = delete;
+    ~FECDecoder();
+
+    /** Parity is only tracked once the source has sent a parity packet. */
+    bool is_enabled() { return _parity != nullptr; }
+    void reset();
+
+    /** Add a received audio packet. Late packets of a finished group are ignored. */
+    void add(int32_t packet_index, uint32_t timestamp, uint8_t* payload, size_t payload_len);
+
+    /**
+     * Process a parity packet. If exactly one packet of its group went missing,
+     * the payload and header of that packet are recovered. Returns the length
+     * of the recovered payload, or 0 if nothing could be recovered.
+     */
+    size_t recover(int32_t first_packet_index, uint8_t* buffer, size_t buffer_len, int32_t& packet_index,
+                   uint32_t& timestamp);
+    uint8_t* get_payload() { return _parity; }
+
+private:
+    void start_group();
+};
@@ -0,0 +1,44 @@
+#include "support.h"
+
+#include "FractionalResampler.h"
+
+LOG_TAG(FractionalResampler);
+
+void FractionalResampler::reset() {
+    _position = ONE;
+    _last = 0;
+}
+
+size_t FractionalResampler::process(const int16_t* input, size_t input_len, int16_t* output, size_t max_output_len,
+                                    float ratio) {
+    if (!input_len) {
+        return 0;
+    }
+
+    const auto step = (uint32_t)lroundf(ratio * (float)ONE);
+
+    if (step == ONE && _position == ONE && input_len <= max_output_len) {
+        memcpy(output, input, input_len * sizeof(int16_t));
+        _last = input[input_len - 1];
+        return input_len;
+    }
+
+    const auto end = (uint32_t)input_len << FRACTION_BITS;
+
+    size_t output_len = 0;
+
+    for (; _position < end && output_len < max_output_len; _position += step) {
+        const auto index = _position >> FRACTION_BITS;
+        const auto fraction = (int32_t)((_position & (ONE - 1)) >> (FRACTION_BITS - 15));
+
+        const auto s0 = (int32_t)(index == 0 ? _last : input[index - 1]);
+        const auto s1 = (int32_t)input[index];
+
+        output[output_len++] = (int16_t)(s0 + (((s1 - s0) * fraction) >> 15));
+    }
+
+    _position = _position >= end ? _position - end : 0;
+    _last = input[input_len - 1];
+
+    return output_len;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+/**
+ * Resamples a stream by a ratio close to one using linear interpolation.
+ *
+ * The ratio may change between calls; the position in the stream carries
+ * over, so the output is continuous across packets. At a ratio of exactly
+ * one the input is copied unchanged.
+ */
+class FractionalResampler {
+    static constexpr int FRACTION_BITS = 20;
+    static constexpr uint32_t ONE = 1 << FRACTION_BITS;
+
+    // Position of the next output sample; 0 is the last sample of the
+    // previous input, ONE the first sample of the next input.
+    uint32_t _position{ONE};
+    int16_t _last{};
+
+public:
+    /** Upper bound for the output of an input of the given length. */
+    static constexpr size_t get_max_output_len(size_t input_len) { return input_len + input_len / 512 + 2; }
+
+    void reset();
+
+    /** Resample input, consuming ratio input samples per output sample. Returns the number of output samples. */
+    size_t process(const int16_t* input, size_t input_len, int16_t* output, size_t max_output_len, float ratio);
+};
@@ -6,16 +6,33 @@
 
 LOG_TAG(I2SPlaybackDevice);
 
+static bool is_mixer_changed(const AudioConfiguration& a, const AudioConfiguration& b) {
+    return a.audio_buffer_ms != b.audio_buffer_ms || a.jitter_buffer_adaptive != b.jitter_buffer_adaptive ||
+           a.jitter_buffer_percentile != b.jitter_buffer_percentile || a.codec != b.codec ||
+           a.frame_ms != b.frame_ms || a.transport != b.transport || a.mix_normalized != b.mix_normalized;
+}
+
+static bool is_auto_volume_changed(const AudioConfiguration& a, const AudioConfiguration& b) {
+    return a.playback_auto_volume_enabled != b.playback_auto_volume_enabled ||
+           a.playback_target_db != b.playback_target_db;
+}
+
 void I2SPlaybackDevice::begin(const AudioConfiguration& audio_config) {
+    _audio_config = audio_config;
     _volume_scale_low = audio_config.volume_scale_low;
     _volume_scale_high = audio_config.volume_scale_high;
     _auto_volume_enabled = audio_config.playback_auto_volume_enabled;
 
-    _buffer.initialize(audio_config.audio_buffer_ms);
+    _packet_queue.initialize(CONFIG_DEVICE_AUDIO_PACKET_QUEUE_LEN);
+    _buffer.initialize(audio_config);
 
     _auto_volume.set_target_db(audio_config.playback_target_db);
 
+    const auto latency_settings = get_latency_settings(audio_config);
+
     i2s_chan_config_t chan_config = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
+    chan_config.dma_desc_num = latency_settings.dma_desc_num;
+    chan_config.dma_frame_num = US_TO_SAMPLES(latency_settings.dma_frame_ms * 1000);
     ESP_ERROR_CHECK(i2s_new_channel(&chan_config, &_chan, NULL));
 
     i2s_std_config_t tx_std_cfg = {
@@ -38,13 +55,16 @@ void I2SPlaybackDevice::begin(const AudioConfiguration& audio_config) {
     };
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(_chan, &tx_std_cfg));
 
-    _write_buffer_len = AUDIO_BUFFER_LEN(CONFIG_DEVICE_AUDIO_CHUNK_MS);
+    _sample_clock.begin(_chan, sizeof(int16_t), true);
+
+    _write_buffer_len = AUDIO_BUFFER_LEN(latency_settings.chunk_ms);
     _write_buffer = (uint8_t*)heap_caps_malloc(_write_buffer_len, MALLOC_CAP_INTERNAL);
     ESP_ERROR_ASSERT(_write_buffer);
 }
 
 void I2SPlaybackDevice::set_volume(float volume) {
     volume = clamp(volume, 0.0f, 1.0f);
+    _volume = volume;
 
     const auto scaled_volume = _volume_scale_low + (_volume_scale_high - _volume_scale_low) * volume;
 
@@ -67,8 +87,6 @@ bool I2SPlaybackDevice::start() {
             result = true;
             _playing = true;
 
-            _buffer.reset();
-
             FREERTOS_CHECK(xTaskCreatePinnedToCore(
                 [](void* param) {
                     ((I2SPlaybackDevice*)param)->write_task();
@@ -109,15 +127,125 @@ bool I2SPlaybackDevice::stop() {
     return result;
 }
 
-void I2SPlaybackDevice::add_samples(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len) {
-    auto guard = _lock.take();
+void I2SPlaybackDevice::add_samples(Span<UDPPacket> packets) {
+    const auto queued = _packet_queue.push(packets, esp_timer_get_time());
+    if (queued < packets.len()) {
+        ESP_LOGW(TAG, "Dropping %d incoming packets; packet queue is full", (int)(packets.len() - queued));
+    }
+}
+
+bool I2SPlaybackDevice::reconfigure(const AudioConfiguration& audio_config) {
+    auto changed = false;
+
+    if (audio_config.volume_scale_low != _volume_scale_low || audio_config.volume_scale_high != _volume_scale_high) {
+        _volume_scale_low = audio_config.volume_scale_low;
+        _volume_scale_high = audio_config.volume_scale_high;
+
+        set_volume(_volume);
+
+        changed = true;
+    }
+
+    if (!is_mixer_changed(_audio_config, audio_config) && !is_auto_volume_changed(_audio_config, audio_config)) {
+        return changed;
+    }
+
+    {
+        auto guard = _lock.take();
+
+        _pending_audio_config = audio_config;
+        _reconfigure_pending = true;
+    }
+
+    // The write task picks the configuration up between chunks. If it isn't
+    // running, we apply it ourselves. We register before looking at
+    // _playing; a notification that comes in before we wait isn't lost.
+
+    while (true) {
+        {
+            auto guard = _lock.take();
+
+            if (!_reconfigure_pending) {
+                break;
+            }
+
+            _reconfigure_task = xTaskGetCurrentTaskHandle();
+        }
+
+        if (!_playing) {
+            auto task_guard = _task_lock.take();
+
+            apply_pending_audio_config();
+        } else {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
+
+    return true;
+}
+
+void I2SPlaybackDevice::apply_pending_audio_config() {
+    AudioConfiguration audio_config;
 
-    _buffer.append(source_addr, buffer, buffer_len);
+    {
+        auto guard = _lock.take();
+
+        if (!_reconfigure_pending) {
+            return;
+        }
+
+        audio_config = _pending_audio_config;
+    }
+
+    if (is_mixer_changed(_audio_config, audio_config)) {
+        ESP_LOGI(TAG, "Rebuilding mixer");
+
+        // Queued packets were sent with the old settings.
+        while (_packet_queue.front()) {
+            _packet_queue.pop();
+        }
+
+        _buffer.initialize(audio_config);
+    }
+
+    _auto_volume_enabled = audio_config.playback_auto_volume_enabled;
+    _auto_volume.set_target_db(audio_config.playback_target_db);
+
+    _audio_config = audio_config;
+    _reconfigure_pending = false;
+
+    notify_reconfigure_task();
+}
+
+void I2SPlaybackDevice::notify_reconfigure_task() {
+    TaskHandle_t task;
+
+    {
+        auto guard = _lock.take();
+
+        task = _reconfigure_task;
+        _reconfigure_task = nullptr;
+    }
+
+    if (task && task != xTaskGetCurrentTaskHandle()) {
+        xTaskNotifyGive(task);
+    }
+}
+
+void I2SPlaybackDevice::drain_packet_queue() {
+    PacketQueue::Packet* packet;
+    while ((packet = _packet_queue.front())) {
+        _buffer.append(&packet->source_addr, packet->buffer, packet->buffer_len, packet->arrival_time);
+
+        _packet_queue.pop();
+    }
 }
 
 void I2SPlaybackDevice::write_task() {
     auto task_guard = _task_lock.take();
 
+    _buffer.reset();
+
     // Wait a little bit to give the buffer some time to collect data.
 
     vTaskDelay(pdMS_TO_TICKS(10));
@@ -141,44 +269,50 @@ void I2SPlaybackDevice::write_task() {
 
     _recording_device.reset_feed_buffer();
 
+    _sample_clock.start();
+
     ESP_ERROR_CHECK(i2s_channel_enable(_chan));
 
-    // Calculate at what time sound should be playing from the buffer. We take the
-    // time that we enable the channel, plus the preloaded data above.
+    // Position of the next chunk in the played stream, after the preloaded
+    // data above. The sample clock maps it to the time it'll be playing.
 
-    auto playback_time = esp_timer_get_time() + SAMPLES_TO_US(preloaded_samples);
+    int64_t playback_samples = preloaded_samples;
 
     while (_playing) {
-        bool has_data;
-
-        {
-            auto guard = _lock.take();
-
-            has_data = _buffer.has_data();
-            if (has_data) {
-                _buffer.take(_write_buffer, _write_buffer_len);
-            }
+        if (_reconfigure_pending) {
+            apply_pending_audio_config();
         }
 
-        if (!has_data) {
+        drain_packet_queue();
+
+        if (!_buffer.has_data()) {
             ESP_LOGI(TAG, "Buffer exhausted");
 
             _buffer_exhausted.call();
             break;
         }
 
+        _buffer.take(_write_buffer, _write_buffer_len);
+
         if (_auto_volume_enabled) {
             _auto_volume.process_block((int16_t*)_write_buffer, _write_buffer_len / sizeof(int16_t));
         }
 
-        _recording_device.feed_reference_samples(playback_time, _write_buffer, _write_buffer_len);
-        playback_time += SAMPLES_TO_US(_write_buffer_len / sizeof(int16_t));
+        _sample_clock.update();
+
+        _recording_device.feed_reference_samples(_sample_clock.get_time(playback_samples), _write_buffer,
+                                                 _write_buffer_len);
+        playback_samples += _write_buffer_len / sizeof(int16_t);
 
         ESP_ERROR_CHECK(i2s_channel_write(_chan, _write_buffer, _write_buffer_len, nullptr, portMAX_DELAY));
     }
 
     ESP_LOGI(TAG, "Exiting write task");
 
+    // A configuration that came in while we were stopping is applied by
+    // reconfigure() once we release the task lock.
+    notify_reconfigure_task();
+
     _recording_device.reset_feed_buffer();
 
     ESP_ERROR_CHECK(i2s_channel_disable(_chan));
@@ -8,15 +8,20 @@
 #include "Callback.h"
 #include "I2SRecordingDevice.h"
 #include "Mutex.h"
+#include "PacketQueue.h"
+#include "SampleClock.h"
 #include "driver/i2s_std.h"
 
 class I2SPlaybackDevice {
     I2SRecordingDevice& _recording_device;
     i2s_chan_handle_t _chan;
+    SampleClock _sample_clock;
     atomic<bool> _playing;
     Callback<bool> _playing_changed;
     Mutex _task_lock;
     Mutex _lock;
+    // Received packets are handed to the write task, which owns the mixer.
+    PacketQueue _packet_queue;
     AudioMixer _buffer;
     Callback<void> _buffer_exhausted;
     AutoVolume _auto_volume;
@@ -25,7 +30,18 @@ class I2SPlaybackDevice {
     size_t _write_buffer_len;
     float _volume_scale_low;
     float _volume_scale_high;
+    float _volume{};
     bool _auto_volume_enabled;
+    // Configuration the mixer and auto volume are set up with. Only the write
+    // task, or whoever holds the task lock, changes it.
+    AudioConfiguration _audio_config;
+    // Configuration waiting to be applied between chunks (guarded by _lock).
+    AudioConfiguration _pending_audio_config;
+    atomic<bool> _reconfigure_pending{};
+    // Task waiting in reconfigure() for the configuration to be applied
+    // (guarded by _lock). It's notified when the write task applies it or
+    // exits.
+    TaskHandle_t _reconfigure_task{};
 
 public:
     I2SPlaybackDevice(I2SRecordingDevice& recording_device) : _recording_device(recording_device) {}
@@ -36,10 +52,20 @@ public:
     void on_buffer_exhausted(function<void()> func) { _buffer_exhausted.add(func); }
     void on_volume_changed(function<void(float)> func) { _volume_changed.add(func); }
     bool is_playing() { return _playing; }
+    /** Drift of the playback sample clock against the timer, as a fraction. */
+    float get_clock_drift() { return _sample_clock.get_drift(); }
     bool start();
     bool stop();
-    void add_samples(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len);
+    void add_samples(Span<UDPPacket> packets);
+    /**
+     * Apply a new audio configuration, rebuilding only the parts whose
+     * settings changed. Returns whether anything changed.
+     */
+    bool reconfigure(const AudioConfiguration& audio_config);
 
 private:
     void write_task();
+    void drain_packet_queue();
+    void apply_pending_audio_config();
+    void notify_reconfigure_task();
 };
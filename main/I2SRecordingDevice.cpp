@@ -4,6 +4,8 @@
 
 #include <algorithm>
 
+#include "AudioKernels.h"
+
 LOG_TAG(I2SRecordingDevice);
 
 I2SRecordingDevice::I2SRecordingDevice(UDPServer& udp_server) : _udp_server(udp_server) {
@@ -13,20 +15,46 @@ I2SRecordingDevice::I2SRecordingDevice(UDPServer& udp_server) : _udp_server(udp_
 }
 
 void I2SRecordingDevice::begin(const AudioConfiguration& audio_config) {
+    _audio_config = audio_config;
     _enable_audio_processing = audio_config.enable_audio_processing;
+    // Without audio processing, the device does its own voice activity detection.
+    _voice_activity_detection = audio_config.dtx_enabled && _enable_audio_processing;
     _microphone_gain_bits = audio_config.microphone_gain_bits;
     _auto_volume_enabled = audio_config.recording_auto_volume_enabled;
-    _smoothing_factor = audio_config.recording_smoothing_factor;
 
-    _feed_buffer.initialize(AUDIO_BUFFER_LEN(audio_config.audio_buffer_ms * 2));
+    const auto latency_settings = get_latency_settings(audio_config);
+
+    // The reference is held back by the echo delay on top of the time it's
+    // fed ahead of playback.
+    _feed_buffer.initialize(
+        AUDIO_BUFFER_LEN((latency_settings.audio_buffer_ms * 2 + EchoDelayEstimator::MAX_DELAY_MS)));
+
+    begin_i2s(latency_settings);
+    begin_afe(latency_settings);
 
-    begin_i2s();
-    begin_afe();
+    allocate_buffers();
+
+    _recording_gain.begin(audio_config.recording_smoothing_factor, _read_buffer_len / sizeof(int32_t));
+
+    start_forward_task();
+}
 
+void I2SRecordingDevice::allocate_buffers() {
     const auto feed_chunksize = _afe_handle->get_feed_chunksize(_afe_data);
     const auto feed_nch = _afe_handle->get_feed_channel_num(_afe_data);
     assert(feed_nch == 2);
-    _work_buffer_len = feed_chunksize * feed_nch * sizeof(int16_t);
+
+    const auto work_buffer_len = feed_chunksize * feed_nch * sizeof(int16_t);
+    if (work_buffer_len == _work_buffer_len) {
+        return;
+    }
+
+    free(_work_buffer);
+    free(_reference_buffer);
+    free(_read_buffer);
+    free(_microphone_buffer);
+
+    _work_buffer_len = work_buffer_len;
     _work_buffer = (int16_t*)heap_caps_malloc(_work_buffer_len, MALLOC_CAP_INTERNAL);
     ESP_ERROR_ASSERT(_work_buffer);
     _reference_buffer = (int16_t*)heap_caps_malloc(_work_buffer_len, MALLOC_CAP_INTERNAL);
@@ -36,7 +64,11 @@ void I2SRecordingDevice::begin(const AudioConfiguration& audio_config) {
     _read_buffer_len = feed_chunksize * 1 /* mono */ * sizeof(int32_t);
     _read_buffer = heap_caps_malloc(_read_buffer_len, MALLOC_CAP_INTERNAL);
     ESP_ERROR_ASSERT(_read_buffer);
+    _microphone_buffer = (int16_t*)heap_caps_malloc(feed_chunksize * sizeof(int16_t), MALLOC_CAP_INTERNAL);
+    ESP_ERROR_ASSERT(_microphone_buffer);
+}
 
+void I2SRecordingDevice::start_forward_task() {
     FREERTOS_CHECK(xTaskCreatePinnedToCore(
         [](void* param) {
             ((I2SRecordingDevice*)param)->forward_task();
@@ -46,8 +78,10 @@ void I2SRecordingDevice::begin(const AudioConfiguration& audio_config) {
         "forward_task", CONFIG_ESP_MAIN_TASK_STACK_SIZE, this, 5, nullptr, 0));
 }
 
-void I2SRecordingDevice::begin_i2s() {
+void I2SRecordingDevice::begin_i2s(const LatencySettings& latency_settings) {
     i2s_chan_config_t chan_config = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_1, I2S_ROLE_MASTER);
+    chan_config.dma_desc_num = latency_settings.dma_desc_num;
+    chan_config.dma_frame_num = US_TO_SAMPLES(latency_settings.dma_frame_ms * 1000);
     ESP_ERROR_CHECK(i2s_new_channel(&chan_config, NULL, &_chan));
 
     i2s_std_config_t rx_std_cfg = {
@@ -81,13 +115,17 @@ void I2SRecordingDevice::begin_i2s() {
             },
     };
     ESP_ERROR_CHECK(i2s_channel_init_std_mode(_chan, &rx_std_cfg));
+
+    _sample_clock.begin(_chan, sizeof(int32_t), false);
 }
 
-void I2SRecordingDevice::begin_afe() {
+void I2SRecordingDevice::begin_afe(const LatencySettings& latency_settings) {
     // Quick and dirty way to properly initialize an empty models data structure.
     // The first four bytes of the model partition is the number of models.
-    int32_t model_count = 0;
-    _models = srmodel_load(&model_count);
+    if (!_models) {
+        int32_t model_count = 0;
+        _models = srmodel_load(&model_count);
+    }
 
     // _models = esp_srmodel_init("model");
 
@@ -118,7 +156,7 @@ void I2SRecordingDevice::begin_afe() {
 
     /********** VAD(Voice Activity Detection) **********/
     // Whether to init vad
-    afe_config->vad_init = false;
+    afe_config->vad_init = _voice_activity_detection;
     // The value can be: VAD_MODE_0, VAD_MODE_1, VAD_MODE_2, VAD_MODE_3, VAD_MODE_4
     // afe_config->vad_mode;
     // The model name of vad, If it is null, WebRTC VAD will be used.
@@ -168,6 +206,7 @@ void I2SRecordingDevice::begin_afe() {
     // The preferred priority of afe se task, which is created in afe_create function.
     // afe_config->afe_perferred_priority;
     // The ring buffer size: the number of frame data in ring buffer.
+    afe_config->afe_ringbuf_size = latency_settings.afe_ringbuf_size;
     // afe_config->afe_ringbuf_size;
     // The memory alloc mode for afe. From Internal RAM or PSRAM
     // afe_config->memory_alloc_mode;
@@ -185,33 +224,37 @@ void I2SRecordingDevice::begin_afe() {
     ESP_ERROR_ASSERT(_afe_data);
 
     afe_config_free(afe_config);
+
+    _processing_ms =
+        _enable_audio_processing ? SAMPLES_TO_US(_afe_handle->get_fetch_chunksize(_afe_data)) / 1000 : 0;
 }
 
-int32_t I2SRecordingDevice::scale_sample(int32_t sample, float& smoothed_peak) {
-    // This logic implements a smoothing algorithm to dynamically
-    // scale the raw samples to 16 bits.
+void I2SRecordingDevice::rebuild_afe(const AudioConfiguration& audio_config) {
+    // The forward task is blocked fetching from the AFE. Feed it silence
+    // until it notices it has to stop.
 
-    const auto abs_sample = abs((float)(sample));
+    _stop_forward_task = true;
 
-    // Update the smoothed peak:
-    // - If the current sample exceeds the current smoothedPeak, update immediately.
-    // - Otherwise, decay the smoothed peak slowly.
+    memset(_work_buffer, 0, _work_buffer_len);
 
-    if (abs_sample > smoothed_peak) {
-        smoothed_peak = abs_sample;
-    } else {
-        smoothed_peak = smoothed_peak * (1.0f - _smoothing_factor) + abs_sample * _smoothing_factor;
-    }
+    while (_stop_forward_task) {
+        _afe_handle->feed(_afe_data, _work_buffer);
 
-    // Prevent division by zero or very small numbers.
-    if (smoothed_peak < 1.0f) {
-        smoothed_peak = 1.0f;
+        vTaskDelay(1);
     }
 
-    // Calculate the gain factor to map the smoothed peak to the 16-bit maximum.
-    const auto gain = min(1.0f, float(INT16_MAX) / smoothed_peak);
+    _afe_handle->destroy(_afe_data);
+    _afe_data = nullptr;
+
+    _enable_audio_processing = audio_config.enable_audio_processing;
+    _voice_activity_detection = audio_config.dtx_enabled && _enable_audio_processing;
+    _voice_active = false;
 
-    return int32_t(sample * gain);
+    begin_afe(get_latency_settings(audio_config));
+
+    allocate_buffers();
+
+    start_forward_task();
 }
 
 bool I2SRecordingDevice::start() {
@@ -228,16 +271,7 @@ bool I2SRecordingDevice::start() {
             result = true;
             _recording = true;
 
-            // AFE requires a significantly larger than normal stack.
-            const int AFE_TASK_SIZE = 8192;
-
-            FREERTOS_CHECK(xTaskCreatePinnedToCore(
-                [](void* param) {
-                    ((I2SRecordingDevice*)param)->read_task();
-
-                    vTaskDelete(nullptr);
-                },
-                "read_task", AFE_TASK_SIZE, this, 5, nullptr, 1));
+            start_read_task();
         }
     }
 
@@ -248,6 +282,19 @@ bool I2SRecordingDevice::start() {
     return true;
 }
 
+void I2SRecordingDevice::start_read_task() {
+    // AFE requires a significantly larger than normal stack.
+    const int AFE_TASK_SIZE = 8192;
+
+    FREERTOS_CHECK(xTaskCreatePinnedToCore(
+        [](void* param) {
+            ((I2SRecordingDevice*)param)->read_task();
+
+            vTaskDelete(nullptr);
+        },
+        "read_task", AFE_TASK_SIZE, this, 5, nullptr, 1));
+}
+
 bool I2SRecordingDevice::stop() {
     bool result = false;
 
@@ -271,6 +318,77 @@ bool I2SRecordingDevice::stop() {
     return result;
 }
 
+bool I2SRecordingDevice::reconfigure(const AudioConfiguration& audio_config) {
+    const auto gain_changed =
+        audio_config.microphone_gain_bits != _audio_config.microphone_gain_bits ||
+        audio_config.recording_auto_volume_enabled != _audio_config.recording_auto_volume_enabled ||
+        audio_config.recording_smoothing_factor != _audio_config.recording_smoothing_factor;
+    const auto feed_buffer_changed = audio_config.audio_buffer_ms != _audio_config.audio_buffer_ms;
+    const auto afe_changed = audio_config.enable_audio_processing != _audio_config.enable_audio_processing ||
+                             audio_config.dtx_enabled != _audio_config.dtx_enabled;
+
+    if (!gain_changed && !feed_buffer_changed && !afe_changed) {
+        return false;
+    }
+
+    // Have the read task exit after the block it's working on, and restart
+    // it once we're done.
+
+    bool recording;
+
+    {
+        auto guard = _lock.take();
+
+        recording = _recording;
+        _recording = false;
+    }
+
+    {
+        auto task_guard = _task_lock.take();
+
+        if (gain_changed) {
+            _microphone_gain_bits = audio_config.microphone_gain_bits;
+            _auto_volume_enabled = audio_config.recording_auto_volume_enabled;
+        }
+
+        if (feed_buffer_changed) {
+            ESP_LOGI(TAG, "Rebuilding feed buffer");
+
+            const auto latency_settings = get_latency_settings(audio_config);
+
+            auto guard = _lock.take();
+
+            _feed_buffer.initialize(
+                AUDIO_BUFFER_LEN((latency_settings.audio_buffer_ms * 2 + EchoDelayEstimator::MAX_DELAY_MS)));
+            _feed_buffer_end_time = 0;
+        }
+
+        if (afe_changed) {
+            ESP_LOGI(TAG, "Rebuilding AFE");
+
+            rebuild_afe(audio_config);
+        }
+
+        // Rebuilding the AFE may change the read block length.
+        if (gain_changed || afe_changed) {
+            _recording_gain.begin(audio_config.recording_smoothing_factor, _read_buffer_len / sizeof(int32_t));
+        }
+
+        _audio_config = audio_config;
+
+        if (recording) {
+            auto guard = _lock.take();
+
+            // The read task waits for us to release the task lock.
+            _recording = true;
+
+            start_read_task();
+        }
+    }
+
+    return true;
+}
+
 void I2SRecordingDevice::reset_feed_buffer() {
     auto guard = _lock.take();
 
@@ -289,83 +407,139 @@ void I2SRecordingDevice::read_task() {
     auto task_guard = _task_lock.take();
 
     size_t work_buffer_offset = 0;
-    auto smoothed_peak = 1.0f;
+
+    _recording_gain.reset();
+
+    _sample_clock.start();
 
     ESP_ERROR_CHECK(i2s_channel_enable(_chan));
 
-    // Capture the time we start recording. We assume that we're taking samples from
-    // the moment we've enabled the channel.
-    auto recording_time = esp_timer_get_time();
+    // Position of the next block in the recorded stream. The sample clock
+    // maps it to the time it was recorded.
+    int64_t recording_samples = 0;
 
     auto feed_buffer_synced = false;
 
+    _echo_delay_estimator.reset();
+
     while (_recording) {
         size_t read;
         ESP_ERROR_CHECK(i2s_channel_read(_chan, _read_buffer, _read_buffer_len, &read, portMAX_DELAY));
 
         const auto samples = read / sizeof(int32_t);
 
+        _sample_clock.update();
+
+        const auto recording_time = _sample_clock.get_time(recording_samples);
+        recording_samples += samples;
+
+        // The echo reaches the microphone later than the timestamps say, so
+        // the reference is read delayed by the estimated echo delay.
+
+        const auto reference_time = recording_time - _echo_delay_estimator.get_delay_us();
+
         size_t reference_read = 0;
+        size_t hold = 0;
 
         {
             auto guard = _lock.take();
 
+            const auto feed_buffer_start_time =
+                _feed_buffer_end_time - SAMPLES_TO_US(_feed_buffer.available() / sizeof(int16_t));
+
             if (!feed_buffer_synced) {
                 // Sync the feed buffer with the recording offset. If the current recording
                 // time lies within the data buffered in the feed buffer, sync up the head
                 // of the feed buffer with the recording time and take samples from it.
 
-                auto feed_buffer_start_time =
-                    _feed_buffer_end_time - SAMPLES_TO_US(_feed_buffer.available() / sizeof(int16_t));
-
-                if (recording_time >= feed_buffer_start_time && recording_time <= _feed_buffer_end_time) {
+                if (reference_time >= feed_buffer_start_time && reference_time <= _feed_buffer_end_time) {
                     // Sync up the head of the feed buffer with the recording time.
-                    const auto skip = US_TO_SAMPLES(recording_time - feed_buffer_start_time) * sizeof(int16_t);
+                    const auto skip = US_TO_SAMPLES(reference_time - feed_buffer_start_time) * sizeof(int16_t);
 
                     _feed_buffer.skip(skip);
 
                     feed_buffer_synced = true;
                 }
+            } else {
+                // Keep the head of the feed buffer aligned with the reference
+                // time. This follows changes of the echo delay and the drift
+                // between the playback and recording clocks. A reference
+                // that's behind skips ahead; one that's ahead is held back
+                // with silence.
+
+                const auto misalignment = (int32_t)US_TO_SAMPLES(reference_time - feed_buffer_start_time);
+
+                if (misalignment >= MAX_REFERENCE_MISALIGNMENT) {
+                    const auto skip = misalignment * sizeof(int16_t);
+                    if (_feed_buffer.skip(skip) < skip) {
+                        feed_buffer_synced = false;
+                    }
+                } else if (misalignment <= -MAX_REFERENCE_MISALIGNMENT) {
+                    hold = min((size_t)-misalignment, samples);
+
+                    memset(_reference_buffer, 0, hold * sizeof(int16_t));
+                }
             }
 
             if (feed_buffer_synced) {
-                reference_read = _feed_buffer.read(_reference_buffer, samples * sizeof(int16_t));
+                reference_read = hold * sizeof(int16_t) +
+                                 _feed_buffer.read(_reference_buffer + hold, (samples - hold) * sizeof(int16_t));
                 if (reference_read < samples * sizeof(int16_t)) {
                     feed_buffer_synced = false;
                 }
             }
         }
 
-        recording_time += SAMPLES_TO_US(samples);
-
         const auto reference_samples = reference_read / sizeof(int16_t);
 
-        auto source = (int32_t*)_read_buffer;
+        // Missing reference audio is silence.
+        if (reference_samples < samples) {
+            memset(_reference_buffer + reference_samples, 0, (samples - reference_samples) * sizeof(int16_t));
+        }
 
-        for (int i = 0; i < samples; i++) {
-            // The INMP441 writes bits 1 through 24. To align this with a 32 bit value,
-            // the shift would have to be (source << 1) >> 8. We however need to compress
-            // the value into 16 bits. This is done with a smoothing algorithm.
-            // The value of _microphone_gain_bits determines how much
-            // bits we actually give the method. The full 24 bit range is too much (it
-            // picks up far to low volume audio), so we clip the bottom here already.
-            //
-            // The result will be 24 bits compressed into (16 + _microphone_gain_bits)
-            // bits.
+        // The INMP441 writes bits 1 through 24. To align this with a 32 bit value,
+        // the shift would have to be (source << 1) >> 8. We however need to compress
+        // the value into 16 bits. This is done with a smoothing algorithm.
+        // The value of _microphone_gain_bits determines how much
+        // bits we actually give the method. The full 24 bit range is too much (it
+        // picks up far to low volume audio), so we clip the bottom here already.
+        //
+        // The result will be 24 bits compressed into (16 + _microphone_gain_bits)
+        // bits.
+
+        const auto source = (int32_t*)_read_buffer;
+        const auto shift = 16 - _microphone_gain_bits;
+
+        if (_auto_volume_enabled) {
+            _recording_gain.process(source, _microphone_buffer, samples, shift);
+        } else {
+            convert_microphone_audio(source, _microphone_buffer, samples, shift);
+        }
+
+        if (_enable_audio_processing) {
+            _echo_delay_estimator.process(_microphone_buffer, _reference_buffer, samples);
+        }
 
-            const auto raw_sample = (source[i] << 1) >> (16 - _microphone_gain_bits);
-            const auto scaled_sample = _auto_volume_enabled ? scale_sample(raw_sample, smoothed_peak) : raw_sample;
-            const auto sample = (int16_t)clamp<int32_t>(scaled_sample, INT16_MIN, INT16_MAX);
+        // The work buffer holds the left mic and the playback/reference
+        // channel interleaved if we're feeding the AFE, or just the mic.
 
-            const auto reference_sample = i < reference_samples ? _reference_buffer[i] : 0;
+        const auto channels = _enable_audio_processing ? 2 : 1;
+        const auto work_buffer_samples = _work_buffer_len / sizeof(int16_t) / channels;
 
-            _work_buffer[work_buffer_offset++] = sample;  // Left mic.
+        for (size_t offset = 0; offset < samples;) {
+            const auto len = min(samples - offset, work_buffer_samples - work_buffer_offset);
 
             if (_enable_audio_processing) {
-                _work_buffer[work_buffer_offset++] = reference_sample;  // Playback/reference channel.
+                interleave_audio(_microphone_buffer + offset, _reference_buffer + offset,
+                                 _work_buffer + work_buffer_offset * channels, len);
+            } else {
+                memcpy(_work_buffer + work_buffer_offset, _microphone_buffer + offset, len * sizeof(int16_t));
             }
 
-            if (work_buffer_offset * sizeof(int16_t) >= _work_buffer_len) {
+            offset += len;
+            work_buffer_offset += len;
+
+            if (work_buffer_offset == work_buffer_samples) {
                 if (_enable_audio_processing) {
                     _afe_handle->feed(_afe_data, _work_buffer);
                 } else {
@@ -375,7 +549,7 @@ void I2SRecordingDevice::read_task() {
                 work_buffer_offset = 0;
 
 #ifdef CONFIG_DEVICE_DUMP_AFE_INPUT
-                _udp_server.send((sockaddr*)&_dump_target, sizeof(_dump_target), feed_buffer, feed_buffer_len);
+                _udp_server.send((sockaddr*)&_dump_target, sizeof(_dump_target), _work_buffer, _work_buffer_len);
 #endif
             }
         }
@@ -392,6 +566,15 @@ void I2SRecordingDevice::forward_task() {
         ESP_ERROR_ASSERT(res);
         ESP_ERROR_CHECK(res->ret_value);
 
+        if (_stop_forward_task) {
+            _stop_forward_task = false;
+            break;
+        }
+
+        if (_voice_activity_detection) {
+            _voice_active = res->vad_state == VAD_SPEECH;
+        }
+
         _data_available.call({(uint8_t*)res->data, (size_t)res->data_size});
     }
 }
@@ -4,8 +4,11 @@
 
 #include "AudioConfiguration.h"
 #include "Callback.h"
+#include "EchoDelayEstimator.h"
 #include "Mutex.h"
+#include "RecordingGain.h"
 #include "RingBuffer.h"
+#include "SampleClock.h"
 #include "Signal.h"
 #include "Span.h"
 #include "UDPServer.h"
@@ -14,11 +17,18 @@
 #include "esp_afe_sr_models.h"
 
 class I2SRecordingDevice {
+    // The reference is realigned once it's off by this many samples.
+    static constexpr int32_t MAX_REFERENCE_MISALIGNMENT = US_TO_SAMPLES(500);
+
     UDPServer &_udp_server;
     i2s_chan_handle_t _chan;
-    srmodel_list_t *_models;
+    SampleClock _sample_clock;
+    srmodel_list_t *_models{};
     const esp_afe_sr_iface_t *_afe_handle;
     esp_afe_sr_data_t *_afe_data;
+    uint32_t _processing_ms{};
+    // Set to have the forward task exit; it clears it when it does.
+    atomic<bool> _stop_forward_task{};
     atomic<bool> _recording{};
     Callback<bool> _recording_changed;
     Mutex _task_lock;
@@ -27,15 +37,21 @@ class I2SRecordingDevice {
     Callback<Span<uint8_t>> _data_available;
     RingBuffer _feed_buffer;
     int64_t _feed_buffer_end_time{};
-    int16_t *_work_buffer;
-    size_t _work_buffer_len;
-    int16_t *_reference_buffer;
-    void *_read_buffer;
-    size_t _read_buffer_len;
+    int16_t *_work_buffer{};
+    size_t _work_buffer_len{};
+    int16_t *_reference_buffer{};
+    int16_t *_microphone_buffer{};
+    void *_read_buffer{};
+    size_t _read_buffer_len{};
     uint8_t _microphone_gain_bits;
     bool _auto_volume_enabled;
-    float _smoothing_factor;
+    RecordingGain _recording_gain;
+    EchoDelayEstimator _echo_delay_estimator;
     bool _enable_audio_processing;
+    bool _voice_activity_detection;
+    atomic<bool> _voice_active{};
+    // Configuration the device is set up with.
+    AudioConfiguration _audio_config;
 #ifdef CONFIG_DEVICE_DUMP_AFE_INPUT
     sockaddr_in _dump_target;
 #endif
@@ -49,13 +65,35 @@ public:
     bool start();
     bool stop();
     void on_data_available(function<void(Span<uint8_t>)> func) { _data_available.add(func); }
+    /**
+     * Apply a new audio configuration, rebuilding only the parts whose
+     * settings changed. Recording pauses while that happens. Returns whether
+     * anything changed.
+     */
+    bool reconfigure(const AudioConfiguration &audio_config);
+    /** Whether the AFE classifies the audio passed to the data available callback. */
+    bool has_voice_activity_detection() { return _voice_activity_detection; }
+    /** Whether the AFE classified the audio being passed to the data available callback as speech. */
+    bool is_voice_active() { return _voice_active; }
+    /** Audio read from the microphone in one go. */
+    uint32_t get_block_ms() { return SAMPLES_TO_US(_read_buffer_len / sizeof(int32_t)) / 1000; }
+    /** Audio the AFE processes in one go, or 0 without audio processing. */
+    uint32_t get_processing_ms() { return _processing_ms; }
+    /** Estimated delay of the echo on top of the reference timestamps. */
+    int64_t get_echo_delay_us() { return _echo_delay_estimator.get_delay_us(); }
+    float get_echo_correlation() { return _echo_delay_estimator.get_correlation(); }
+    /** Drift of the recording sample clock against the timer, as a fraction. */
+    float get_clock_drift() { return _sample_clock.get_drift(); }
     void reset_feed_buffer();
     void feed_reference_samples(int64_t time, uint8_t *buffer, size_t len);
 
 private:
+    void start_read_task();
     void read_task();
+    void start_forward_task();
     void forward_task();
-    void begin_i2s();
-    void begin_afe();
-    int32_t scale_sample(int32_t sample, float &smoothed_peak);
+    void begin_i2s(const LatencySettings &latency_settings);
+    void begin_afe(const LatencySettings &latency_settings);
+    void rebuild_afe(const AudioConfiguration &audio_config);
+    void allocate_buffers();
 };
@@ -0,0 +1,58 @@
+#include "support.h"
+
+#include "JitterEstimator.h"
+
+#include <algorithm>
+
+LOG_TAG(JitterEstimator);
+
+void JitterEstimator::reset() {
+    _lateness_offset = 0;
+    _lateness_count = 0;
+
+    restart();
+}
+
+void JitterEstimator::restart() {
+    _has_reference = false;
+    _block_min = INT32_MAX;
+    _prev_block_min = INT32_MAX;
+    _block_count = 0;
+}
+
+void JitterEstimator::add(int64_t arrival_us, int64_t media_us) {
+    if (!_has_reference) {
+        _reference = arrival_us - media_us;
+        _has_reference = true;
+    }
+
+    const auto transit = (int32_t)(arrival_us - media_us - _reference);
+
+    _block_min = min(_block_min, transit);
+    if (++_block_count >= BLOCK) {
+        _prev_block_min = _block_min;
+        _block_min = INT32_MAX;
+        _block_count = 0;
+    }
+
+    const auto base = min(_block_min, _prev_block_min);
+
+    _lateness[_lateness_offset] = transit - base;
+    _lateness_offset = (_lateness_offset + 1) % WINDOW;
+    _lateness_count = min(_lateness_count + 1, WINDOW);
+}
+
+int32_t JitterEstimator::get_lateness_us(float percentile) {
+    if (_lateness_count < MIN_SAMPLES) {
+        return -1;
+    }
+
+    int32_t sorted[WINDOW];
+    copy(_lateness, _lateness + _lateness_count, sorted);
+
+    const auto index = (size_t)(clamp(percentile, 0.0f, 1.0f) * (float)(_lateness_count - 1) + 0.5f);
+
+    nth_element(sorted, sorted + index, sorted + _lateness_count);
+
+    return sorted[index];
+}
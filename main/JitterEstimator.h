@@ -0,0 +1,46 @@
+#pragma once
+
+/**
+ * Per-source network jitter estimator.
+ *
+ * Every packet contributes its transit time (arrival time minus media time).
+ * The lateness of a packet is its transit relative to the fastest packet seen
+ * recently; the playout delay needed to absorb a given fraction of packets is
+ * a percentile over the lateness history. The history survives restarts of the
+ * stream, so a new talk spurt from a known source starts with the delay that
+ * suited the previous one.
+ */
+class JitterEstimator {
+    // Number of lateness samples the percentile is taken over.
+    static constexpr size_t WINDOW = 128;
+    // Minimum number of samples before an estimate is returned.
+    static constexpr size_t MIN_SAMPLES = 16;
+    // The base transit is the minimum over the current and previous block of
+    // this many packets, so that clock drift doesn't skew the lateness.
+    static constexpr size_t BLOCK = 32;
+
+    int32_t _lateness[WINDOW];
+    size_t _lateness_offset{};
+    size_t _lateness_count{};
+    int64_t _reference{};
+    bool _has_reference{};
+    int32_t _block_min{INT32_MAX};
+    int32_t _prev_block_min{INT32_MAX};
+    size_t _block_count{};
+
+public:
+    /** Forget all history. */
+    void reset();
+
+    /** Start of a new stream; keeps the lateness history but drops the transit reference. */
+    void restart();
+
+    /** Record a packet whose first sample has the given media time. */
+    void add(int64_t arrival_us, int64_t media_us);
+
+    /** Lateness in microseconds not exceeded by the given fraction of packets, or -1 if unknown. */
+    int32_t get_lateness_us(float percentile);
+
+    /** Lateness in microseconds of the last packet. */
+    int32_t get_last_lateness_us() { return _lateness_count ? _lateness[(_lateness_offset + WINDOW - 1) % WINDOW] : 0; }
+};
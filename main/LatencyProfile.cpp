@@ -0,0 +1,82 @@
+#include "support.h"
+
+#include "LatencyProfile.h"
+
+#include "AudioConfiguration.h"
+
+LOG_TAG(LatencyProfile);
+
+const char* latency_profile_to_string(LatencyProfile profile) {
+    switch (profile) {
+        case LatencyProfile::Balanced:
+            return "balanced";
+        case LatencyProfile::Low:
+            return "low";
+        case LatencyProfile::Robust:
+            return "robust";
+        default:
+            return "unknown";
+    }
+}
+
+bool parse_latency_profile(const char* value, LatencyProfile& profile) {
+    if (iequals(value, "balanced")) {
+        profile = LatencyProfile::Balanced;
+        return true;
+    }
+    if (iequals(value, "low")) {
+        profile = LatencyProfile::Low;
+        return true;
+    }
+    if (iequals(value, "robust")) {
+        profile = LatencyProfile::Robust;
+        return true;
+    }
+
+    return false;
+}
+
+LatencySettings get_latency_settings(const AudioConfiguration& audio_config) {
+    LatencySettings settings;
+
+    switch (audio_config.latency_profile) {
+        case LatencyProfile::Low:
+            // Short DMA buffers and chunks cost more interrupts and task
+            // switches, and leave little slack for the playback task.
+            settings = {
+                .dma_desc_num = 4,
+                .dma_frame_ms = 10,
+                .chunk_ms = 10,
+                .afe_ringbuf_size = 8,
+                .audio_buffer_ms = 60,
+            };
+            break;
+
+        case LatencyProfile::Robust:
+            settings = {
+                .dma_desc_num = 8,
+                .dma_frame_ms = 15,
+                .chunk_ms = CONFIG_DEVICE_AUDIO_CHUNK_MS * 2,
+                .afe_ringbuf_size = 50,
+                .audio_buffer_ms = 400,
+            };
+            break;
+
+        default:
+            // The driver and AFE defaults.
+            settings = {
+                .dma_desc_num = 6,
+                .dma_frame_ms = 15,
+                .chunk_ms = CONFIG_DEVICE_AUDIO_CHUNK_MS,
+                .afe_ringbuf_size = 50,
+                .audio_buffer_ms = 200,
+            };
+            break;
+    }
+
+    if (audio_config.audio_buffer_ms) {
+        settings.audio_buffer_ms = audio_config.audio_buffer_ms;
+    }
+
+    return settings;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+struct AudioConfiguration;
+
+// Trade-off between latency and robustness against network jitter and
+// scheduling hiccups. The profile sizes all audio buffering on the device
+// together, so one stage can't undo what another saved.
+enum class LatencyProfile : uint8_t { Balanced, Low, Robust };
+
+const char* latency_profile_to_string(LatencyProfile profile);
+bool parse_latency_profile(const char* value, LatencyProfile& profile);
+
+struct LatencySettings {
+    // I2S DMA buffering of both channels.
+    uint32_t dma_desc_num;
+    uint32_t dma_frame_ms;
+    // Audio taken from the mixer and written to the playback channel in one go.
+    uint32_t chunk_ms;
+    // Number of frames the AFE buffers between feed and fetch.
+    int afe_ringbuf_size;
+    // Mixer prebuffer; the upper bound of the playout delay.
+    uint32_t audio_buffer_ms;
+};
+
+/**
+ * Buffer sizes for the latency profile of the configuration. An explicit
+ * audio buffer length in the configuration takes precedence over that of
+ * the profile.
+ */
+LatencySettings get_latency_settings(const AudioConfiguration& audio_config);
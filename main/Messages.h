@@ -38,4 +38,4 @@
 #define FA_MEMORY "\U0000f538"
 #define FA_GEARS "\U0000f085"
 #define FA_CIRCLE_PLAY "\U0000f144"
-#define FA_CIRCLE_EXCLAMATION "\U0000f06a"
\ No newline at end of file
+#define FA_CIRCLE_EXCLAMATION "\U0000f06a"
\ No newline at end of file
@@ -0,0 +1,118 @@
+#include "support.h"
+
+#include "OpusCodec.h"
+
+#include "esp_opus_dec.h"
+#include "esp_opus_enc.h"
+
+LOG_TAG(OpusCodec);
+
+static esp_opus_enc_frame_duration_t get_encoder_frame_duration(uint32_t frame_ms) {
+    switch (frame_ms) {
+        case 10:
+            return ESP_OPUS_ENC_FRAME_DURATION_10_MS;
+        case 20:
+            return ESP_OPUS_ENC_FRAME_DURATION_20_MS;
+        case 40:
+            return ESP_OPUS_ENC_FRAME_DURATION_40_MS;
+        case 60:
+            return ESP_OPUS_ENC_FRAME_DURATION_60_MS;
+        default:
+            ESP_LOGE(TAG, "Unsupported Opus frame duration %d ms", (int)frame_ms);
+            ESP_ERROR_ASSERT(false);
+            return ESP_OPUS_ENC_FRAME_DURATION_20_MS;
+    }
+}
+
+static esp_opus_dec_frame_duration_t get_decoder_frame_duration(uint32_t frame_ms) {
+    switch (frame_ms) {
+        case 10:
+            return ESP_OPUS_DEC_FRAME_DURATION_10_MS;
+        case 20:
+            return ESP_OPUS_DEC_FRAME_DURATION_20_MS;
+        case 40:
+            return ESP_OPUS_DEC_FRAME_DURATION_40_MS;
+        case 60:
+            return ESP_OPUS_DEC_FRAME_DURATION_60_MS;
+        default:
+            ESP_LOGE(TAG, "Unsupported Opus frame duration %d ms", (int)frame_ms);
+            ESP_ERROR_ASSERT(false);
+            return ESP_OPUS_DEC_FRAME_DURATION_20_MS;
+    }
+}
+
+OpusAudioEncoder::OpusAudioEncoder(uint32_t frame_ms) {
+    esp_opus_enc_config_t config = {};
+    config.sample_rate = CONFIG_DEVICE_I2S_SAMPLE_RATE;
+    config.channel = 1;
+    config.bits_per_sample = CONFIG_DEVICE_I2S_BITS_PER_SAMPLE;
+    config.bitrate = CONFIG_DEVICE_OPUS_BITRATE;
+    config.frame_duration = get_encoder_frame_duration(frame_ms);
+    config.application_mode = ESP_OPUS_ENC_APPLICATION_VOIP;
+    config.complexity = CONFIG_DEVICE_OPUS_COMPLEXITY;
+    config.enable_fec = false;
+    config.enable_dtx = false;
+    config.enable_vbr = true;
+
+    ESP_ERROR_ASSERT(esp_opus_enc_open(&config, sizeof(config), &_handle) == ESP_AUDIO_ERR_OK);
+
+    int in_size;
+    int out_size;
+    ESP_ERROR_ASSERT(esp_opus_enc_get_frame_size(_handle, &in_size, &out_size) == ESP_AUDIO_ERR_OK);
+
+    _frame_len = (size_t)in_size;
+
+    ESP_LOGI(TAG, "Opened Opus encoder with %d ms frames of %d bytes", (int)frame_ms, in_size);
+}
+
+OpusAudioEncoder::~OpusAudioEncoder() { esp_opus_enc_close(_handle); }
+
+int OpusAudioEncoder::encode(uint8_t* frame, uint8_t* buffer, size_t buffer_len) {
+    esp_audio_enc_in_frame_t in_frame = {};
+    in_frame.buffer = frame;
+    in_frame.len = _frame_len;
+
+    esp_audio_enc_out_frame_t out_frame = {};
+    out_frame.buffer = buffer;
+    out_frame.len = buffer_len;
+
+    const auto err = esp_opus_enc_process(_handle, &in_frame, &out_frame);
+    if (err != ESP_AUDIO_ERR_OK) {
+        ESP_LOGE(TAG, "Failed to encode frame; error %d", (int)err);
+        return -1;
+    }
+
+    return (int)out_frame.encoded_bytes;
+}
+
+OpusAudioDecoder::OpusAudioDecoder(uint32_t frame_ms) {
+    esp_opus_dec_cfg_t config = {};
+    config.sample_rate = CONFIG_DEVICE_I2S_SAMPLE_RATE;
+    config.channel = 1;
+    config.frame_duration = get_decoder_frame_duration(frame_ms);
+    config.self_delimited = false;
+
+    ESP_ERROR_ASSERT(esp_opus_dec_open(&config, sizeof(config), &_handle) == ESP_AUDIO_ERR_OK);
+}
+
+OpusAudioDecoder::~OpusAudioDecoder() { esp_opus_dec_close(_handle); }
+
+int OpusAudioDecoder::decode(uint8_t* buffer, size_t buffer_len, int16_t* samples, size_t max_samples) {
+    esp_audio_dec_in_raw_t raw = {};
+    raw.buffer = buffer;
+    raw.len = buffer_len;
+
+    esp_audio_dec_out_frame_t frame = {};
+    frame.buffer = (uint8_t*)samples;
+    frame.len = max_samples * sizeof(int16_t);
+
+    esp_audio_dec_info_t info = {};
+
+    const auto err = esp_opus_dec_decode(_handle, &raw, &frame, &info);
+    if (err != ESP_AUDIO_ERR_OK) {
+        ESP_LOGW(TAG, "Failed to decode frame; error %d", (int)err);
+        return -1;
+    }
+
+    return (int)(frame.decoded_size / sizeof(int16_t));
+}
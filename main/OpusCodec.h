@@ -0,0 +1,29 @@
+#pragma once
+
+#include "AudioCodec.h"
+
+/**
+ * Opus in VoIP mode, mono at the I2S sample rate. Every packet carries
+ * exactly one frame.
+ */
+class OpusAudioEncoder : public AudioEncoder {
+    void* _handle{};
+    size_t _frame_len{};
+
+public:
+    OpusAudioEncoder(uint32_t frame_ms);
+    ~OpusAudioEncoder() override;
+
+    size_t get_frame_len() override { return _frame_len; }
+    int encode(uint8_t* frame, uint8_t* buffer, size_t buffer_len) override;
+};
+
+class OpusAudioDecoder : public AudioDecoder {
+    void* _handle{};
+
+public:
+    OpusAudioDecoder(uint32_t frame_ms);
+    ~OpusAudioDecoder() override;
+
+    int decode(uint8_t* buffer, size_t buffer_len, int16_t* samples, size_t max_samples) override;
+};
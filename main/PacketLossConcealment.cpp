@@ -0,0 +1,158 @@
+#include "support.h"
+
+#include "PacketLossConcealment.h"
+
+#include <algorithm>
+
+LOG_TAG(PacketLossConcealment);
+
+void PacketLossConcealment::reset() {
+    _history_len = 0;
+    _concealing = false;
+}
+
+void PacketLossConcealment::add(int16_t* samples, size_t len) {
+    if (_concealing) {
+        // Cross-fade from the concealment into the real audio.
+
+        const auto overlap = (int32_t)min(len, OVERLAP);
+
+        for (int32_t i = 0; i < overlap; i++) {
+            const auto concealment = (int32_t)next_sample();
+
+            samples[i] = (int16_t)((samples[i] * i + concealment * (overlap - i)) / overlap);
+        }
+
+        _concealing = false;
+    }
+
+    if (len >= HISTORY_LEN) {
+        memcpy(_history, samples + len - HISTORY_LEN, HISTORY_LEN * sizeof(int16_t));
+        _history_len = HISTORY_LEN;
+    } else {
+        const auto keep = min(_history_len, HISTORY_LEN - len);
+
+        memmove(_history, _history + _history_len - keep, keep * sizeof(int16_t));
+        memcpy(_history + keep, samples, len * sizeof(int16_t));
+        _history_len = keep + len;
+    }
+}
+
+bool PacketLossConcealment::conceal(int16_t* samples, size_t len) {
+    if (!_concealing) {
+        start_concealing();
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        samples[i] = next_sample();
+    }
+
+    return _concealed < MAX_CONCEAL;
+}
+
+void PacketLossConcealment::fade_out(int16_t* samples, size_t len) {
+    if (!_concealing) {
+        start_concealing();
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        samples[i] = next_sample();
+    }
+
+    apply_fade_out(samples, len);
+
+    _concealing = false;
+}
+
+void PacketLossConcealment::apply_fade_in(int16_t* samples, size_t len) {
+    for (int32_t i = 0; i < (int32_t)len; i++) {
+        samples[i] = (int16_t)(samples[i] * i / (int32_t)len);
+    }
+}
+
+void PacketLossConcealment::apply_fade_out(int16_t* samples, size_t len) {
+    for (int32_t i = 0; i < (int32_t)len; i++) {
+        samples[i] = (int16_t)(samples[i] * ((int32_t)len - i) / (int32_t)len);
+    }
+}
+
+void PacketLossConcealment::start_concealing() {
+    _pitch = estimate_pitch();
+    _phase = 0;
+    // Without history there's nothing to conceal with.
+    _concealed = _history_len ? 0 : MAX_CONCEAL;
+    _concealing = true;
+}
+
+size_t PacketLossConcealment::estimate_pitch() {
+    if (_history_len < CORRELATION_LEN + MIN_PITCH) {
+        return max(_history_len, (size_t)1);
+    }
+
+    // Find the lag with the highest normalized correlation between the
+    // most recent audio and the audio one period before it. The search
+    // is done on every other lag and sample first, and then refined
+    // around the best match.
+
+    const auto max_pitch = min(MAX_PITCH, _history_len - CORRELATION_LEN);
+    const auto window = _history + _history_len - CORRELATION_LEN;
+
+    auto correlate = [window](size_t pitch, size_t step) {
+        const auto candidate = window - pitch;
+
+        int64_t correlation = 0;
+        int64_t energy = 0;
+
+        for (size_t i = 0; i < CORRELATION_LEN; i += step) {
+            correlation += (int32_t)window[i] * candidate[i];
+            energy += (int32_t)candidate[i] * candidate[i];
+        }
+
+        if (energy == 0) {
+            return 0.0f;
+        }
+
+        return (float)correlation * fabsf((float)correlation) / (float)energy;
+    };
+
+    auto best_pitch = MIN_PITCH;
+    auto best_score = correlate(MIN_PITCH, 2);
+
+    for (auto pitch = MIN_PITCH + 2; pitch <= max_pitch; pitch += 2) {
+        const auto score = correlate(pitch, 2);
+        if (score > best_score) {
+            best_score = score;
+            best_pitch = pitch;
+        }
+    }
+
+    const auto coarse_pitch = best_pitch;
+    best_score = correlate(coarse_pitch, 1);
+
+    for (auto pitch = max(coarse_pitch - 1, MIN_PITCH); pitch <= min(coarse_pitch + 1, max_pitch); pitch++) {
+        const auto score = correlate(pitch, 1);
+        if (score > best_score) {
+            best_score = score;
+            best_pitch = pitch;
+        }
+    }
+
+    return best_pitch;
+}
+
+int16_t PacketLossConcealment::next_sample() {
+    if (_concealed >= MAX_CONCEAL) {
+        return 0;
+    }
+
+    auto sample = (int32_t)_history[_history_len - _pitch + _phase];
+    _phase = (_phase + 1) % _pitch;
+
+    if (_concealed >= FADE_START) {
+        sample = sample * (int32_t)(MAX_CONCEAL - _concealed) / (int32_t)(MAX_CONCEAL - FADE_START);
+    }
+
+    _concealed++;
+
+    return (int16_t)sample;
+}
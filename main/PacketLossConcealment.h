@@ -0,0 +1,63 @@
+#pragma once
+
+/**
+ * Pitch based waveform substitution for a single audio stream, loosely
+ * modeled after G.711 Appendix I.
+ *
+ * Received audio is kept in a short history. When audio goes missing,
+ * the pitch period of the history is estimated and the last period is
+ * repeated, fading out until the concealment is exhausted. When real
+ * audio resumes, it's cross-faded with the continuation of the
+ * concealment.
+ */
+class PacketLossConcealment {
+    // Pitch search range; 400 Hz down to 50 Hz.
+    static constexpr size_t MIN_PITCH = US_TO_SAMPLES(2500);
+    static constexpr size_t MAX_PITCH = US_TO_SAMPLES(20000);
+    // Length of the window correlated against the history when searching the pitch.
+    static constexpr size_t CORRELATION_LEN = US_TO_SAMPLES(10000);
+    static constexpr size_t HISTORY_LEN = MAX_PITCH + CORRELATION_LEN;
+    // Concealment is played at full level for this long, then fades out.
+    static constexpr size_t FADE_START = US_TO_SAMPLES(10000);
+    // After this long, the concealment is silent.
+    static constexpr size_t MAX_CONCEAL = US_TO_SAMPLES(60000);
+
+    int16_t _history[HISTORY_LEN]{};
+    size_t _history_len{};
+    size_t _pitch{};
+    size_t _phase{};
+    size_t _concealed{};
+    bool _concealing{};
+
+public:
+    // Length of the cross-fade when real audio resumes.
+    static constexpr size_t OVERLAP = US_TO_SAMPLES(4000);
+
+    /** Forget the history. */
+    void reset();
+
+    /**
+     * Add received audio to the history. If we were concealing, the start of the
+     * samples is cross-faded with the concealment in place.
+     */
+    void add(int16_t* samples, size_t len);
+
+    /** Generate concealment. Returns false once the concealment is exhausted. */
+    bool conceal(int16_t* samples, size_t len);
+
+    /** Generate the continuation of the concealment, faded out, and end concealing. */
+    void fade_out(int16_t* samples, size_t len);
+
+    /** Fade samples in or out linearly, complementary to each other. */
+    static void apply_fade_in(int16_t* samples, size_t len);
+    static void apply_fade_out(int16_t* samples, size_t len);
+
+    bool is_concealing() { return _concealing; }
+    bool is_exhausted() { return _concealing && _concealed >= MAX_CONCEAL; }
+    bool has_history() { return _history_len > 0; }
+
+private:
+    void start_concealing();
+    size_t estimate_pitch();
+    int16_t next_sample();
+};
@@ -0,0 +1,80 @@
+#include "support.h"
+
+#include "PacketQueue.h"
+
+#include <algorithm>
+
+#if CONFIG_DEVICE_UDP_NETCONN
+#include "lwip/pbuf.h"
+#endif
+
+LOG_TAG(PacketQueue);
+
+PacketQueue::~PacketQueue() { free(_packets); }
+
+void PacketQueue::initialize(size_t capacity) {
+    _capacity = capacity;
+    _packets = (Packet*)heap_caps_malloc(_capacity * sizeof(Packet), MALLOC_CAP_INTERNAL);
+    ESP_ERROR_ASSERT(_packets);
+}
+
+size_t PacketQueue::push(Span<UDPPacket> packets, int64_t arrival_time) {
+    const auto head = _head.load(memory_order_relaxed);
+    const auto tail = _tail.load(memory_order_acquire);
+
+    // The whole batch is published with a single store.
+
+    const auto count = min(packets.len(), _capacity - (head - tail));
+    if (count < packets.len()) {
+        _dropped.fetch_add(packets.len() - count, memory_order_relaxed);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        push(packets.buffer()[i], head + i, arrival_time);
+    }
+
+    _head.store(head + count, memory_order_release);
+
+    return count;
+}
+
+void PacketQueue::push(const UDPPacket& packet, size_t index, int64_t arrival_time) {
+    auto& slot = _packets[index % _capacity];
+
+    slot.source_addr = *packet.source_addr;
+    slot.arrival_time = arrival_time;
+
+#if CONFIG_DEVICE_UDP_NETCONN
+    pbuf_ref(packet.pbuf);
+    slot.pbuf = packet.pbuf;
+    slot.buffer = (uint8_t*)packet.buffer;
+    slot.buffer_len = packet.buffer_len;
+#else
+    slot.buffer = slot.data;
+    slot.buffer_len = min(packet.buffer_len, sizeof(slot.data));
+    memcpy(slot.data, packet.buffer, slot.buffer_len);
+#endif
+}
+
+PacketQueue::Packet* PacketQueue::front() {
+    const auto tail = _tail.load(memory_order_relaxed);
+    const auto head = _head.load(memory_order_acquire);
+
+    if (head == tail) {
+        return nullptr;
+    }
+
+    return &_packets[tail % _capacity];
+}
+
+void PacketQueue::pop() {
+    const auto tail = _tail.load(memory_order_relaxed);
+
+#if CONFIG_DEVICE_UDP_NETCONN
+    auto& slot = _packets[tail % _capacity];
+    pbuf_free(slot.pbuf);
+    slot.pbuf = nullptr;
+#endif
+
+    _tail.store(tail + 1, memory_order_release);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <atomic>
+
+#include "UDPServer.h"
+
+/**
+ * Lock-free single producer, single consumer queue of received packets.
+ *
+ * Slots are allocated up front, so neither side touches the heap or waits
+ * for the other. When the queue is full, the incoming packet is dropped.
+ *
+ * With the netconn receive mode, a slot holds a reference on the received
+ * pbuf instead of a copy of its payload. The reference is released when
+ * the packet is popped.
+ */
+class PacketQueue {
+public:
+    struct Packet {
+        sockaddr_in source_addr;
+        int64_t arrival_time;
+        uint8_t* buffer;
+        size_t buffer_len;
+#if CONFIG_DEVICE_UDP_NETCONN
+        struct pbuf* pbuf;
+#else
+        uint8_t data[UDPServer::PAYLOAD_LEN];
+#endif
+    };
+
+private:
+    Packet* _packets{};
+    size_t _capacity{};
+    // Incremented by the producer and consumer only; the difference is the
+    // number of queued packets.
+    atomic<size_t> _head{};
+    atomic<size_t> _tail{};
+    atomic<uint32_t> _dropped{};
+
+public:
+    PacketQueue() {}
+    PacketQueue(const PacketQueue& other) = delete;
+    PacketQueue& operator=(const PacketQueue& other) = delete;
+    ~PacketQueue();
+
+    void initialize(size_t capacity);
+
+    /**
+     * Producer: queue a batch of received packets. Returns the number of
+     * packets queued; the rest is dropped because the queue is full.
+     */
+    size_t push(Span<UDPPacket> packets, int64_t arrival_time);
+
+    /** Consumer: the oldest packet, or nullptr if the queue is empty. */
+    Packet* front();
+    /** Consumer: release the packet returned by front(). */
+    void pop();
+
+    uint32_t get_dropped() { return _dropped; }
+
+private:
+    void push(const UDPPacket& packet, size_t index, int64_t arrival_time);
+};
@@ -0,0 +1,495 @@
+#include "support.h"
+
+#include "RTPSession.h"
+
+#include <sys/time.h>
+
+#include <algorithm>
+
+#include "ComfortNoise.h"
+#include "esp_random.h"
+
+LOG_TAG(RTPSession);
+
+static constexpr uint8_t RTP_VERSION = 2;
+static constexpr uint8_t RTP_PAYLOAD_TYPE_L16 = 96;
+static constexpr uint8_t RTP_PAYLOAD_TYPE_OPUS = 97;
+static constexpr uint32_t RTP_OPUS_CLOCK_RATE = 48000;
+
+static constexpr uint8_t RTCP_SR = 200;
+static constexpr uint8_t RTCP_RR = 201;
+static constexpr uint8_t RTCP_SDES = 202;
+static constexpr uint8_t RTCP_SDES_CNAME = 1;
+static constexpr size_t RTCP_REPORT_BLOCK_LEN = 24;
+
+// Seconds between the NTP epoch (1900) and the Unix epoch (1970).
+static constexpr uint64_t NTP_UNIX_OFFSET = 2208988800ull;
+
+// Sequence number jumps considered valid (RFC 3550 A.1).
+static constexpr uint16_t MAX_DROPOUT = 3000;
+static constexpr uint16_t MAX_MISORDER = 100;
+
+static uint16_t read_u16(const uint8_t* buffer) { return (uint16_t)((buffer[0] << 8) | buffer[1]); }
+
+static uint32_t read_u32(const uint8_t* buffer) {
+    return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) | ((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+static void write_u16(uint8_t* buffer, uint16_t value) {
+    buffer[0] = (uint8_t)(value >> 8);
+    buffer[1] = (uint8_t)value;
+}
+
+static void write_u32(uint8_t* buffer, uint32_t value) {
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >> 8);
+    buffer[3] = (uint8_t)value;
+}
+
+static void write_rtcp_header(uint8_t* buffer, uint8_t count, uint8_t packet_type, size_t len) {
+    buffer[0] = (uint8_t)((RTP_VERSION << 6) | count);
+    buffer[1] = packet_type;
+    // Length in 32 bit words minus one.
+    write_u16(buffer + 2, (uint16_t)(len / 4 - 1));
+}
+
+static uint64_t get_ntp_time() {
+    timeval tv;
+    gettimeofday(&tv, nullptr);
+
+    const auto seconds = (uint64_t)tv.tv_sec + NTP_UNIX_OFFSET;
+    const auto fraction = ((uint64_t)tv.tv_usec << 32) / 1000000;
+
+    return (seconds << 32) | fraction;
+}
+
+// Middle 32 bits of an NTP timestamp, in 1/65536 seconds.
+static uint32_t get_ntp_short(uint64_t ntp_time) { return (uint32_t)(ntp_time >> 16); }
+
+bool parse_rtp_packet(uint8_t* buffer, size_t buffer_len, RTPPacket& packet) {
+    if (buffer_len < RTP_HEADER_LEN || buffer[0] >> 6 != RTP_VERSION) {
+        return false;
+    }
+
+    const auto padding = (buffer[0] & 0x20) != 0;
+    const auto extension = (buffer[0] & 0x10) != 0;
+    const auto csrc_count = buffer[0] & 0x0f;
+
+    auto header_len = RTP_HEADER_LEN + csrc_count * 4;
+    if (extension) {
+        if (buffer_len < header_len + 4) {
+            return false;
+        }
+        header_len += 4 + read_u16(buffer + header_len + 2) * 4;
+    }
+
+    auto payload_len = buffer_len;
+    if (padding) {
+        payload_len -= buffer[buffer_len - 1];
+    }
+
+    if (payload_len < header_len || payload_len > buffer_len) {
+        return false;
+    }
+
+    packet = {
+        .marker = (buffer[1] & 0x80) != 0,
+        .payload_type = (uint8_t)(buffer[1] & 0x7f),
+        .sequence = read_u16(buffer + 2),
+        .timestamp = read_u32(buffer + 4),
+        .ssrc = read_u32(buffer + 8),
+        .payload = buffer + header_len,
+        .payload_len = payload_len - header_len,
+    };
+
+    return true;
+}
+
+bool is_rtcp_packet(uint8_t* buffer, size_t buffer_len) {
+    // RTCP packet types occupy what would be RTP payload types 64-95 with
+    // the marker bit set (RFC 5761 section 4).
+    return buffer_len >= 8 && buffer[0] >> 6 == RTP_VERSION && buffer[1] >= 192 && buffer[1] <= 223;
+}
+
+uint8_t get_rtp_payload_type(AudioCodecType codec) {
+    return codec == AudioCodecType::Opus ? RTP_PAYLOAD_TYPE_OPUS : RTP_PAYLOAD_TYPE_L16;
+}
+
+uint32_t get_rtp_timestamp_scale(AudioCodecType codec) {
+    return codec == AudioCodecType::Opus ? RTP_OPUS_CLOCK_RATE / CONFIG_DEVICE_I2S_SAMPLE_RATE : 1;
+}
+
+void swap_l16(int16_t* target, const int16_t* source, size_t samples) {
+    for (size_t i = 0; i < samples; i++) {
+        target[i] = (int16_t)__builtin_bswap16((uint16_t)source[i]);
+    }
+}
+
+void RTPSession::begin(AudioCodecType codec) {
+    // We may be reconfigured while packets are being received.
+
+    auto guard = _lock.take();
+
+    _payload_type = get_rtp_payload_type(codec);
+    _timestamp_scale = get_rtp_timestamp_scale(codec);
+
+    // Sequence numbers and timestamps start at a random value (RFC 3550 5.1).
+
+    _ssrc = esp_random();
+    _sequence = (uint16_t)esp_random();
+    _timestamp_offset = esp_random();
+
+    snprintf(_cname, sizeof(_cname), "intercom-%08" PRIx32, _ssrc);
+
+    // Statistics of the streams we receive are in timestamp units of the
+    // codec, so they start over.
+
+    for (auto& source : _sources) {
+        source.in_use = false;
+    }
+
+    ESP_LOGI(TAG, "RTP session with SSRC %08" PRIx32 " and payload type %d", _ssrc, _payload_type);
+}
+
+void RTPSession::start_talk_spurt() {
+    auto guard = _lock.take();
+
+    // Timestamps keep advancing with the wall clock between talk spurts,
+    // so receivers see a gap instead of a jump back in time.
+
+    if (_last_timestamp_time) {
+        const auto elapsed = US_TO_SAMPLES(esp_timer_get_time() - _last_timestamp_time);
+
+        _timestamp_offset = _last_timestamp + (uint32_t)elapsed * _timestamp_scale;
+    }
+
+    _marker = true;
+}
+
+void RTPSession::write_header(uint8_t* header, uint32_t timestamp, bool comfort_noise) {
+    auto guard = _lock.take();
+
+    const auto rtp_timestamp = _timestamp_offset + timestamp * _timestamp_scale;
+
+    header[0] = RTP_VERSION << 6;
+    header[1] = comfort_noise ? RTP_PAYLOAD_TYPE_CN : (uint8_t)((_marker ? 0x80 : 0) | _payload_type);
+    write_u16(header + 2, _sequence++);
+    write_u32(header + 4, rtp_timestamp);
+    write_u32(header + 8, _ssrc);
+
+    _marker = comfort_noise;
+    _last_timestamp = rtp_timestamp;
+    _last_timestamp_time = esp_timer_get_time();
+}
+
+size_t RTPSession::packet_sent(size_t payload_len) {
+    auto guard = _lock.take();
+
+    _packets_sent++;
+    _octets_sent += payload_len;
+
+    const auto now = esp_timer_get_time();
+    if (now - _last_sender_report < REPORT_INTERVAL_US) {
+        return 0;
+    }
+
+    _last_sender_report = now;
+
+    return create_sender_report(now);
+}
+
+size_t RTPSession::packet_received(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len) {
+    RTPPacket packet;
+    if (!parse_rtp_packet(buffer, buffer_len, packet)) {
+        return 0;
+    }
+
+    const auto now = esp_timer_get_time();
+
+    auto guard = _lock.take();
+
+    for (auto& source : _sources) {
+        if (source.in_use && now - source.last_arrival > SOURCE_EVICT_US) {
+            source.in_use = false;
+        }
+    }
+
+    auto source_ptr = find_source(source_addr);
+    const auto inserted = !source_ptr;
+    if (inserted) {
+        source_ptr = add_source(source_addr);
+    }
+
+    auto& source = *source_ptr;
+
+    // Sequence number bookkeeping follows RFC 3550 A.1, without the
+    // probation period.
+
+    const auto delta = (uint16_t)(packet.sequence - source.max_sequence);
+
+    if (inserted || source.ssrc != packet.ssrc || (delta > MAX_DROPOUT && delta <= (uint16_t)-MAX_MISORDER)) {
+        const auto last_receiver_report = source.last_receiver_report;
+
+        source = {
+            .in_use = true,
+            .addr = source.addr,
+            .port = source.port,
+            .ssrc = packet.ssrc,
+            .max_sequence = packet.sequence,
+            .base_sequence = packet.sequence,
+            .last_receiver_report = inserted ? now : last_receiver_report,
+        };
+    } else if (delta <= MAX_DROPOUT) {
+        if (packet.sequence < source.max_sequence) {
+            source.cycles += 0x10000;
+        }
+        source.max_sequence = packet.sequence;
+    }
+
+    source.received++;
+    source.last_arrival = now;
+
+    // Interarrival jitter (RFC 3550 A.8), in timestamp units.
+
+    const auto arrival = (uint32_t)US_TO_SAMPLES(now) * _timestamp_scale;
+    const auto transit = (int32_t)(arrival - packet.timestamp);
+
+    if (source.received > 1) {
+        const auto d = abs(transit - source.transit);
+
+        source.jitter += d - ((source.jitter + 8) >> 4);
+    }
+    source.transit = transit;
+
+    if (now - source.last_receiver_report < REPORT_INTERVAL_US) {
+        return 0;
+    }
+
+    source.last_receiver_report = now;
+
+    return create_receiver_report(source, now);
+}
+
+void RTPSession::process_rtcp(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len) {
+    const auto now = esp_timer_get_time();
+
+    auto guard = _lock.take();
+
+    // Walk the packets of the compound packet.
+
+    for (size_t offset = 0; offset + 8 <= buffer_len;) {
+        auto packet = buffer + offset;
+        const auto packet_len = ((size_t)read_u16(packet + 2) + 1) * 4;
+        if (offset + packet_len > buffer_len) {
+            ESP_LOGW(TAG, "Invalid RTCP packet length");
+            return;
+        }
+
+        const size_t count = packet[0] & 0x1f;
+        const auto packet_type = packet[1];
+
+        size_t blocks_offset = 0;
+
+        if (packet_type == RTCP_SR && packet_len >= 28) {
+            const auto source = find_source(source_addr);
+            if (source) {
+                source->last_sender_report =
+                    get_ntp_short(((uint64_t)read_u32(packet + 8) << 32) | read_u32(packet + 12));
+                source->last_sender_report_arrival = now;
+            }
+
+            blocks_offset = 28;
+        } else if (packet_type == RTCP_RR) {
+            blocks_offset = 8;
+        }
+
+        if (blocks_offset) {
+            for (size_t i = 0; i < count && blocks_offset + (i + 1) * RTCP_REPORT_BLOCK_LEN <= packet_len; i++) {
+                process_report_block(packet + blocks_offset + i * RTCP_REPORT_BLOCK_LEN);
+            }
+        }
+
+        offset += packet_len;
+    }
+}
+
+RTPSession::Source* RTPSession::find_source(sockaddr_in* source_addr) {
+    for (auto& source : _sources) {
+        if (source.in_use && source.addr == source_addr->sin_addr.s_addr && source.port == source_addr->sin_port) {
+            return &source;
+        }
+    }
+
+    return nullptr;
+}
+
+RTPSession::Source* RTPSession::add_source(sockaddr_in* source_addr) {
+    // Without a free slot, take over the source we heard from the longest
+    // time ago.
+
+    Source* result = nullptr;
+
+    for (auto& source : _sources) {
+        if (!source.in_use) {
+            result = &source;
+            break;
+        }
+        if (!result || source.last_arrival < result->last_arrival) {
+            result = &source;
+        }
+    }
+
+    *result = {
+        .in_use = true,
+        .addr = source_addr->sin_addr.s_addr,
+        .port = source_addr->sin_port,
+    };
+
+    return result;
+}
+
+void RTPSession::process_report_block(uint8_t* block) {
+    if (read_u32(block) != _ssrc) {
+        return;
+    }
+
+    _has_remote_report = true;
+    _remote_fraction_lost = block[4];
+    // Cumulative loss is a signed 24 bit value.
+    _remote_cumulative_lost = (int32_t)(read_u32(block + 4) << 8) >> 8;
+    _remote_jitter = read_u32(block + 12);
+
+    const auto last_sender_report = read_u32(block + 16);
+    const auto delay_since_last_sender_report = read_u32(block + 20);
+
+    if (last_sender_report) {
+        const auto round_trip =
+            (int32_t)(get_ntp_short(get_ntp_time()) - last_sender_report - delay_since_last_sender_report);
+
+        _round_trip_ms = max(round_trip, 0) * 1000.0f / 65536.0f;
+    }
+}
+
+size_t RTPSession::create_sender_report(int64_t now) {
+    auto buffer = _sender_report;
+
+    // The RTP timestamp of the report corresponds to the wall clock time.
+
+    const auto elapsed = US_TO_SAMPLES(now - _last_timestamp_time);
+    const auto ntp_time = get_ntp_time();
+
+    write_u32(buffer + 4, _ssrc);
+    write_u32(buffer + 8, (uint32_t)(ntp_time >> 32));
+    write_u32(buffer + 12, (uint32_t)ntp_time);
+    write_u32(buffer + 16, _last_timestamp + (uint32_t)elapsed * _timestamp_scale);
+    write_u32(buffer + 20, _packets_sent);
+    write_u32(buffer + 24, _octets_sent);
+    write_rtcp_header(buffer, 0, RTCP_SR, 28);
+
+    return 28 + write_sdes(buffer + 28);
+}
+
+size_t RTPSession::create_receiver_report(Source& source, int64_t now) {
+    auto buffer = _receiver_report;
+
+    write_u32(buffer + 4, _ssrc);
+    const auto len = 8 + write_report_block(buffer + 8, source, now);
+    write_rtcp_header(buffer, 1, RTCP_RR, len);
+
+    return len + write_sdes(buffer + len);
+}
+
+size_t RTPSession::write_report_block(uint8_t* buffer, Source& source, int64_t now) {
+    // Loss statistics follow RFC 3550 A.3.
+
+    const auto extended_max = source.cycles + source.max_sequence;
+    const auto expected = extended_max - source.base_sequence + 1;
+    const auto lost = clamp((int32_t)(expected - source.received), -0x800000, 0x7fffff);
+
+    const auto expected_interval = expected - source.expected_prior;
+    const auto received_interval = source.received - source.received_prior;
+    const auto lost_interval = (int32_t)(expected_interval - received_interval);
+
+    source.expected_prior = expected;
+    source.received_prior = source.received;
+    source.fraction_lost =
+        expected_interval == 0 || lost_interval <= 0 ? 0 : (uint8_t)min((lost_interval << 8) / expected_interval, 255u);
+    source.cumulative_lost = lost;
+
+    uint32_t delay_since_last_sender_report = 0;
+    if (source.last_sender_report) {
+        delay_since_last_sender_report = (uint32_t)((now - source.last_sender_report_arrival) * 65536 / 1000000);
+    }
+
+    write_u32(buffer, source.ssrc);
+    write_u32(buffer + 4, ((uint32_t)source.fraction_lost << 24) | ((uint32_t)lost & 0xffffff));
+    write_u32(buffer + 8, extended_max);
+    write_u32(buffer + 12, source.jitter >> 4);
+    write_u32(buffer + 16, source.last_sender_report);
+    write_u32(buffer + 20, delay_since_last_sender_report);
+
+    return RTCP_REPORT_BLOCK_LEN;
+}
+
+size_t RTPSession::write_sdes(uint8_t* buffer) {
+    const auto cname_len = strlen(_cname);
+
+    write_u32(buffer + 4, _ssrc);
+    buffer[8] = RTCP_SDES_CNAME;
+    buffer[9] = (uint8_t)cname_len;
+    memcpy(buffer + 10, _cname, cname_len);
+
+    // The item list is terminated by at least one null octet, padded to a
+    // 32 bit boundary.
+
+    auto len = 10 + cname_len;
+    const auto padded_len = (len + 4) & ~3;
+    memset(buffer + len, 0, padded_len - len);
+
+    write_rtcp_header(buffer, 1, RTCP_SDES, padded_len);
+
+    return padded_len;
+}
+
+cJSON* RTPSession::get_state() {
+    auto guard = _lock.take();
+
+    auto root = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(root, "ssrc", strformat("%08" PRIx32, _ssrc).c_str());
+    cJSON_AddNumberToObject(root, "packets_sent", _packets_sent);
+    cJSON_AddNumberToObject(root, "octets_sent", _octets_sent);
+
+    // Jitter is reported in timestamp units.
+    const auto jitter_scale = 1000.0f / (float)(CONFIG_DEVICE_I2S_SAMPLE_RATE * _timestamp_scale);
+
+    if (_has_remote_report) {
+        if (_round_trip_ms >= 0) {
+            cJSON_AddNumberToObject(root, "round_trip_ms", _round_trip_ms);
+        }
+        cJSON_AddNumberToObject(root, "fraction_lost", _remote_fraction_lost / 256.0f);
+        cJSON_AddNumberToObject(root, "packets_lost", _remote_cumulative_lost);
+        cJSON_AddNumberToObject(root, "jitter_ms", _remote_jitter * jitter_scale);
+    }
+
+    auto sources = cJSON_AddArrayToObject(root, "sources");
+
+    for (const auto& source : _sources) {
+        if (!source.in_use) {
+            continue;
+        }
+
+        auto item = cJSON_CreateObject();
+
+        cJSON_AddStringToObject(item, "ssrc", strformat("%08" PRIx32, source.ssrc).c_str());
+        cJSON_AddNumberToObject(item, "packets_received", source.received);
+        cJSON_AddNumberToObject(item, "fraction_lost", source.fraction_lost / 256.0f);
+        cJSON_AddNumberToObject(item, "packets_lost", source.cumulative_lost);
+        cJSON_AddNumberToObject(item, "jitter_ms", (source.jitter >> 4) * jitter_scale);
+
+        cJSON_AddItemToArray(sources, item);
+    }
+
+    return root;
+}
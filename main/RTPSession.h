@@ -0,0 +1,139 @@
+#pragma once
+
+#include "AudioCodec.h"
+#include "Mutex.h"
+
+/**
+ * RTP (RFC 3550) framing and RTCP reporting for the audio stream.
+ *
+ * L16 audio is sent with dynamic payload type 96 at the device sample rate,
+ * Opus with dynamic payload type 97 at the 48 kHz clock of RFC 7587. RTCP
+ * is multiplexed on the RTP port (RFC 5761).
+ *
+ * The session keeps statistics for the stream we send and for every stream
+ * we receive. Sender reports go out with the stream we send, receiver
+ * reports to every source we receive from. Round trip time, loss and
+ * jitter as reported by the remote end are taken from the report blocks
+ * about our stream.
+ */
+
+static constexpr size_t RTP_HEADER_LEN = 12;
+
+struct RTPPacket {
+    bool marker;
+    uint8_t payload_type;
+    uint16_t sequence;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    uint8_t* payload;
+    size_t payload_len;
+};
+
+/** Parse an RTP packet. Returns false if it isn't a valid RTP packet. */
+bool parse_rtp_packet(uint8_t* buffer, size_t buffer_len, RTPPacket& packet);
+/** Whether a packet on the multiplexed port is RTCP instead of RTP. */
+bool is_rtcp_packet(uint8_t* buffer, size_t buffer_len);
+uint8_t get_rtp_payload_type(AudioCodecType codec);
+/** Number of RTP timestamp units per sample. */
+uint32_t get_rtp_timestamp_scale(AudioCodecType codec);
+/** Swap L16 samples between host and network byte order. */
+void swap_l16(int16_t* target, const int16_t* source, size_t samples);
+
+class RTPSession {
+    static constexpr int64_t REPORT_INTERVAL_US = ESP_TIMER_SECONDS(5);
+    static constexpr int64_t SOURCE_EVICT_US = ESP_TIMER_SECONDS(30);
+    // Number of streams we keep statistics for; as many as the mixer plays.
+    static constexpr size_t MAX_SOURCES = CONFIG_DEVICE_AUDIO_MAX_SOURCES;
+    // Large enough for an SR or RR with a single report block and SDES.
+    static constexpr size_t REPORT_LEN = 128;
+
+    struct Source {
+        // Whether this slot of the source table is taken, and by whom.
+        bool in_use;
+        in_addr_t addr;
+        in_port_t port;
+        uint32_t ssrc;
+        uint16_t max_sequence;
+        uint32_t cycles;
+        uint32_t base_sequence;
+        uint32_t received;
+        uint32_t expected_prior;
+        uint32_t received_prior;
+        int32_t transit;
+        // Interarrival jitter in timestamp units, scaled by 16 (RFC 3550 A.8).
+        uint32_t jitter;
+        // Middle 32 bits of the NTP timestamp of the last sender report.
+        uint32_t last_sender_report;
+        int64_t last_sender_report_arrival;
+        int64_t last_receiver_report;
+        int64_t last_arrival;
+        uint8_t fraction_lost;
+        int32_t cumulative_lost;
+    };
+
+    Mutex _lock;
+    uint8_t _payload_type{};
+    uint32_t _timestamp_scale{1};
+    uint32_t _ssrc{};
+    char _cname[32]{};
+    // Stream we send.
+    uint16_t _sequence{};
+    uint32_t _timestamp_offset{};
+    uint32_t _last_timestamp{};
+    int64_t _last_timestamp_time{};
+    bool _marker{};
+    uint32_t _packets_sent{};
+    uint32_t _octets_sent{};
+    int64_t _last_sender_report{};
+    // Reception of our stream as reported by the remote end.
+    bool _has_remote_report{};
+    float _round_trip_ms{-1};
+    uint8_t _remote_fraction_lost{};
+    int32_t _remote_cumulative_lost{};
+    uint32_t _remote_jitter{};
+    // Streams we receive. Fixed capacity, so the receive path doesn't touch
+    // the heap.
+    Source _sources[MAX_SOURCES]{};
+    uint8_t _sender_report[REPORT_LEN];
+    uint8_t _receiver_report[REPORT_LEN];
+
+public:
+    void begin(AudioCodecType codec);
+
+    /** Start a new talk spurt; continues the timeline of the previous one. */
+    void start_talk_spurt();
+
+    /**
+     * Write the RTP header of the next packet. The timestamp is in samples
+     * since the start of the talk spurt. The first audio packet after a
+     * comfort noise packet starts a new talk spurt.
+     */
+    void write_header(uint8_t* header, uint32_t timestamp, bool comfort_noise = false);
+
+    /**
+     * Account for a sent packet. Returns the length of a sender report that
+     * must be sent to all endpoints if one is due, or 0 otherwise.
+     */
+    size_t packet_sent(size_t payload_len);
+    uint8_t* get_sender_report() { return _sender_report; }
+
+    /**
+     * Account for a received RTP packet. Returns the length of a receiver
+     * report that must be sent back to the source if one is due, or 0 otherwise.
+     */
+    size_t packet_received(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len);
+    uint8_t* get_receiver_report() { return _receiver_report; }
+
+    void process_rtcp(sockaddr_in* source_addr, uint8_t* buffer, size_t buffer_len);
+
+    cJSON* get_state();
+
+private:
+    Source* find_source(sockaddr_in* source_addr);
+    Source* add_source(sockaddr_in* source_addr);
+    size_t create_sender_report(int64_t now);
+    size_t create_receiver_report(Source& source, int64_t now);
+    size_t write_report_block(uint8_t* buffer, Source& source, int64_t now);
+    size_t write_sdes(uint8_t* buffer);
+    void process_report_block(uint8_t* block);
+};
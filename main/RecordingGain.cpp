@@ -0,0 +1,94 @@
+#include "support.h"
+
+#include "RecordingGain.h"
+
+#include <algorithm>
+
+LOG_TAG(RecordingGain);
+
+RecordingGain::~RecordingGain() { free(_decay_table); }
+
+void RecordingGain::begin(float smoothing_factor, size_t max_samples) {
+    if (max_samples != _max_samples) {
+        free(_decay_table);
+
+        _max_samples = max_samples;
+        _decay_table = (int32_t*)heap_caps_malloc((_max_samples + 1) * sizeof(int32_t), MALLOC_CAP_INTERNAL);
+        ESP_ERROR_ASSERT(_decay_table);
+    }
+
+    // The release over n samples is (1 - smoothing factor)^n.
+
+    const auto decay = (int64_t)lroundf((1 - smoothing_factor) * DECAY_UNITY);
+
+    _decay_table[0] = DECAY_UNITY;
+    for (size_t i = 1; i <= _max_samples; i++) {
+        _decay_table[i] = (int32_t)((_decay_table[i - 1] * decay + DECAY_UNITY / 2) >> DECAY_BITS);
+    }
+
+    reset();
+}
+
+void RecordingGain::reset() {
+    _peak = PEAK_UNITY;
+    _gain = GAIN_UNITY;
+}
+
+void RecordingGain::process(const int32_t* source, int16_t* target, size_t samples, int shift) {
+    if (!samples) {
+        return;
+    }
+
+    ESP_ERROR_ASSERT(samples <= _max_samples);
+
+    // The INMP441 writes bits 1 through 24; see convert_microphone_audio.
+
+    int32_t block_peak = 0;
+    int64_t block_sum = 0;
+
+    for (size_t i = 0; i < samples; i++) {
+        const auto abs_sample = abs((source[i] << 1) >> shift);
+
+        block_peak = max(block_peak, abs_sample);
+        block_sum += abs_sample;
+    }
+
+    // Update the peak:
+    // - If a sample in the block exceeds the peak, take it immediately.
+    // - Otherwise, decay towards the level of the block. Per sample, this
+    //   is what the smoothing factor would've done with a block of samples
+    //   at the average level.
+    //
+    // The peak takes at most 31 + PEAK_BITS bits, so this fits in 64 bits.
+
+    if ((int64_t)block_peak << PEAK_BITS > _peak) {
+        _peak = (int64_t)block_peak << PEAK_BITS;
+    } else {
+        const int64_t decay = _decay_table[samples];
+        const auto level = (block_sum / (int64_t)samples) << PEAK_BITS;
+
+        _peak = (_peak * decay + level * (DECAY_UNITY - decay)) >> DECAY_BITS;
+    }
+
+    // Prevent division by zero or very small numbers.
+    _peak = max(_peak, PEAK_UNITY);
+
+    // Map the peak to the 16-bit maximum.
+
+    const auto peak = _peak >> PEAK_BITS;
+    const auto target_gain = peak <= INT16_MAX ? GAIN_UNITY : (int32_t)(((int64_t)INT16_MAX << GAIN_BITS) / peak);
+
+    auto gain = min(_gain, target_gain);
+    const auto gain_step = (target_gain - gain) / (int32_t)samples;
+
+    for (size_t i = 0; i < samples; i++) {
+        const auto sample = (source[i] << 1) >> shift;
+        const auto scaled = (int32_t)(((int64_t)sample * gain) >> GAIN_BITS);
+
+        target[i] = (int16_t)clamp<int32_t>(scaled, INT16_MIN, INT16_MAX);
+
+        gain += gain_step;
+    }
+
+    _gain = target_gain;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+/**
+ * Automatic gain that compresses raw microphone samples into 16 bits.
+ *
+ * This follows the peak of the audio with an instant attack and a release
+ * set by the smoothing factor, which is the fraction of the distance to the
+ * current sample level the peak moves per sample. The envelope and the gain
+ * are however only updated once per block. A gain reduction applies from the
+ * start of the block that needs it, so peaks don't clip; a gain increase
+ * ramps linearly across the block.
+ *
+ * This is all fixed point. The release over a block is looked up in a table
+ * by block length, which is calculated in begin().
+ */
+class RecordingGain {
+    // Gains and the release are in Q24; the peak is in Q4.
+    static constexpr int GAIN_BITS = 24;
+    static constexpr int32_t GAIN_UNITY = 1 << GAIN_BITS;
+    static constexpr int DECAY_BITS = 24;
+    static constexpr int32_t DECAY_UNITY = 1 << DECAY_BITS;
+    static constexpr int PEAK_BITS = 4;
+    static constexpr int64_t PEAK_UNITY = 1 << PEAK_BITS;
+
+    int64_t _peak{PEAK_UNITY};
+    int32_t _gain{GAIN_UNITY};
+    // Release of the peak over a block, by the number of samples in it.
+    int32_t* _decay_table{};
+    size_t _max_samples{};
+
+public:
+    ~RecordingGain();
+
+    /** Blocks passed to process() may be up to max_samples long. */
+    void begin(float smoothing_factor, size_t max_samples);
+    void reset();
+
+    /**
+     * Convert raw 32 bit I2S microphone samples to int16 like
+     * convert_microphone_audio, applying the gain.
+     */
+    void process(const int32_t* source, int16_t* target, size_t samples, int shift);
+};
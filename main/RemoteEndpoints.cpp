@@ -0,0 +1,106 @@
+#include "support.h"
+
+#include "RemoteEndpoints.h"
+
+#include <algorithm>
+
+LOG_TAG(RemoteEndpoints);
+
+RemoteEndpoints::Snapshot::Snapshot(RemoteEndpoints& owner) : _owner(owner) {
+    // We announce we're loading before loading the pointer. A writer that
+    // sees no one loading knows the reader counts of the snapshots it
+    // replaced are complete.
+    _owner._loading.fetch_add(1);
+    _set = _owner._set.load();
+    _set->readers.fetch_add(1);
+    _owner._loading.fetch_sub(1);
+}
+
+RemoteEndpoints::Snapshot::~Snapshot() { _set->readers.fetch_sub(1); }
+
+RemoteEndpoints::~RemoteEndpoints() {
+    for (const auto set : _retired) {
+        delete set;
+    }
+
+    delete _set.load();
+}
+
+bool RemoteEndpoints::contains(const string& endpoint) {
+    const auto snapshot = read();
+
+    return any_of(snapshot.begin(), snapshot.end(),
+                  [&endpoint](const Endpoint& ep) { return ep.endpoint == endpoint; });
+}
+
+bool RemoteEndpoints::add(const Endpoint& endpoint) {
+    auto guard = _lock.take();
+
+    const auto& current = _set.load()->endpoints;
+
+    if (any_of(current.begin(), current.end(),
+               [&endpoint](const Endpoint& ep) { return ep.endpoint == endpoint.endpoint; })) {
+        return false;
+    }
+
+    auto endpoints = current;
+    endpoints.push_back(endpoint);
+
+    publish(move(endpoints));
+
+    return true;
+}
+
+bool RemoteEndpoints::remove(const string& endpoint) {
+    auto guard = _lock.take();
+
+    const auto& current = _set.load()->endpoints;
+
+    auto it =
+        find_if(current.begin(), current.end(), [&endpoint](const Endpoint& ep) { return ep.endpoint == endpoint; });
+    if (it == current.end()) {
+        return false;
+    }
+
+    auto endpoints = current;
+    endpoints.erase(endpoints.begin() + (it - current.begin()));
+
+    publish(move(endpoints));
+
+    return true;
+}
+
+void RemoteEndpoints::publish(vector<Endpoint>&& endpoints) {
+    auto set = new Set();
+    set->endpoints = move(endpoints);
+    for (const auto& endpoint : set->endpoints) {
+        set->addrs.push_back(endpoint.addr);
+    }
+
+    _retired.push_back(_set.exchange(set));
+
+    // Loading a snapshot takes a few instructions, so this wait is short.
+    // It's bounded anyway; the replaced snapshots are then looked at again
+    // by a later change.
+
+    for (TickType_t i = 0; _loading.load() != 0; i++) {
+        if (i == PUBLISH_WAIT_TICKS) {
+            return;
+        }
+
+        vTaskDelay(1);
+    }
+
+    // No one can pick up a replaced snapshot anymore. Those without readers
+    // can go.
+
+    const auto it = remove_if(_retired.begin(), _retired.end(), [](const Set* retired) {
+        if (retired->readers.load() != 0) {
+            return false;
+        }
+
+        delete retired;
+        return true;
+    });
+    _retired.erase(it, _retired.end());
+}
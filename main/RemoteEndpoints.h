@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "Mutex.h"
+
+/**
+ * Set of endpoints the audio stream is sent to.
+ *
+ * The set is copy-on-write. Changes publish a new immutable snapshot
+ * through an atomic pointer, so the audio path reads it without taking a
+ * lock. Every snapshot counts its own readers, and a replaced snapshot
+ * is freed once it has none. Writers never wait for a reader to finish
+ * with a snapshot; one that's still read is freed by a later change.
+ */
+class RemoteEndpoints {
+    // Ticks a writer waits for readers that are between loading the
+    // pointer and counting themselves.
+    static constexpr TickType_t PUBLISH_WAIT_TICKS = 2;
+
+public:
+    struct Endpoint {
+        string endpoint;
+        sockaddr_in addr;
+    };
+
+private:
+    struct Set {
+        vector<Endpoint> endpoints;
+        // Addresses of the endpoints, so a packet is queued for all of them
+        // in one go.
+        vector<sockaddr_in> addrs;
+        mutable atomic<int> readers{};
+    };
+
+public:
+    class Snapshot {
+        RemoteEndpoints& _owner;
+        const Set* _set;
+
+    public:
+        Snapshot(RemoteEndpoints& owner);
+        Snapshot(const Snapshot& other) = delete;
+        Snapshot& operator=(const Snapshot& other) = delete;
+        ~Snapshot();
+
+        vector<Endpoint>::const_iterator begin() const { return _set->endpoints.begin(); }
+        vector<Endpoint>::const_iterator end() const { return _set->endpoints.end(); }
+        const sockaddr_in* get_addrs() const { return _set->addrs.data(); }
+        size_t size() const { return _set->addrs.size(); }
+    };
+
+private:
+    // Serializes writers only.
+    Mutex _lock;
+    atomic<const Set*> _set;
+    // Readers between loading the pointer and counting themselves on it.
+    atomic<int> _loading{};
+    // Replaced snapshots that may still be read (guarded by _lock).
+    vector<const Set*> _retired;
+
+public:
+    RemoteEndpoints() : _set(new Set()) {}
+    RemoteEndpoints(const RemoteEndpoints& other) = delete;
+    RemoteEndpoints& operator=(const RemoteEndpoints& other) = delete;
+    ~RemoteEndpoints();
+
+    /** The current endpoints. Doesn't block; the snapshot stays valid while it's alive. */
+    Snapshot read() { return Snapshot(*this); }
+
+    bool contains(const string& endpoint);
+    /** Returns false if the endpoint was already added. */
+    bool add(const Endpoint& endpoint);
+    /** Returns false if the endpoint wasn't added. */
+    bool remove(const string& endpoint);
+
+private:
+    void publish(vector<Endpoint>&& endpoints);
+};
@@ -7,9 +7,13 @@ LOG_TAG(RingBuffer);
 RingBuffer::~RingBuffer() { free(_buffer); }
 
 void RingBuffer::initialize(size_t buffer_len) {
+    free(_buffer);
+
     _buffer_len = buffer_len;
     _buffer = heap_caps_malloc(_buffer_len, MALLOC_CAP_INTERNAL);
     ESP_ERROR_ASSERT(_buffer);
+
+    reset();
 }
 
 void RingBuffer::reset() {
@@ -0,0 +1,95 @@
+#include "support.h"
+
+#include "SampleClock.h"
+
+#include <algorithm>
+
+LOG_TAG(SampleClock);
+
+static constexpr float NOMINAL_PERIOD_NS = 1000000000.0f / CONFIG_DEVICE_I2S_SAMPLE_RATE;
+
+void SampleClock::begin(i2s_chan_handle_t chan, size_t bytes_per_sample, bool transmit) {
+    _bytes_per_sample = bytes_per_sample;
+    _period_ns = NOMINAL_PERIOD_NS;
+
+    i2s_event_callbacks_t callbacks = {};
+    if (transmit) {
+        callbacks.on_sent = on_dma_event;
+    } else {
+        callbacks.on_recv = on_dma_event;
+    }
+
+    ESP_ERROR_CHECK(i2s_channel_register_event_callback(chan, &callbacks, this));
+}
+
+void SampleClock::start() {
+    portENTER_CRITICAL(&_spinlock);
+    _event_samples = 0;
+    _event_time = 0;
+    _event_count = 0;
+    portEXIT_CRITICAL(&_spinlock);
+
+    // Until the first DMA event comes in, we assume the stream starts now.
+    // The drift estimate is kept.
+
+    _last_event_count = 0;
+    _has_event = false;
+    _base_samples = 0;
+    _base_time_ns = esp_timer_get_time() * 1000;
+}
+
+void SampleClock::update() {
+    portENTER_CRITICAL(&_spinlock);
+    const auto samples = _event_samples;
+    const auto time = _event_time;
+    const auto count = _event_count;
+    portEXIT_CRITICAL(&_spinlock);
+
+    if (count == _last_event_count) {
+        return;
+    }
+
+    _last_event_count = count;
+
+    const auto predicted_ns = get_time_ns(samples);
+    const auto error_ns = (float)(time * 1000 - predicted_ns);
+    const auto elapsed = samples - _base_samples;
+
+    _base_samples = samples;
+
+    // The first event replaces the guess made when the stream started.
+
+    if (!_has_event) {
+        _has_event = true;
+        _base_time_ns = time * 1000;
+        return;
+    }
+
+    _base_time_ns = predicted_ns + (int64_t)(error_ns * OFFSET_GAIN);
+
+    if (elapsed > 0) {
+        _period_ns = clamp(_period_ns + error_ns * RATE_GAIN / (float)elapsed, NOMINAL_PERIOD_NS * (1 - MAX_DRIFT),
+                           NOMINAL_PERIOD_NS * (1 + MAX_DRIFT));
+        _drift = _period_ns / NOMINAL_PERIOD_NS - 1;
+    }
+}
+
+int64_t SampleClock::get_time(int64_t sample) { return get_time_ns(sample) / 1000; }
+
+int64_t SampleClock::get_time_ns(int64_t sample) {
+    return _base_time_ns + (int64_t)((float)(sample - _base_samples) * _period_ns);
+}
+
+bool IRAM_ATTR SampleClock::on_dma_event(i2s_chan_handle_t chan, i2s_event_data_t* event, void* user_ctx) {
+    const auto self = (SampleClock*)user_ctx;
+    const auto time = esp_timer_get_time();
+
+    portENTER_CRITICAL_ISR(&self->_spinlock);
+    self->_event_samples += event->size / self->_bytes_per_sample;
+    self->_event_time = time;
+    self->_event_count++;
+    portEXIT_CRITICAL_ISR(&self->_spinlock);
+
+    // We didn't wake up a task.
+    return false;
+}
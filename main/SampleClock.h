@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+
+#include "driver/i2s_std.h"
+
+/**
+ * Mapping between the sample clock of an I2S channel and esp_timer time.
+ *
+ * The DMA event callback of the channel records how many samples have been
+ * transferred every time a DMA buffer completes, and when. The owning task
+ * folds those events into a linear mapping from the sample position in the
+ * stream to the time that sample passes the DMA. The offset follows the
+ * events closely, filtering out the interrupt latency; the rate follows them
+ * slowly and tracks the drift of the I2S clock against the timer.
+ */
+class SampleClock {
+    // Fraction of the timing error of a DMA event taken into the offset, and
+    // the rate.
+    static constexpr float OFFSET_GAIN = 0.1f;
+    static constexpr float RATE_GAIN = 0.002f;
+    // Bound on the drift we follow; crystals are well within this.
+    static constexpr float MAX_DRIFT = 0.001f;
+
+    size_t _bytes_per_sample{};
+    // Written by the DMA event callback.
+    portMUX_TYPE _spinlock = portMUX_INITIALIZER_UNLOCKED;
+    int64_t _event_samples{};
+    int64_t _event_time{};
+    uint32_t _event_count{};
+    // The mapping, owned by the task of the channel.
+    uint32_t _last_event_count{};
+    bool _has_event{};
+    int64_t _base_samples{};
+    // In nanoseconds, so rounding doesn't accumulate.
+    int64_t _base_time_ns{};
+    float _period_ns{};
+    atomic<float> _drift{};
+
+public:
+    /** Register for the DMA events of a channel that moves samples of the given size. */
+    void begin(i2s_chan_handle_t chan, size_t bytes_per_sample, bool transmit);
+
+    /** Start of a stream; call right before enabling the channel. */
+    void start();
+
+    /** Fold in the DMA events since the last call. */
+    void update();
+
+    /** Time the sample at the given position in the stream passes the DMA. */
+    int64_t get_time(int64_t sample);
+
+    /** Drift of the sample clock against the timer, as a fraction. */
+    float get_drift() { return _drift; }
+
+private:
+    int64_t get_time_ns(int64_t sample);
+    static bool on_dma_event(i2s_chan_handle_t chan, i2s_event_data_t* event, void* user_ctx);
+};
@@ -0,0 +1,70 @@
+#include "support.h"
+
+#include "SoftLimiter.h"
+
+#include <algorithm>
+
+LOG_TAG(SoftLimiter);
+
+void SoftLimiter::reset() {
+    memset(_blocks, 0, sizeof(_blocks));
+    memset(_peaks, 0, sizeof(_peaks));
+    _block = 0;
+    _position = 0;
+    _gain = 1;
+    _target_gain = 1;
+    _gain_step = 0;
+}
+
+void SoftLimiter::process(const int32_t* samples, int16_t* output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        auto& input_block = _blocks[_block];
+        const auto& output_block = _blocks[(_block + 1) % BLOCKS];
+
+        const auto sample = output_block[_position];
+
+        // Without limiting, this is just the conversion to int16.
+
+        auto limited = sample;
+        if (_gain < 1 || _gain_step != 0) {
+            limited = (int32_t)((float)sample * (_gain + _gain_step * (float)_position));
+        }
+        output[i] = (int16_t)clamp<int32_t>(limited, INT16_MIN, INT16_MAX);
+
+        input_block[_position] = samples[i];
+        _peaks[_block] = max(_peaks[_block], abs(samples[i]));
+
+        if (++_position == BLOCK_SAMPLES) {
+            next_block();
+        }
+    }
+}
+
+void SoftLimiter::next_block() {
+    _gain = _target_gain;
+    _position = 0;
+
+    // The block just filled becomes the look-ahead; the oldest one is
+    // output next and its slot is filled.
+
+    _block = (_block + 1) % BLOCKS;
+    _peaks[_block] = 0;
+
+    const auto output_peak = _peaks[(_block + 1) % BLOCKS];
+    const auto lookahead_peak = _peaks[(_block + 2) % BLOCKS];
+    const auto peak = max(output_peak, lookahead_peak);
+
+    auto target = min(_gain + (1 - _gain) * RELEASE, 1.0f);
+    if (peak > THRESHOLD) {
+        target = min(target, (float)THRESHOLD / (float)peak);
+    }
+
+    // Snap to unity, so unlimited audio passes through bit exact.
+
+    if (target > 0.9999f) {
+        target = 1;
+    }
+
+    _target_gain = target;
+    _gain_step = (target - _gain) / (float)BLOCK_SAMPLES;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+/**
+ * Look-ahead peak limiter that converts a 32 bit mix to int16.
+ *
+ * Audio is processed in short blocks and delayed by two of them. The gain
+ * of a block ramps linearly towards what that block and the one following
+ * it need to stay below the threshold, so the gain is already down when a
+ * peak comes in. After a peak, the gain is released slowly. Below the
+ * threshold the audio passes through unchanged.
+ */
+class SoftLimiter {
+    static constexpr size_t BLOCK_SAMPLES = US_TO_SAMPLES(1000);
+    static constexpr size_t BLOCKS = 3;
+    static constexpr int32_t THRESHOLD = 29204;  // -1 dBFS
+    // Fraction of the distance to unity gain released per block; a time
+    // constant of roughly 50 ms.
+    static constexpr float RELEASE = 0.02f;
+
+    int32_t _blocks[BLOCKS][BLOCK_SAMPLES]{};
+    int32_t _peaks[BLOCKS]{};
+    // Block being filled; the one after it is being output.
+    size_t _block{};
+    size_t _position{};
+    // Gain ramps from _gain to _target_gain over the block being output.
+    float _gain{1};
+    float _target_gain{1};
+    float _gain_step{};
+
+public:
+    void reset();
+
+    /** Limit samples into output. Output lags the input by two blocks. */
+    void process(const int32_t* samples, int16_t* output, size_t len);
+
+    float get_gain() { return _gain; }
+
+private:
+    void next_block();
+};
@@ -2,14 +2,56 @@
 
 #include "UDPServer.h"
 
+#include <algorithm>
+
 #include "esp_timer.h"
 #include "lwip/sockets.h"
 
+#if CONFIG_DEVICE_UDP_NETCONN
+#include "lwip/api.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/udp.h"
+#endif
+
 LOG_TAG(UDPServer);
 
+struct UDPServer::SendSlot {
+    // First, so the buffer handed out by allocate_packet() is the slot.
+    uint8_t buffer[PAYLOAD_LEN];
+    sockaddr_in to[SEND_MAX_DESTINATIONS];
+    size_t to_len;
+    size_t len;
+};
+
 void UDPServer::begin() {
-    _receive_buffer = malloc(PAYLOAD_LEN);
+#if !CONFIG_DEVICE_UDP_NETCONN
+    _receive_buffer = malloc(PAYLOAD_LEN * CONFIG_DEVICE_UDP_RECEIVE_BATCH);
     ESP_ERROR_ASSERT(_receive_buffer);
+#endif
+
+    // With every slot that can be held outside of the queue on top of it,
+    // the queue always has a packet to drop when there are no free slots.
+
+    const auto send_slots = SEND_QUEUE_LEN + SEND_HELD_SLOTS;
+
+    _send_slots = (SendSlot**)malloc(SEND_QUEUE_LEN * sizeof(SendSlot*));
+    ESP_ERROR_ASSERT(_send_slots);
+    _send_free = (SendSlot**)malloc(send_slots * sizeof(SendSlot*));
+    ESP_ERROR_ASSERT(_send_free);
+
+    for (size_t i = 0; i < send_slots; i++) {
+        _send_free[i] = (SendSlot*)malloc(sizeof(SendSlot));
+        ESP_ERROR_ASSERT(_send_free[i]);
+    }
+    _send_free_len = send_slots;
+
+    FREERTOS_CHECK(xTaskCreatePinnedToCore(
+        [](void* param) {
+            ((UDPServer*)param)->send_loop();
+
+            vTaskDelete(nullptr);
+        },
+        "udp_send", CONFIG_ESP_MAIN_TASK_STACK_SIZE, this, 5, &_send_task, 0));
 
     FREERTOS_CHECK(xTaskCreatePinnedToCore(
         [](void* param) {
@@ -21,29 +63,395 @@ void UDPServer::begin() {
 }
 
 void UDPServer::send(const sockaddr* to, socklen_t tolen, void* buffer, size_t buffer_len) {
+    // Only the AFE input dump sends datagrams that don't fit a slot. Those
+    // go out directly.
+
+    if (buffer_len > PAYLOAD_LEN) {
+        auto guard = _lock.take();
+
+        transmit((const sockaddr_in*)to, buffer, buffer_len);
+        return;
+    }
+
+    send((const sockaddr_in*)to, 1, nullptr, 0, buffer, buffer_len);
+}
+
+void UDPServer::send(const sockaddr_in* to, size_t to_len, void* header, size_t header_len, void* buffer,
+                     size_t buffer_len) {
+    const auto len = header_len + buffer_len;
+
+    ESP_ERROR_ASSERT(len <= PAYLOAD_LEN);
+
+    if (!to_len) {
+        return;
+    }
+
+    const auto packet = allocate_packet();
+
+    if (header_len) {
+        memcpy(packet, header, header_len);
+    }
+    memcpy(packet + header_len, buffer, buffer_len);
+
+    send_packet(packet, len, to, to_len);
+}
+
+uint8_t* UDPServer::allocate_packet() {
+    auto guard = _send_lock.take();
+
+    return take_send_slot()->buffer;
+}
+
+UDPServer::SendSlot* UDPServer::take_send_slot() {
+    if (_send_free_len) {
+        return _send_free[--_send_free_len];
+    }
+
+    return drop_oldest_packet();
+}
+
+UDPServer::SendSlot* UDPServer::drop_oldest_packet() {
+    // When the radio can't keep up, the oldest packet makes room. Fresh
+    // audio is worth more than audio that is already late.
+
+    ESP_ERROR_ASSERT(_send_queue_len);
+
+    const auto tail = (_send_queue_head + SEND_QUEUE_LEN - _send_queue_len) % SEND_QUEUE_LEN;
+    _send_queue_len--;
+
+    const auto slot = _send_slots[tail];
+    _send_dropped.fetch_add(slot->to_len, memory_order_relaxed);
+
+    return slot;
+}
+
+void UDPServer::send_packet(uint8_t* packet, size_t len, const sockaddr_in* to, size_t to_len) {
+    ESP_ERROR_ASSERT(len <= PAYLOAD_LEN);
+
+    const auto slot = (SendSlot*)packet;
+
+    {
+        auto guard = _send_lock.take();
+
+        if (!to_len) {
+            _send_free[_send_free_len++] = slot;
+            return;
+        }
+
+        // Destinations that don't fit the slot get a copy of the packet.
+
+        for (size_t offset = 0; offset < to_len; offset += SEND_MAX_DESTINATIONS) {
+            const auto count = min(to_len - offset, SEND_MAX_DESTINATIONS);
+
+            auto target = slot;
+            if (offset) {
+                target = take_send_slot();
+                memcpy(target->buffer, slot->buffer, len);
+            }
+
+            memcpy(target->to, to + offset, count * sizeof(*to));
+            target->to_len = count;
+            target->len = len;
+
+            if (_send_queue_len == SEND_QUEUE_LEN) {
+                _send_free[_send_free_len++] = drop_oldest_packet();
+            }
+
+            _send_slots[_send_queue_head] = target;
+            _send_queue_head = (_send_queue_head + 1) % SEND_QUEUE_LEN;
+            _send_queue_len++;
+            _send_queued.fetch_add(count, memory_order_relaxed);
+        }
+    }
+
+    xTaskNotifyGive(_send_task);
+}
+
+void UDPServer::release_packet(uint8_t* packet) {
+    auto guard = _send_lock.take();
+
+    _send_free[_send_free_len++] = (SendSlot*)packet;
+}
+
+void UDPServer::send_loop() {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        while (true) {
+            SendSlot* slot;
+
+            {
+                auto guard = _send_lock.take();
+
+                if (!_send_queue_len) {
+                    break;
+                }
+
+                // Take the oldest slot out of the queue, so producers can't
+                // reuse it while we're sending from it.
+
+                const auto tail = (_send_queue_head + SEND_QUEUE_LEN - _send_queue_len) % SEND_QUEUE_LEN;
+                slot = _send_slots[tail];
+                _send_queue_len--;
+            }
+
+            {
+                auto guard = _lock.take();
+
+                for (size_t i = 0; i < slot->to_len; i++) {
+                    if (transmit(&slot->to[i], slot->buffer, slot->len)) {
+                        _send_sent.fetch_add(1, memory_order_relaxed);
+                    }
+                }
+            }
+
+            auto guard = _send_lock.take();
+
+            _send_free[_send_free_len++] = slot;
+        }
+    }
+}
+
+#if CONFIG_DEVICE_UDP_NETCONN
+
+bool UDPServer::transmit(const sockaddr_in* to, void* buffer, size_t buffer_len) {
+    if (!_conn) {
+        log_send_error(ENOTCONN);
+        return false;
+    }
+
+    ip_addr_t addr;
+    ip_addr_set_ip4_u32(&addr, to->sin_addr.s_addr);
+
+    auto buf = netbuf_new();
+    if (!buf) {
+        log_send_error(ENOMEM);
+        return false;
+    }
+
+    auto err = netbuf_ref(buf, buffer, buffer_len);
+    if (err == ERR_OK) {
+        err = netconn_sendto(_conn, buf, &addr, ntohs(to->sin_port));
+    }
+
+    netbuf_delete(buf);
+
+    if (err != ERR_OK) {
+        log_send_error(err_to_errno(err));
+        return false;
+    }
+
+    return true;
+}
+
+#else
+
+bool UDPServer::transmit(const sockaddr_in* to, void* buffer, size_t buffer_len) {
+    if (sendto(_sock, buffer, buffer_len, 0, (const sockaddr*)to, sizeof(*to)) < 0) {
+        log_send_error(errno);
+        return false;
+    }
+
+    return true;
+}
+
+#endif
+
+void UDPServer::log_send_error(int send_errno) {
+    // Rate-limit: with the link down, sendto can fail on every audio packet
+    // (hundreds/sec). Logging each one storms the MQTT-routed logger and the
+    // heap, so coalesce to at most one line per second with an occurrence
+    // count. State is guarded by _lock, held by the caller.
+    constexpr int64_t LOG_INTERVAL_US = 1000000;
+
+    _send_error_count++;
+
+    const auto now = esp_timer_get_time();
+    if (now - _last_send_error_log_us >= LOG_INTERVAL_US) {
+        ESP_LOGE(TAG, "Failed to send packet: errno %d (%d occurrences)", send_errno, _send_error_count);
+        _last_send_error_log_us = now;
+        _send_error_count = 0;
+    }
+}
+
+bool UDPServer::join_group(const string& group) {
+    in_addr addr;
+    if (inet_pton(AF_INET, group.c_str(), &addr) != 1 || !IN_MULTICAST(ntohl(addr.s_addr))) {
+        ESP_LOGE(TAG, "Invalid multicast group %s", group.c_str());
+        return false;
+    }
+
     auto guard = _lock.take();
 
-    int err = sendto(_sock, buffer, buffer_len, 0, to, tolen);
-    if (err < 0) {
-        const auto send_errno = errno;
+    for (const auto& joined : _multicast_groups) {
+        if (joined.s_addr == addr.s_addr) {
+            return true;
+        }
+    }
+
+    _multicast_groups.push_back(addr);
+
+    if (is_open()) {
+        return set_membership(IP_ADD_MEMBERSHIP, addr);
+    }
 
-        // Rate-limit: with the link down, sendto can fail on every audio packet
-        // (hundreds/sec). Logging each one storms the MQTT-routed logger and the
-        // heap, so coalesce to at most one line per second with an occurrence
-        // count. State is guarded by _lock, held above.
-        constexpr int64_t LOG_INTERVAL_US = 1000000;
+    return true;
+}
+
+void UDPServer::leave_group(const string& group) {
+    in_addr addr;
+    if (inet_pton(AF_INET, group.c_str(), &addr) != 1) {
+        return;
+    }
 
-        _send_error_count++;
+    auto guard = _lock.take();
+
+    auto it = find_if(_multicast_groups.begin(), _multicast_groups.end(),
+                      [&addr](const in_addr& joined) { return joined.s_addr == addr.s_addr; });
 
-        const auto now = esp_timer_get_time();
-        if (now - _last_send_error_log_us >= LOG_INTERVAL_US) {
-            ESP_LOGE(TAG, "Failed to send packet: errno %d (%d occurrences)", send_errno, _send_error_count);
-            _last_send_error_log_us = now;
-            _send_error_count = 0;
+    if (it != _multicast_groups.end()) {
+        _multicast_groups.erase(it);
+
+        if (is_open()) {
+            set_membership(IP_DROP_MEMBERSHIP, addr);
         }
     }
 }
 
+#if CONFIG_DEVICE_UDP_NETCONN
+
+struct ConfigureMulticastCall {
+    tcpip_api_call_data call;
+    udp_pcb* pcb;
+};
+
+static err_t configure_multicast_pcb(tcpip_api_call_data* call) {
+    const auto pcb = ((ConfigureMulticastCall*)call)->pcb;
+
+    udp_set_multicast_ttl(pcb, CONFIG_DEVICE_MULTICAST_TTL);
+
+    auto flags = udp_flags(pcb);
+#ifdef CONFIG_DEVICE_MULTICAST_LOOPBACK
+    flags |= UDP_FLAGS_MULTICAST_LOOP;
+#else
+    flags &= ~UDP_FLAGS_MULTICAST_LOOP;
+#endif
+    udp_setflags(pcb, flags);
+
+    return ERR_OK;
+}
+
+void UDPServer::configure_multicast() {
+    // Audio sent to multicast endpoints shouldn't leave the local network,
+    // and we don't want to hear ourselves in groups we've joined.
+    //
+    // The pcb belongs to the tcpip thread. There's no netconn call for these
+    // options, so they're set from the tcpip thread, or under the core lock
+    // if lwIP is built with it. Joining and leaving groups goes through the
+    // netconn API, which does the same.
+
+    ConfigureMulticastCall call{};
+    call.pcb = _conn->pcb.udp;
+    tcpip_api_call(configure_multicast_pcb, &call.call);
+
+    auto guard = _lock.take();
+
+    for (const auto& group : _multicast_groups) {
+        set_membership(IP_ADD_MEMBERSHIP, group);
+    }
+}
+
+bool UDPServer::set_membership(int option, const in_addr& group) {
+    ip_addr_t multiaddr;
+    ip_addr_set_ip4_u32(&multiaddr, group.s_addr);
+
+    auto err = netconn_join_leave_group(_conn, &multiaddr, IP4_ADDR_ANY,
+                                        option == IP_ADD_MEMBERSHIP ? NETCONN_JOIN : NETCONN_LEAVE);
+    if (err != ERR_OK) {
+        char buffer[INET_ADDRSTRLEN];
+        ESP_LOGE(TAG, "Failed to %s multicast group %s; error %d", option == IP_ADD_MEMBERSHIP ? "join" : "leave",
+                 inet_ntop(AF_INET, &group, buffer, sizeof(buffer)), err);
+        return false;
+    }
+
+    return true;
+}
+
+#else
+
+void UDPServer::configure_multicast() {
+    // Audio sent to multicast endpoints shouldn't leave the local network,
+    // and we don't want to hear ourselves in groups we've joined.
+
+    uint8_t ttl = CONFIG_DEVICE_MULTICAST_TTL;
+    if (setsockopt(_sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0) {
+        ESP_LOGE(TAG, "Failed to set multicast TTL; errno %d", errno);
+    }
+
+#ifdef CONFIG_DEVICE_MULTICAST_LOOPBACK
+    uint8_t loop = 1;
+#else
+    uint8_t loop = 0;
+#endif
+    if (setsockopt(_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+        ESP_LOGE(TAG, "Failed to set multicast loopback; errno %d", errno);
+    }
+
+    auto guard = _lock.take();
+
+    for (const auto& group : _multicast_groups) {
+        set_membership(IP_ADD_MEMBERSHIP, group);
+    }
+}
+
+bool UDPServer::set_membership(int option, const in_addr& group) {
+    ip_mreq mreq = {
+        .imr_multiaddr = group,
+        .imr_interface =
+            {
+                .s_addr = htonl(INADDR_ANY),
+            },
+    };
+
+    if (setsockopt(_sock, IPPROTO_IP, option, &mreq, sizeof(mreq)) < 0) {
+        char buffer[INET_ADDRSTRLEN];
+        ESP_LOGE(TAG, "Failed to %s multicast group %s; errno %d", option == IP_ADD_MEMBERSHIP ? "join" : "leave",
+                 inet_ntop(AF_INET, &group, buffer, sizeof(buffer)), errno);
+        return false;
+    }
+
+    return true;
+}
+
+#endif
+
+cJSON* UDPServer::get_state() {
+    const uint32_t wakeups = _wakeups;
+    const uint32_t packets_received = _packets_received;
+
+    auto root = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(root, "wakeups", wakeups);
+    cJSON_AddNumberToObject(root, "packets_received", packets_received);
+    cJSON_AddNumberToObject(root, "packets_per_wakeup", wakeups ? (float)packets_received / (float)wakeups : 0);
+    cJSON_AddNumberToObject(root, "max_batch_len", _max_batch_len);
+    cJSON_AddNumberToObject(root, "send_queued", _send_queued);
+    cJSON_AddNumberToObject(root, "send_sent", _send_sent);
+    cJSON_AddNumberToObject(root, "send_dropped", _send_dropped);
+
+    return root;
+}
+
+void UDPServer::dispatch(Span<UDPPacket> packets) {
+    _wakeups.fetch_add(1, memory_order_relaxed);
+    _packets_received.fetch_add(packets.len(), memory_order_relaxed);
+    if (packets.len() > _max_batch_len.load(memory_order_relaxed)) {
+        _max_batch_len.store(packets.len(), memory_order_relaxed);
+    }
+
+    _received.call(packets);
+}
+
 void UDPServer::receive_loop() {
     while (true) {
         run_server();
@@ -54,6 +462,122 @@ void UDPServer::receive_loop() {
     }
 }
 
+#if CONFIG_DEVICE_UDP_NETCONN
+
+bool UDPServer::is_open() { return _conn != nullptr; }
+
+void UDPServer::run_server() {
+    auto conn = netconn_new(NETCONN_UDP);
+    if (!conn) {
+        ESP_LOGE(TAG, "Failed to create netconn");
+        return;
+    }
+
+    netconn_set_recvtimeout(conn, 10000);
+
+    auto err = netconn_bind(conn, IP4_ADDR_ANY, _port);
+    if (err != ERR_OK) {
+        ESP_LOGE(TAG, "Netconn unable to bind; error %d", err);
+        netconn_delete(conn);
+        return;
+    }
+
+    ESP_LOGI(TAG, "Netconn bound on port %d", _port);
+
+    {
+        auto guard = _lock.take();
+        _conn = conn;
+    }
+
+    configure_multicast();
+
+    UDPPacket packets[CONFIG_DEVICE_UDP_RECEIVE_BATCH];
+    sockaddr_in source_addrs[CONFIG_DEVICE_UDP_RECEIVE_BATCH];
+    netbuf* bufs[CONFIG_DEVICE_UDP_RECEIVE_BATCH];
+    pbuf* clones[CONFIG_DEVICE_UDP_RECEIVE_BATCH];
+
+    while (true) {
+        size_t count = 0;
+
+        while (count < CONFIG_DEVICE_UDP_RECEIVE_BATCH) {
+            // Block for the first datagram only, then take whatever else
+            // is already queued.
+
+            netbuf* buf;
+            err = count ? netconn_recv_udp_raw_netbuf_flags(conn, &buf, NETCONN_DONTBLOCK) : netconn_recv(conn, &buf);
+            if (err != ERR_OK) {
+                break;
+            }
+
+            // Subscribers expect the payload in one piece. Datagrams that fit
+            // the MTU arrive in a single pbuf; anything else is flattened.
+
+            auto p = buf->p;
+            auto clone = p->next ? pbuf_clone(PBUF_RAW, PBUF_RAM, p) : nullptr;
+            if (clone) {
+                p = clone;
+            }
+
+            if (p->next) {
+                netbuf_delete(buf);
+                continue;
+            }
+
+            source_addrs[count] = {
+                .sin_family = AF_INET,
+                .sin_port = htons(netbuf_fromport(buf)),
+                .sin_addr =
+                    {
+                        .s_addr = ip_addr_get_ip4_u32(netbuf_fromaddr(buf)),
+                    },
+            };
+
+            packets[count] = {
+                .source_addr = &source_addrs[count],
+                .buffer = p->payload,
+                .buffer_len = p->len,
+                .pbuf = p,
+            };
+            bufs[count] = buf;
+            clones[count] = clone;
+            count++;
+        }
+
+        if (count) {
+            dispatch(Span<UDPPacket>(packets, count));
+
+            for (size_t i = 0; i < count; i++) {
+                if (clones[i]) {
+                    pbuf_free(clones[i]);
+                }
+                netbuf_delete(bufs[i]);
+            }
+
+            continue;
+        }
+
+        if (err == ERR_TIMEOUT) {
+            continue;
+        }
+
+        ESP_LOGE(TAG, "netconn_recv failed: error %d", err);
+        break;
+    }
+
+    ESP_LOGE(TAG, "Shutting down netconn and restarting...");
+
+    {
+        auto guard = _lock.take();
+        _conn = nullptr;
+    }
+
+    netconn_delete(conn);
+}
+
+#else
+
+bool UDPServer::is_open() { return _sock != -1; }
+
 void UDPServer::run_server() {
     sockaddr_in dest_addr = {
         .sin_family = AF_INET,
@@ -64,48 +588,82 @@ void UDPServer::run_server() {
             },
     };
 
-    _sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
-    if (_sock < 0) {
-        ESP_LOGE(TAG, "Failed to open socket; error %d", _sock);
+    const auto sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Failed to open socket; error %d", sock);
         return;
     }
 
     // Set timeout
     timeval timeout = {.tv_sec = 10};
-    setsockopt(_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
 
-    int err = bind(_sock, (sockaddr*)&dest_addr, sizeof(dest_addr));
+    int err = bind(sock, (sockaddr*)&dest_addr, sizeof(dest_addr));
     if (err < 0) {
         ESP_LOGE(TAG, "Socket unable to bind; errno %d", errno);
+        close(sock);
         return;
     }
 
     ESP_LOGI(TAG, "Socket bound on port %d", _port);
 
-    sockaddr_storage source_addr;
-    socklen_t socklen = sizeof(source_addr);
+    // The send task uses the socket too.
+    {
+        auto guard = _lock.take();
+        _sock = sock;
+    }
+
+    configure_multicast();
+
+    UDPPacket packets[CONFIG_DEVICE_UDP_RECEIVE_BATCH];
+    sockaddr_in source_addrs[CONFIG_DEVICE_UDP_RECEIVE_BATCH];
 
     while (true) {
-        int len = recvfrom(_sock, _receive_buffer, PAYLOAD_LEN, 0, (sockaddr*)&source_addr, &socklen);
-        if (len < 0) {
-            if (errno == EAGAIN) {
-                continue;
+        size_t count = 0;
+
+        while (count < CONFIG_DEVICE_UDP_RECEIVE_BATCH) {
+            // Block for the first datagram only, then take whatever else
+            // is already queued.
+
+            const auto buffer = (uint8_t*)_receive_buffer + count * PAYLOAD_LEN;
+            socklen_t socklen = sizeof(source_addrs[count]);
+
+            int len = recvfrom(_sock, buffer, PAYLOAD_LEN, count ? MSG_DONTWAIT : 0, (sockaddr*)&source_addrs[count],
+                               &socklen);
+            if (len < 0) {
+                break;
             }
 
-            ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
-            break;
+            packets[count] = {
+                .source_addr = &source_addrs[count],
+                .buffer = buffer,
+                .buffer_len = (size_t)len,
+                .pbuf = nullptr,
+            };
+            count++;
+        }
+
+        if (count) {
+            dispatch(Span<UDPPacket>(packets, count));
+            continue;
         }
 
-        _received.call(UDPPacket{
-            .source_addr = (sockaddr_in*)&source_addr,
-            .buffer = _receive_buffer,
-            .buffer_len = (size_t)len,
-        });
+        if (errno == EAGAIN) {
+            continue;
+        }
+
+        ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+        break;
     }
 
     if (_sock != -1) {
         ESP_LOGE(TAG, "Shutting down socket and restarting...");
         shutdown(_sock, 0);
         close(_sock);
+
+        auto guard = _lock.take();
+        _sock = -1;
     }
 }
+
+#endif
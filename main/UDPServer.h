@@ -1,25 +1,95 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
 #include "Callback.h"
 #include "Mutex.h"
+#include "Span.h"
+
+struct pbuf;
+struct netconn;
 
 struct UDPPacket {
     sockaddr_in* source_addr;
     void* buffer;
     size_t buffer_len;
+    // With the netconn receive mode, the pbuf holding the payload. A
+    // subscriber that needs the payload after the callback returns takes
+    // a reference on it instead of copying it.
+    struct pbuf* pbuf;
 };
 
+/**
+ * UDP server for the audio stream.
+ *
+ * By default this uses a BSD socket, which copies every datagram into our
+ * receive buffer. With CONFIG_DEVICE_UDP_NETCONN it uses the lwIP netconn
+ * API instead, and hands out the received pbufs themselves.
+ *
+ * Once woken up by a datagram, the server takes every datagram that is
+ * already queued, up to CONFIG_DEVICE_UDP_RECEIVE_BATCH, without blocking,
+ * and hands them to subscribers as a single batch.
+ *
+ * Sending is asynchronous. Packets go into a bounded queue of preallocated
+ * slots and are sent by a dedicated task, so a stalled radio never blocks
+ * the audio pipeline. When the queue is full, the oldest packet is dropped.
+ * A packet for several destinations takes a single slot.
+ *
+ * To queue a packet without copying it, build it in a slot: take one with
+ * allocate_packet() and pass it to send_packet(). send() copies the packet
+ * into a slot, so the caller can reuse its buffers right away.
+ */
+
 class UDPServer {
+    static constexpr size_t SEND_QUEUE_LEN = CONFIG_DEVICE_UDP_SEND_QUEUE_LEN;
+    // Destinations a queued packet holds. A packet for more is copied into
+    // more slots.
+    static constexpr size_t SEND_MAX_DESTINATIONS = 4;
+    // Slots that may be outside of the queue at the same time: one being
+    // sent, and one being built by each of the audio task, the UDP receive
+    // task and the AFE input dump.
+    static constexpr size_t SEND_HELD_SLOTS = 4;
+
+    // A queued packet. Audio frames are encoded or byte swapped straight
+    // into one, so they aren't copied after that. What is still copied:
+    // - Native PCM frames, once, since the recording buffer is reused.
+    // - Packets from send(): comfort noise, parity and RTCP reports.
+    // - Packets for more than SEND_MAX_DESTINATIONS destinations, once per
+    //   extra slot they take.
+    struct SendSlot;
+
     Mutex _lock;
-    Callback<UDPPacket> _received;
+    Callback<Span<UDPPacket>> _received;
     int _port;
+#if CONFIG_DEVICE_UDP_NETCONN
+    netconn* _conn{};
+#else
     void* _receive_buffer;
     int _sock{-1};
+#endif
     // Rate-limit state for the send-error log (guarded by _lock).
     int _send_error_count{};
     int64_t _last_send_error_log_us{};
+    // Multicast groups we've joined (guarded by _lock). They're joined
+    // again when the socket is recreated.
+    vector<in_addr> _multicast_groups;
+    // Receive statistics, written by the receive task only.
+    atomic<uint32_t> _wakeups{};
+    atomic<uint32_t> _packets_received{};
+    atomic<uint32_t> _max_batch_len{};
+    // Send queue and free slots (guarded by _send_lock). Slots that are
+    // being built or sent are in neither.
+    Mutex _send_lock;
+    SendSlot** _send_slots{};
+    size_t _send_queue_head{};
+    size_t _send_queue_len{};
+    SendSlot** _send_free{};
+    size_t _send_free_len{};
+    TaskHandle_t _send_task{};
+    atomic<uint32_t> _send_queued{};
+    atomic<uint32_t> _send_sent{};
+    atomic<uint32_t> _send_dropped{};
 
 public:
     static constexpr size_t PAYLOAD_LEN = 1472 /* max safe data size assuming an MTU of 1500 */;
@@ -28,10 +98,33 @@ public:
 
     void begin();
     int get_port() { return _port; }
-    void on_received(function<void(UDPPacket)> func) { _received.add(func); }
+    void on_received(function<void(Span<UDPPacket>)> func) { _received.add(func); }
     void send(const struct sockaddr* to, socklen_t tolen, void* buffer, size_t buffer_len);
+    /** Send a header and payload from separate buffers as a single datagram, to every destination. */
+    void send(const sockaddr_in* to, size_t to_len, void* header, size_t header_len, void* buffer,
+              size_t buffer_len);
+    /**
+     * Buffer of PAYLOAD_LEN bytes to build a packet in. It must be passed to
+     * send_packet() or release_packet().
+     */
+    uint8_t* allocate_packet();
+    /** Queue a packet built in a buffer from allocate_packet(), to every destination. */
+    void send_packet(uint8_t* packet, size_t len, const sockaddr_in* to, size_t to_len);
+    void release_packet(uint8_t* packet);
+    bool join_group(const string& group);
+    void leave_group(const string& group);
+    cJSON* get_state();
 
 private:
+    bool is_open();
+    SendSlot* take_send_slot();
+    SendSlot* drop_oldest_packet();
+    void send_loop();
+    bool transmit(const sockaddr_in* to, void* buffer, size_t buffer_len);
+    void log_send_error(int send_errno);
+    void configure_multicast();
+    bool set_membership(int option, const in_addr& group);
     void receive_loop();
     void run_server();
+    void dispatch(Span<UDPPacket> packets);
 };
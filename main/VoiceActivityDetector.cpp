@@ -0,0 +1,68 @@
+#include "support.h"
+
+#include "VoiceActivityDetector.h"
+
+#include <algorithm>
+
+#include "ComfortNoise.h"
+
+LOG_TAG(VoiceActivityDetector);
+
+static float get_energy(const int16_t* samples, size_t len) {
+    int64_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += (int32_t)samples[i] * samples[i];
+    }
+
+    return len ? (float)sum / (float)len : 0;
+}
+
+void VoiceActivityDetector::reset() {
+    _noise_floor = -1;
+    _noise_energy = -1;
+    _hangover = 0;
+}
+
+bool VoiceActivityDetector::process(const int16_t* samples, size_t len) {
+    const auto energy = get_energy(samples, len);
+
+    // The noise floor drops to quiet frames immediately and rises slowly,
+    // so speech doesn't pull it up. It can't drop to zero or it would
+    // never rise again.
+
+    if (_noise_floor < 0 || energy < _noise_floor) {
+        _noise_floor = max(energy, 1.0f);
+    } else {
+        _noise_floor *= powf(NOISE_FLOOR_RISE, (float)len / CONFIG_DEVICE_I2S_SAMPLE_RATE);
+    }
+
+    const auto speech = energy > _noise_floor * SPEECH_THRESHOLD && energy > MIN_SPEECH_ENERGY;
+
+    return update(energy, len, speech);
+}
+
+bool VoiceActivityDetector::process(const int16_t* samples, size_t len, bool speech) {
+    return update(get_energy(samples, len), len, speech);
+}
+
+bool VoiceActivityDetector::update(float energy, size_t len, bool speech) {
+    if (speech) {
+        _hangover = HANGOVER_SAMPLES;
+        return true;
+    }
+
+    if (_hangover) {
+        _hangover -= min(_hangover, len);
+        return true;
+    }
+
+    if (_noise_energy < 0) {
+        _noise_energy = energy;
+    } else {
+        _noise_energy += (energy - _noise_energy) * NOISE_LEVEL_SMOOTHING;
+    }
+
+    return false;
+}
+
+uint8_t VoiceActivityDetector::get_noise_level() { return ComfortNoise::get_level(max(_noise_energy, 0.0f)); }
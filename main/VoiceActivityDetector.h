@@ -0,0 +1,40 @@
+#pragma once
+
+/**
+ * Voice activity detection for discontinuous transmission.
+ *
+ * Frames are classified by their energy relative to a tracked noise floor,
+ * or by an external detector like the one in the AFE. Either way, speech is
+ * held for a while after the last speech frame so trailing syllables aren't
+ * cut off. The energy of frames classified as silence is the noise level
+ * for the comfort noise.
+ */
+class VoiceActivityDetector {
+    // Frames this much louder than the noise floor are speech (9 dB).
+    static constexpr float SPEECH_THRESHOLD = 8;
+    // Frames quieter than this are never speech (-60 dBFS).
+    static constexpr float MIN_SPEECH_ENERGY = 32767.0f * 32767.0f / 1000000;
+    // How fast the noise floor follows the background up, per second (3 dB).
+    static constexpr float NOISE_FLOOR_RISE = 2;
+    // Smoothing of the noise level reported for comfort noise.
+    static constexpr float NOISE_LEVEL_SMOOTHING = 0.25f;
+    static constexpr size_t HANGOVER_SAMPLES = US_TO_SAMPLES(ESP_TIMER_MS(300));
+
+    float _noise_floor{-1};
+    float _noise_energy{-1};
+    size_t _hangover{};
+
+public:
+    void reset();
+
+    /** Classify a frame by its energy. Returns whether it should be transmitted. */
+    bool process(const int16_t* samples, size_t len);
+    /** Classify a frame using the decision of an external detector. */
+    bool process(const int16_t* samples, size_t len, bool speech);
+
+    /** Level of the background noise for comfort noise. */
+    uint8_t get_noise_level();
+
+private:
+    bool update(float energy, size_t len, bool speech);
+};
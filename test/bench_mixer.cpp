@@ -0,0 +1,73 @@
+#include "support.h"
+
+#include <chrono>
+
+#include "AudioMixer.h"
+
+// Measures the time the mixer takes for a 20 ms cycle: a packet from every
+// source, followed by taking a chunk. This is done for both the saturating
+// and the normalized mix. Configure with -DAUDIO_MAX_SOURCES=16
+// to measure more sources.
+
+static constexpr int64_t PACKET_US = ESP_TIMER_MS(20);
+static constexpr size_t PACKET_SAMPLES = US_TO_SAMPLES(PACKET_US);
+static constexpr int CYCLES = 20000;
+
+static void generate_packet(uint8_t* buffer) {
+    const auto samples = (int16_t*)(buffer + sizeof(AudioFrameHeader));
+
+    for (size_t i = 0; i < PACKET_SAMPLES; i++) {
+        samples[i] = (int16_t)(8000 * sinf(2 * (float)M_PI * 300 * (float)i / CONFIG_DEVICE_I2S_SAMPLE_RATE));
+    }
+}
+
+static double run(int sources, bool mix_normalized) {
+    AudioConfiguration audio_config{};
+    audio_config.audio_buffer_ms = 100;
+    audio_config.codec = AudioCodecType::PCM;
+    audio_config.frame_ms = 20;
+    audio_config.mix_normalized = mix_normalized;
+
+    AudioMixer mixer;
+    mixer.initialize(audio_config);
+
+    uint8_t packet[sizeof(AudioFrameHeader) + PACKET_SAMPLES * sizeof(int16_t)];
+    int16_t output[PACKET_SAMPLES];
+
+    generate_packet(packet);
+
+    const auto header = (AudioFrameHeader*)packet;
+
+    const auto start = chrono::steady_clock::now();
+
+    for (auto i = 0; i < CYCLES; i++) {
+        const auto now = (int64_t)i * PACKET_US;
+        host_set_time(now);
+
+        header->packet_index = htonl(i);
+        header->timestamp = htonl(i * PACKET_SAMPLES);
+
+        for (auto j = 0; j < sources; j++) {
+            sockaddr_in source_addr{};
+            source_addr.sin_family = AF_INET;
+            source_addr.sin_port = htons(5000 + j);
+
+            mixer.append(&source_addr, packet, sizeof(packet), now);
+        }
+
+        mixer.take((uint8_t*)output, sizeof(output));
+    }
+
+    const auto elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start);
+
+    return elapsed.count() / CYCLES;
+}
+
+int main() {
+    for (auto sources = 1; sources <= CONFIG_DEVICE_AUDIO_MAX_SOURCES; sources++) {
+        printf("%2d sources: %6.2f us per cycle saturating, %6.2f us normalized\n", sources, run(sources, false),
+               run(sources, true));
+    }
+
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "support.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "RecordingGain.h"
+
+// Measures the time the recording gain takes per read block, for the fixed
+// point implementation and for the floating point one it replaced. The
+// latter calculated the release over a block with powf(); it's repeated
+// here without the per-length cache, to show what the table saves.
+
+static constexpr size_t BLOCK_SAMPLES = 512;
+static constexpr int BLOCKS = 200000;
+static constexpr float SMOOTHING_FACTOR = 0.1f;
+static constexpr int SHIFT = 8;
+
+static vector<int32_t> generate_source() {
+    mt19937 engine(1);
+    normal_distribution<float> noise(0, 1 << 18);
+
+    vector<int32_t> source(BLOCK_SAMPLES * 64);
+    for (auto& sample : source) {
+        sample = (int32_t)clamp(noise(engine), -(float)(1 << 22), (float)(1 << 22)) * (1 << 7);
+    }
+
+    return source;
+}
+
+static float float_peak = 1;
+static int32_t float_gain = 1 << 24;
+
+static void process_float(const int32_t* source, int16_t* target, size_t samples, int shift) {
+    int32_t block_peak = 0;
+    int64_t block_sum = 0;
+
+    for (size_t i = 0; i < samples; i++) {
+        const auto abs_sample = abs((source[i] << 1) >> shift);
+
+        block_peak = max(block_peak, abs_sample);
+        block_sum += abs_sample;
+    }
+
+    if ((float)block_peak > float_peak) {
+        float_peak = (float)block_peak;
+    } else {
+        const auto decay = powf(1 - SMOOTHING_FACTOR, (float)samples);
+        const auto level = (float)(block_sum / (int64_t)samples);
+
+        float_peak = float_peak * decay + level * (1 - decay);
+    }
+
+    float_peak = max(float_peak, 1.0f);
+
+    const auto peak = (int32_t)float_peak;
+    const auto target_gain = peak <= INT16_MAX ? 1 << 24 : (int32_t)(((int64_t)INT16_MAX << 24) / (int64_t)peak);
+
+    auto gain = min(float_gain, target_gain);
+    const auto gain_step = (target_gain - gain) / (int32_t)samples;
+
+    for (size_t i = 0; i < samples; i++) {
+        const auto sample = (source[i] << 1) >> shift;
+        const auto scaled = (int32_t)(((int64_t)sample * gain) >> 24);
+
+        target[i] = (int16_t)clamp<int32_t>(scaled, INT16_MIN, INT16_MAX);
+
+        gain += gain_step;
+    }
+
+    float_gain = target_gain;
+}
+
+template <typename F>
+static double run(const vector<int32_t>& source, F process) {
+    int16_t target[BLOCK_SAMPLES];
+    int64_t checksum = 0;
+
+    const auto blocks = source.size() / BLOCK_SAMPLES;
+
+    const auto start = chrono::steady_clock::now();
+
+    for (auto i = 0; i < BLOCKS; i++) {
+        process(&source[(i % blocks) * BLOCK_SAMPLES], target, BLOCK_SAMPLES, SHIFT);
+        checksum += target[i % BLOCK_SAMPLES];
+    }
+
+    const auto elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - start);
+
+    // Keep the work from being optimized away.
+    if (checksum == INT64_MIN) {
+        printf("\n");
+    }
+
+    return elapsed.count() / BLOCKS;
+}
+
+int main() {
+    const auto source = generate_source();
+
+    RecordingGain gain;
+    gain.begin(SMOOTHING_FACTOR, BLOCK_SAMPLES);
+
+    const auto fixed_us = run(source, [&](auto... args) { gain.process(args...); });
+    const auto float_us = run(source, process_float);
+
+    printf("Blocks of %d samples: fixed point %.3f us, floating point %.3f us\n", (int)BLOCK_SAMPLES, fixed_us,
+           float_us);
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+template <typename T>
+class Callback {
+    std::vector<std::function<void(T)>> _funcs;
+
+public:
+    void add(std::function<void(T)> func) { _funcs.push_back(func); }
+    void call(T value) {
+        for (auto& func : _funcs) {
+            func(value);
+        }
+    }
+};
+
+template <>
+class Callback<void> {
+    std::vector<std::function<void()>> _funcs;
+
+public:
+    void add(std::function<void()> func) { _funcs.push_back(func); }
+    void call() {
+        for (auto& func : _funcs) {
+            func();
+        }
+    }
+};
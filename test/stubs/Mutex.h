@@ -0,0 +1,17 @@
+#pragma once
+
+#include <mutex>
+
+class MutexGuard {
+    std::unique_lock<std::mutex> _lock;
+
+public:
+    MutexGuard(std::mutex& mutex) : _lock(mutex) {}
+};
+
+class Mutex {
+    std::mutex _mutex;
+
+public:
+    MutexGuard take() { return MutexGuard(_mutex); }
+};
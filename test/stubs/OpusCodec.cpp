@@ -0,0 +1,17 @@
+#include "support.h"
+
+#include "OpusCodec.h"
+
+// The Opus library is only available on the device. The tests stick to PCM.
+
+OpusAudioEncoder::OpusAudioEncoder(uint32_t frame_ms) { abort(); }
+
+OpusAudioEncoder::~OpusAudioEncoder() {}
+
+int OpusAudioEncoder::encode(uint8_t* frame, uint8_t* buffer, size_t buffer_len) { return -1; }
+
+OpusAudioDecoder::OpusAudioDecoder(uint32_t frame_ms) { abort(); }
+
+OpusAudioDecoder::~OpusAudioDecoder() {}
+
+int OpusAudioDecoder::decode(uint8_t* buffer, size_t buffer_len, int16_t* samples, size_t max_samples) { return -1; }
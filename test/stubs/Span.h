@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+template <typename T>
+class Span {
+    T* _buffer;
+    size_t _len;
+
+public:
+    Span(T* buffer, size_t len) : _buffer(buffer), _len(len) {}
+
+    T* buffer() const { return _buffer; }
+    size_t len() const { return _len; }
+};
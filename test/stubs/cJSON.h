@@ -0,0 +1,19 @@
+#pragma once
+
+// Just enough of cJSON for the state reporting of the sources under test.
+// Nothing is built; every call returns null.
+
+struct cJSON;
+
+void cJSON_Delete(cJSON* item);
+cJSON* cJSON_CreateObject();
+cJSON* cJSON_CreateArray();
+cJSON* cJSON_CreateNumber(double num);
+cJSON* cJSON_CreateString(const char* string);
+cJSON* cJSON_AddObjectToObject(cJSON* object, const char* name);
+cJSON* cJSON_AddArrayToObject(cJSON* object, const char* name);
+cJSON* cJSON_AddNumberToObject(cJSON* object, const char* name, double number);
+cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string);
+cJSON* cJSON_AddBoolToObject(cJSON* object, const char* name, bool boolean);
+bool cJSON_AddItemToObject(cJSON* object, const char* name, cJSON* item);
+bool cJSON_AddItemToArray(cJSON* array, cJSON* item);
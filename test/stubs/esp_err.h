@@ -0,0 +1,44 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// On the device, the socket definitions come in through the ESP-IDF headers.
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NO_MEM 0x101
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_STATE 0x103
+#define ESP_ERR_INVALID_SIZE 0x104
+
+#define ESP_ERROR_CHECK(x)                                                                \
+    do {                                                                                  \
+        if ((x) != ESP_OK) {                                                              \
+            printf("ESP_ERROR_CHECK failed\nfile: \"%s\" line %d\n", __FILE__, __LINE__); \
+            abort();                                                                      \
+        }                                                                                 \
+    } while (0)
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define __ASSERT_FUNC __func__
+
+#define IRAM_ATTR
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+} esp_reset_reason_t;
+
+const char* esp_err_to_name(esp_err_t code);
+void esp_restart();
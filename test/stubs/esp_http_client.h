@@ -0,0 +1,3 @@
+#pragma once
+
+struct esp_http_client_config_t {};
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+int64_t esp_timer_get_time();
+
+// Host only: the tests drive the timer.
+void host_set_time(int64_t time);
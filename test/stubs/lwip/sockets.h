@@ -0,0 +1,4 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <unistd.h>
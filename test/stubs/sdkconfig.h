@@ -0,0 +1,17 @@
+#pragma once
+
+// Defaults of the Kconfig options the sources under test use.
+
+#define CONFIG_ESP_MAIN_TASK_STACK_SIZE 8192
+#define CONFIG_DEVICE_I2S_SAMPLE_RATE 16000
+#define CONFIG_DEVICE_I2S_BITS_PER_SAMPLE 16
+#define CONFIG_DEVICE_AUDIO_CHUNK_MS 20
+#ifndef CONFIG_DEVICE_AUDIO_MAX_SOURCES
+#define CONFIG_DEVICE_AUDIO_MAX_SOURCES 4
+#endif
+#define CONFIG_DEVICE_AUDIO_PACKET_QUEUE_LEN 16
+#define CONFIG_DEVICE_UDP_RECEIVE_BATCH 4
+#define CONFIG_DEVICE_UDP_SEND_QUEUE_LEN 8
+#define CONFIG_DEVICE_MULTICAST_TTL 1
+#define CONFIG_DEVICE_OPUS_BITRATE 24000
+#define CONFIG_DEVICE_OPUS_COMPLEXITY 5
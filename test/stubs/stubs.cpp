@@ -0,0 +1,153 @@
+#include "support.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <mutex>
+#include <random>
+#include <thread>
+
+static int64_t host_time;
+
+int64_t esp_timer_get_time() { return host_time; }
+
+void host_set_time(int64_t time) { host_time = time; }
+
+uint32_t esp_random() {
+    static mt19937 engine(42);
+
+    return engine();
+}
+
+const char* esp_err_to_name(esp_err_t code) { return code == ESP_OK ? "ESP_OK" : "ESP_FAIL"; }
+
+void esp_restart() { abort(); }
+
+void* heap_caps_malloc(size_t size, uint32_t caps) { return malloc(size); }
+
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) { return calloc(n, size); }
+
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void* heap_caps_aligned_calloc(size_t alignment, size_t n, size_t size, uint32_t caps) {
+    const auto result = heap_caps_aligned_alloc(alignment, n * size, caps);
+    if (result) {
+        memset(result, 0, n * size);
+    }
+    return result;
+}
+
+void heap_caps_free(void* ptr) { free(ptr); }
+
+void vTaskDelay(TickType_t ticks) { this_thread::sleep_for(chrono::milliseconds(ticks)); }
+
+struct HostTask {
+    mutex lock;
+    condition_variable notified;
+    uint32_t notifications{};
+};
+
+static thread_local HostTask* current_task;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char* name, uint32_t stack_depth, void* param,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core_id) {
+    const auto host_task = new HostTask();
+    if (handle) {
+        *handle = host_task;
+    }
+
+    thread([=]() {
+        current_task = host_task;
+        task(param);
+    }).detach();
+
+    return pdPASS;
+}
+
+// The thread ends when the task function returns.
+void vTaskDelete(TaskHandle_t task) {}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    // Threads that weren't created as a task, like the main thread, get
+    // their task on first use.
+    if (!current_task) {
+        current_task = new HostTask();
+    }
+
+    return current_task;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+    const auto host_task = (HostTask*)task;
+
+    {
+        lock_guard guard(host_task->lock);
+        host_task->notifications++;
+    }
+    host_task->notified.notify_one();
+
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+    const auto host_task = (HostTask*)xTaskGetCurrentTaskHandle();
+
+    unique_lock guard(host_task->lock);
+
+    const auto notified = [host_task]() { return host_task->notifications > 0; };
+    if (ticks == portMAX_DELAY) {
+        host_task->notified.wait(guard, notified);
+    } else {
+        host_task->notified.wait_for(guard, chrono::milliseconds(ticks), notified);
+    }
+
+    const auto result = host_task->notifications;
+    if (result) {
+        host_task->notifications = clear_on_exit ? 0 : result - 1;
+    }
+
+    return result;
+}
+
+void portENTER_CRITICAL(portMUX_TYPE* mux) {
+    while (__atomic_exchange_n(&mux->locked, 1, __ATOMIC_ACQUIRE)) {
+    }
+}
+
+void portEXIT_CRITICAL(portMUX_TYPE* mux) { __atomic_store_n(&mux->locked, 0, __ATOMIC_RELEASE); }
+
+string strformat(const char* format, ...) {
+    va_list args;
+
+    va_start(args, format);
+    const auto len = vsnprintf(nullptr, 0, format, args);
+    va_end(args);
+
+    string result(len, '\0');
+
+    va_start(args, format);
+    vsnprintf(result.data(), len + 1, format, args);
+    va_end(args);
+
+    return result;
+}
+
+bool iequals(const string& a, const string& b) {
+    return equal(a.begin(), a.end(), b.begin(), b.end(),
+                 [](char a, char b) { return tolower((unsigned char)a) == tolower((unsigned char)b); });
+}
+
+void cJSON_Delete(cJSON* item) {}
+cJSON* cJSON_CreateObject() { return nullptr; }
+cJSON* cJSON_CreateArray() { return nullptr; }
+cJSON* cJSON_CreateNumber(double num) { return nullptr; }
+cJSON* cJSON_CreateString(const char* string) { return nullptr; }
+cJSON* cJSON_AddObjectToObject(cJSON* object, const char* name) { return nullptr; }
+cJSON* cJSON_AddArrayToObject(cJSON* object, const char* name) { return nullptr; }
+cJSON* cJSON_AddNumberToObject(cJSON* object, const char* name, double number) { return nullptr; }
+cJSON* cJSON_AddStringToObject(cJSON* object, const char* name, const char* string) { return nullptr; }
+cJSON* cJSON_AddBoolToObject(cJSON* object, const char* name, bool boolean) { return nullptr; }
+bool cJSON_AddItemToObject(cJSON* object, const char* name, cJSON* item) { return true; }
+bool cJSON_AddItemToArray(cJSON* array, cJSON* item) { return true; }
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal checks for the host tests. A failed check prints where it failed
+// and fails the test.
+
+#define CHECK(x)                                                                                    \
+    do {                                                                                            \
+        if (!(x)) {                                                                                 \
+            printf("CHECK failed\nfile: \"%s\" line %d\nexpression: %s\n", __FILE__, __LINE__, #x); \
+            exit(1);                                                                                \
+        }                                                                                           \
+    } while (0)
@@ -0,0 +1,196 @@
+#include "support.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "AudioKernels.h"
+#include "test.h"
+
+// Checks the audio kernels against plain per-sample reference code, over
+// random buffer alignments and lengths. Samples around the target are
+// checked to be left alone. The saturating mix is also checked for every
+// pair of samples near the limits, in every lane of a vector.
+//
+// The microphone conversion is checked against the per-sample loop the read
+// task used before, for every microphone gain setting.
+
+static constexpr size_t MAX_SAMPLES = 300;
+static constexpr size_t MAX_MISALIGN = 8;
+static constexpr int ITERATIONS = 20000;
+static constexpr int16_t GUARD = 0x5a5a;
+
+static mt19937 engine(1);
+
+static int16_t random_sample() {
+    // Full scale, so a good part of the sums saturate.
+    uniform_int_distribution<int32_t> distribution(INT16_MIN, INT16_MAX);
+    return (int16_t)distribution(engine);
+}
+
+static size_t random_size(size_t max) { return uniform_int_distribution<size_t>(0, max)(engine); }
+
+static void test_mix_audio_saturate() {
+    vector<int16_t> source(MAX_SAMPLES + MAX_MISALIGN);
+    vector<int16_t> target(MAX_SAMPLES + MAX_MISALIGN * 2);
+    vector<int16_t> expected(target.size());
+
+    for (auto i = 0; i < ITERATIONS; i++) {
+        const auto source_offset = random_size(MAX_MISALIGN - 1);
+        const auto target_offset = random_size(MAX_MISALIGN - 1);
+        const auto samples = random_size(MAX_SAMPLES);
+
+        for (auto& sample : source) {
+            sample = random_sample();
+        }
+        for (auto& sample : target) {
+            sample = GUARD;
+        }
+        for (size_t j = 0; j < samples; j++) {
+            target[target_offset + j] = random_sample();
+        }
+
+        expected = target;
+        for (size_t j = 0; j < samples; j++) {
+            expected[target_offset + j] = (int16_t)clamp<int32_t>(
+                (int32_t)expected[target_offset + j] + (int32_t)source[source_offset + j], INT16_MIN, INT16_MAX);
+        }
+
+        mix_audio_saturate(&source[source_offset], &target[target_offset], samples);
+
+        CHECK(target == expected);
+    }
+}
+
+static void test_mix_audio_saturate_limits() {
+    static constexpr int16_t LIMITS[] = {INT16_MIN, INT16_MIN + 1, -16385, -16384, -1, 0, 1, 16383, 16384,
+                                         INT16_MAX - 1, INT16_MAX};
+    static constexpr size_t LANES = 8;
+
+    for (const auto a : LIMITS) {
+        for (const auto b : LIMITS) {
+            for (size_t lane = 0; lane < LANES; lane++) {
+                int16_t source[LANES * 2]{};
+                int16_t target[LANES * 2]{};
+
+                source[lane] = b;
+                target[lane] = a;
+
+                mix_audio_saturate(source, target, size(source));
+
+                CHECK(target[lane] == (int16_t)clamp<int32_t>((int32_t)a + (int32_t)b, INT16_MIN, INT16_MAX));
+            }
+        }
+    }
+}
+
+static void test_mix_audio_accumulate() {
+    vector<int16_t> source(MAX_SAMPLES + MAX_MISALIGN);
+    vector<int32_t> target(MAX_SAMPLES + MAX_MISALIGN * 2);
+    vector<int32_t> expected(target.size());
+
+    for (auto i = 0; i < ITERATIONS; i++) {
+        const auto source_offset = random_size(MAX_MISALIGN - 1);
+        const auto target_offset = random_size(MAX_MISALIGN - 1);
+        const auto samples = random_size(MAX_SAMPLES);
+        const auto gain = i % 2 ? MIX_GAIN_UNITY : (int32_t)random_size(MIX_GAIN_UNITY * 2);
+
+        for (auto& sample : source) {
+            sample = random_sample();
+        }
+        for (auto& sample : target) {
+            sample = (int32_t)random_sample() * 4;
+        }
+
+        expected = target;
+        for (size_t j = 0; j < samples; j++) {
+            expected[target_offset + j] += ((int32_t)source[source_offset + j] * gain) >> 15;
+        }
+
+        mix_audio_accumulate(&source[source_offset], &target[target_offset], samples, gain);
+
+        CHECK(target == expected);
+    }
+}
+
+static void test_convert_microphone_audio() {
+    uniform_int_distribution<int32_t> raw(INT32_MIN, INT32_MAX);
+
+    vector<int32_t> source(MAX_SAMPLES + MAX_MISALIGN);
+    vector<int16_t> target(MAX_SAMPLES + MAX_MISALIGN * 2);
+    vector<int16_t> expected(target.size());
+
+    for (auto microphone_gain_bits = 0; microphone_gain_bits <= 16; microphone_gain_bits++) {
+        const auto shift = 16 - microphone_gain_bits;
+
+        for (auto i = 0; i < ITERATIONS / 16; i++) {
+            const auto source_offset = random_size(MAX_MISALIGN - 1);
+            const auto target_offset = random_size(MAX_MISALIGN - 1);
+            const auto samples = random_size(MAX_SAMPLES);
+
+            // Raw I2S samples, with the extremes thrown in.
+            for (auto& sample : source) {
+                sample = raw(engine);
+            }
+            source[source_offset] = INT32_MIN;
+            source[source_offset + 1] = INT32_MAX;
+
+            for (auto& sample : target) {
+                sample = GUARD;
+            }
+
+            expected = target;
+            for (size_t j = 0; j < samples; j++) {
+                // The loop read_task used to run.
+                const auto raw_sample = (source[source_offset + j] << 1) >> shift;
+                expected[target_offset + j] = (int16_t)clamp<int32_t>(raw_sample, INT16_MIN, INT16_MAX);
+            }
+
+            convert_microphone_audio(&source[source_offset], &target[target_offset], samples, shift);
+
+            CHECK(target == expected);
+        }
+    }
+}
+
+static void test_interleave_audio() {
+    vector<int16_t> left(MAX_SAMPLES + MAX_MISALIGN);
+    vector<int16_t> right(MAX_SAMPLES + MAX_MISALIGN);
+    vector<int16_t> target(MAX_SAMPLES * 2 + MAX_MISALIGN * 2);
+    vector<int16_t> expected(target.size());
+
+    for (auto i = 0; i < ITERATIONS; i++) {
+        const auto left_offset = random_size(MAX_MISALIGN - 1);
+        const auto right_offset = random_size(MAX_MISALIGN - 1);
+        const auto target_offset = random_size(MAX_MISALIGN - 1);
+        const auto samples = random_size(MAX_SAMPLES);
+
+        for (size_t j = 0; j < left.size(); j++) {
+            left[j] = random_sample();
+            right[j] = random_sample();
+        }
+        for (auto& sample : target) {
+            sample = GUARD;
+        }
+
+        expected = target;
+        for (size_t j = 0; j < samples; j++) {
+            expected[target_offset + j * 2] = left[left_offset + j];
+            expected[target_offset + j * 2 + 1] = right[right_offset + j];
+        }
+
+        interleave_audio(&left[left_offset], &right[right_offset], &target[target_offset], samples);
+
+        CHECK(target == expected);
+    }
+}
+
+int main() {
+    test_mix_audio_saturate();
+    test_mix_audio_saturate_limits();
+    test_mix_audio_accumulate();
+    test_convert_microphone_audio();
+    test_interleave_audio();
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+#include "support.h"
+
+#include <algorithm>
+
+#include "AudioMixer.h"
+#include "test.h"
+
+// Checks the clock drift compensation of the mixer. A source sends packets
+// at a clock that runs 100 ppm fast or slow against ours. Without drift
+// compensation it would gain or lose a sample every 10,000, and fill up
+// the buffer or run it dry within minutes:
+//
+// - The drift estimate converges on the drift between the clocks.
+// - The fill level of the source stays at the target.
+// - No audio is concealed or dropped once the source plays.
+//
+// The source plays a tone. Every packet starts at a zero crossing, so it
+// has a quiet sample to drop or repeat should the playout delay adaptation
+// step in. It shouldn't; the drift compensation alone holds the fill level.
+
+static constexpr int64_t PACKET_US = ESP_TIMER_MS(20);
+static constexpr size_t PACKET_SAMPLES = US_TO_SAMPLES(PACKET_US);
+static constexpr int64_t TAKE_US = ESP_TIMER_MS(CONFIG_DEVICE_AUDIO_CHUNK_MS);
+static constexpr size_t TAKE_SAMPLES = US_TO_SAMPLES(TAKE_US);
+static constexpr int64_t DURATION_US = ESP_TIMER_SECONDS(600);
+// The estimate and the fill level are checked over the end of the run.
+static constexpr int64_t SETTLED_US = ESP_TIMER_SECONDS(480);
+// Audio before this is buffering.
+static constexpr int64_t START_US = ESP_TIMER_SECONDS(1);
+static constexpr float MAX_DRIFT_ERROR_PPM = 10;
+static constexpr int32_t MAX_FILL_ERROR = (int32_t)US_TO_SAMPLES(ESP_TIMER_MS(2));
+
+static void generate_packet(uint32_t packet_index, uint8_t* buffer) {
+    const auto header = (AudioFrameHeader*)buffer;
+    header->packet_index = htonl(packet_index);
+    header->timestamp = htonl(packet_index * PACKET_SAMPLES);
+
+    const auto samples = (int16_t*)(buffer + sizeof(AudioFrameHeader));
+
+    for (size_t i = 0; i < PACKET_SAMPLES; i++) {
+        const auto t = (float)(packet_index * PACKET_SAMPLES + i) / CONFIG_DEVICE_I2S_SAMPLE_RATE;
+        samples[i] = (int16_t)(8000 * sinf(2 * (float)M_PI * 300 * t));
+    }
+}
+
+static void test_drift(float drift_ppm) {
+    AudioConfiguration audio_config{};
+    audio_config.audio_buffer_ms = 100;
+    audio_config.codec = AudioCodecType::PCM;
+    audio_config.frame_ms = 20;
+
+    AudioMixer mixer;
+    mixer.initialize(audio_config);
+
+    sockaddr_in source_addr{};
+    source_addr.sin_family = AF_INET;
+    source_addr.sin_port = htons(5000);
+
+    uint8_t packet[sizeof(AudioFrameHeader) + PACKET_SAMPLES * sizeof(int16_t)];
+    int16_t output[TAKE_SAMPLES];
+
+    // The sender produces a packet every PACKET_US of its own clock.
+
+    const auto packet_interval_us = (double)PACKET_US / (1 + drift_ppm * 1e-6);
+
+    uint32_t packet_index = 0;
+    int64_t next_take = TAKE_US / 2;
+    uint32_t concealed_samples = 0;
+    float estimate_ppm = 0;
+    float min_estimate_ppm = INFINITY;
+    float max_estimate_ppm = -INFINITY;
+    int32_t min_fill_error = INT32_MAX;
+    int32_t max_fill_error = INT32_MIN;
+
+    while (true) {
+        const auto next_packet = (int64_t)(packet_index * packet_interval_us);
+        const auto now = min(next_packet, next_take);
+        if (now >= DURATION_US) {
+            break;
+        }
+
+        host_set_time(now);
+
+        if (now == next_packet) {
+            // The fill level is taken as the packet arrives, as the drift
+            // compensation does.
+
+            int32_t fill_error = 0;
+            const auto active = mixer.get_drift(&source_addr, estimate_ppm, fill_error);
+            CHECK(active || now < START_US);
+
+            generate_packet(packet_index, packet);
+            mixer.append(&source_addr, packet, sizeof(packet), now);
+
+            packet_index++;
+
+            if (now >= SETTLED_US) {
+                min_estimate_ppm = min(min_estimate_ppm, estimate_ppm);
+                max_estimate_ppm = max(max_estimate_ppm, estimate_ppm);
+                min_fill_error = min(min_fill_error, fill_error);
+                max_fill_error = max(max_fill_error, fill_error);
+            }
+        } else {
+            next_take += TAKE_US;
+
+            mixer.take((uint8_t*)output, sizeof(output));
+
+            if (now < START_US) {
+                concealed_samples = mixer.get_concealed_samples();
+            }
+        }
+    }
+
+    printf("Drift %+.0f ppm: estimate %+.1f to %+.1f ppm, fill level error %d to %d samples, %d concealed, "
+           "%d dropped\n",
+           drift_ppm, min_estimate_ppm, max_estimate_ppm, (int)min_fill_error, (int)max_fill_error,
+           (int)(mixer.get_concealed_samples() - concealed_samples), (int)mixer.get_dropped_samples());
+
+    CHECK(fabsf(min_estimate_ppm - drift_ppm) < MAX_DRIFT_ERROR_PPM);
+    CHECK(fabsf(max_estimate_ppm - drift_ppm) < MAX_DRIFT_ERROR_PPM);
+    CHECK(min_fill_error > -MAX_FILL_ERROR);
+    CHECK(max_fill_error < MAX_FILL_ERROR);
+    CHECK(mixer.get_concealed_samples() == concealed_samples);
+    CHECK(mixer.get_dropped_samples() == 0);
+}
+
+int main() {
+    test_drift(100);
+    test_drift(-100);
+
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "support.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "EchoDelayEstimator.h"
+#include "test.h"
+
+// Plays a speech-like reference into a simulated echo path with a fixed
+// delay, and feeds the estimator the way the read task does: with the
+// reference read back by the current estimate. For echo delays of 0 to
+// 200 ms, the estimate must settle so the reference leads the echo by the
+// target lag.
+
+static constexpr size_t BLOCK_SAMPLES = 512;
+static constexpr size_t SECONDS = 10;
+static constexpr int TARGET_LAG_MS = 2;
+static constexpr float ECHO_GAIN = 0.3f;
+
+static vector<int16_t> generate_reference(size_t samples, mt19937& engine) {
+    // Noise in bursts of 100 to 300 ms, with pauses in between, like speech.
+
+    normal_distribution<float> noise(0, 4000);
+    uniform_int_distribution<size_t> burst_ms(100, 300);
+
+    vector<int16_t> reference(samples);
+
+    auto talking = true;
+    for (size_t i = 0; i < samples;) {
+        const auto len = min(US_TO_SAMPLES(ESP_TIMER_MS(burst_ms(engine))), samples - i);
+
+        for (size_t j = 0; j < len; j++) {
+            reference[i + j] = talking ? (int16_t)clamp(noise(engine), -32767.0f, 32767.0f) : 0;
+        }
+
+        i += len;
+        talking = !talking;
+    }
+
+    return reference;
+}
+
+static int64_t estimate(int echo_delay_ms) {
+    mt19937 engine(echo_delay_ms);
+
+    const auto preroll = US_TO_SAMPLES(ESP_TIMER_MS(EchoDelayEstimator::MAX_DELAY_MS));
+    const auto samples = US_TO_SAMPLES(ESP_TIMER_SECONDS(SECONDS)) + preroll;
+    const auto reference = generate_reference(samples, engine);
+    const auto echo_delay = US_TO_SAMPLES(ESP_TIMER_MS(echo_delay_ms));
+
+    // The microphone picks up the echo and some ambient noise.
+
+    normal_distribution<float> ambient(0, 50);
+
+    vector<int16_t> microphone(samples);
+    for (size_t i = echo_delay; i < samples; i++) {
+        microphone[i] = (int16_t)(reference[i - echo_delay] * ECHO_GAIN + ambient(engine));
+    }
+
+    EchoDelayEstimator estimator;
+    estimator.reset();
+
+    for (auto i = preroll; i + BLOCK_SAMPLES <= samples; i += BLOCK_SAMPLES) {
+        const auto delay = US_TO_SAMPLES(estimator.get_delay_us());
+
+        estimator.process(&microphone[i], &reference[i - delay], BLOCK_SAMPLES);
+    }
+
+    return estimator.get_delay_us();
+}
+
+int main() {
+    for (auto echo_delay_ms : {0, 5, 20, 50, 100, 150, 200}) {
+        const auto delay_ms = (int)(estimate(echo_delay_ms) / 1000);
+        const auto expected_ms = max(echo_delay_ms - TARGET_LAG_MS, 0);
+
+        printf("Echo delay %d ms: estimate %d ms, expected %d ms\n", echo_delay_ms, delay_ms, expected_ms);
+
+        CHECK(abs(delay_ms - expected_ms) <= 1);
+    }
+
+    return 0;
+}
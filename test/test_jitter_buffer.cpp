@@ -0,0 +1,156 @@
+#include "support.h"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <vector>
+
+#include "AudioMixer.h"
+#include "test.h"
+
+// Replays a trace of network delays through the mixer, and checks that the
+// adaptive jitter buffer follows a jitter increase in the middle of a
+// stream, instead of concealing every packet that's now late.
+//
+// The trace is a file with the network delay of every packet in
+// milliseconds, one per line. Without one, a trace is generated with 10 s
+// of low jitter followed by 20 s of high jitter, and concealment is
+// measured from 2 s after the jitter went up.
+
+static constexpr int64_t PACKET_US = ESP_TIMER_MS(20);
+static constexpr size_t PACKET_SAMPLES = US_TO_SAMPLES(PACKET_US);
+static constexpr int64_t TAKE_US = ESP_TIMER_MS(CONFIG_DEVICE_AUDIO_CHUNK_MS);
+static constexpr size_t TAKE_SAMPLES = US_TO_SAMPLES(TAKE_US);
+static constexpr size_t LOW_JITTER_PACKETS = 500;
+static constexpr int64_t SETTLE_US = ESP_TIMER_SECONDS(2);
+
+struct Arrival {
+    int64_t time;
+    uint32_t packet_index;
+};
+
+static vector<int64_t> generate_trace() {
+    mt19937 engine(1);
+    uniform_real_distribution<float> low_jitter(0, 5);
+    uniform_real_distribution<float> high_jitter(0, 50);
+
+    vector<int64_t> trace;
+
+    for (size_t i = 0; i < 1500; i++) {
+        const auto jitter_ms = i < LOW_JITTER_PACKETS ? low_jitter(engine) : high_jitter(engine);
+
+        trace.push_back(ESP_TIMER_MS(5) + (int64_t)(jitter_ms * 1000));
+    }
+
+    return trace;
+}
+
+static vector<int64_t> load_trace(const char* path) {
+    ifstream file(path);
+    CHECK(file);
+
+    vector<int64_t> trace;
+
+    float delay_ms;
+    while (file >> delay_ms) {
+        trace.push_back((int64_t)(delay_ms * 1000));
+    }
+
+    return trace;
+}
+
+static void generate_packet(uint32_t packet_index, uint8_t* buffer) {
+    // Talk spurts of a second with short pauses, so there's quiet audio for
+    // the playout delay to grow in.
+
+    const auto header = (AudioFrameHeader*)buffer;
+    header->packet_index = htonl(packet_index);
+    header->timestamp = htonl(packet_index * PACKET_SAMPLES);
+
+    const auto samples = (int16_t*)(buffer + sizeof(AudioFrameHeader));
+    const auto talking = packet_index % 70 < 50;
+
+    for (size_t i = 0; i < PACKET_SAMPLES; i++) {
+        const auto t = (float)(packet_index * PACKET_SAMPLES + i) / CONFIG_DEVICE_I2S_SAMPLE_RATE;
+
+        samples[i] = talking ? (int16_t)(8000 * sinf(2 * (float)M_PI * 300 * t)) : 0;
+    }
+}
+
+int main(int argc, char** argv) {
+    const auto trace = argc > 1 ? load_trace(argv[1]) : generate_trace();
+    CHECK(!trace.empty());
+
+    AudioConfiguration audio_config{};
+    audio_config.audio_buffer_ms = 200;
+    audio_config.jitter_buffer_adaptive = true;
+    audio_config.jitter_buffer_percentile = 0.95f;
+    audio_config.codec = AudioCodecType::PCM;
+    audio_config.frame_ms = 20;
+    audio_config.mix_normalized = true;
+
+    AudioMixer mixer;
+    mixer.initialize(audio_config);
+
+    vector<Arrival> arrivals;
+    for (size_t i = 0; i < trace.size(); i++) {
+        arrivals.push_back({(int64_t)i * PACKET_US + trace[i], (uint32_t)i});
+    }
+    stable_sort(arrivals.begin(), arrivals.end(), [](const auto& a, const auto& b) { return a.time < b.time; });
+
+    sockaddr_in source_addr{};
+    source_addr.sin_family = AF_INET;
+    source_addr.sin_port = htons(5000);
+
+    uint8_t packet[sizeof(AudioFrameHeader) + PACKET_SAMPLES * sizeof(int16_t)];
+    int16_t output[TAKE_SAMPLES];
+
+    const auto end_time = arrivals.back().time;
+    const auto measure_time = argc > 1 ? 0 : (int64_t)LOW_JITTER_PACKETS * PACKET_US + SETTLE_US;
+
+    size_t next_arrival = 0;
+    int64_t next_take = TAKE_US / 2;
+    uint32_t concealed_at_measure = 0;
+    size_t measured_samples = 0;
+    int underruns = 0;
+    auto playing = false;
+
+    for (int64_t now = 0; now < end_time; now += 500) {
+        host_set_time(now);
+
+        while (next_arrival < arrivals.size() && arrivals[next_arrival].time <= now) {
+            generate_packet(arrivals[next_arrival].packet_index, packet);
+            mixer.append(&source_addr, packet, sizeof(packet), now);
+            next_arrival++;
+        }
+
+        if (now >= next_take) {
+            next_take += TAKE_US;
+
+            if (now < measure_time) {
+                concealed_at_measure = mixer.get_concealed_samples();
+            } else {
+                measured_samples += TAKE_SAMPLES;
+            }
+
+            mixer.take((uint8_t*)output, sizeof(output));
+
+            if (mixer.has_data()) {
+                playing = true;
+            } else if (playing) {
+                playing = false;
+                underruns++;
+            }
+        }
+    }
+
+    const auto concealed = mixer.get_concealed_samples() - concealed_at_measure;
+    const auto concealed_ratio = (float)concealed / (float)measured_samples;
+
+    printf("Concealed %.2f%% of the audio, %d underruns\n", concealed_ratio * 100, underruns);
+
+    CHECK(underruns == 0);
+    CHECK(concealed_ratio < 0.01f);
+
+    return 0;
+}
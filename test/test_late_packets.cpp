@@ -0,0 +1,148 @@
+#include "support.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "AudioMixer.h"
+#include "test.h"
+
+// Streams a tone from a number of sources, with some packets arriving late,
+// and checks that late packets fill the holes they left:
+//
+// - With a single source, nothing is concealed, the tone plays without
+//   discontinuities and the packets themselves are left alone.
+// - With all sources sending late packets, there are more holes open than
+//   there are concealment states to share between them. Holes are then
+//   concealed early, but the mixer keeps going.
+
+static constexpr int64_t PACKET_US = ESP_TIMER_MS(20);
+static constexpr size_t PACKET_SAMPLES = US_TO_SAMPLES(PACKET_US);
+static constexpr int64_t TAKE_US = ESP_TIMER_MS(CONFIG_DEVICE_AUDIO_CHUNK_MS);
+static constexpr size_t TAKE_SAMPLES = US_TO_SAMPLES(TAKE_US);
+static constexpr int PACKETS = 500;
+static constexpr int16_t AMPLITUDE = 8000;
+static constexpr float FREQUENCY = 300;
+
+struct Arrival {
+    int64_t time;
+    int source;
+    uint32_t packet_index;
+};
+
+static void generate_packet(uint32_t packet_index, uint8_t* buffer) {
+    const auto header = (AudioFrameHeader*)buffer;
+    header->packet_index = htonl(packet_index);
+    header->timestamp = htonl(packet_index * PACKET_SAMPLES);
+
+    const auto samples = (int16_t*)(buffer + sizeof(AudioFrameHeader));
+
+    for (size_t i = 0; i < PACKET_SAMPLES; i++) {
+        const auto t = (float)(packet_index * PACKET_SAMPLES + i) / CONFIG_DEVICE_I2S_SAMPLE_RATE;
+
+        samples[i] = (int16_t)(AMPLITUDE * sinf(2 * (float)M_PI * FREQUENCY * t));
+    }
+}
+
+static void run(int sources, int late_every, int64_t late_us, uint32_t& concealed, int& max_step) {
+    AudioConfiguration audio_config{};
+    audio_config.audio_buffer_ms = 200;
+    audio_config.codec = AudioCodecType::PCM;
+    audio_config.frame_ms = 20;
+    audio_config.mix_normalized = true;
+
+    AudioMixer mixer;
+    mixer.initialize(audio_config);
+
+    vector<Arrival> arrivals;
+    for (int i = 0; i < PACKETS; i++) {
+        for (int j = 0; j < sources; j++) {
+            // Stagger the sources, so their holes don't line up.
+            const auto delay = ESP_TIMER_MS(5) + j * ESP_TIMER_MS(3) + (i % late_every == 1 ? late_us : 0);
+
+            arrivals.push_back({(int64_t)i * PACKET_US + delay, j, (uint32_t)i});
+        }
+    }
+    stable_sort(arrivals.begin(), arrivals.end(), [](const auto& a, const auto& b) { return a.time < b.time; });
+
+    uint8_t packet[sizeof(AudioFrameHeader) + PACKET_SAMPLES * sizeof(int16_t)];
+    uint8_t original[sizeof(packet)];
+    int16_t output[TAKE_SAMPLES];
+    int16_t last_sample = 0;
+    auto playing = false;
+
+    max_step = 0;
+
+    size_t next_arrival = 0;
+    int64_t next_take = TAKE_US / 2;
+    const auto end_time = arrivals.back().time;
+
+    for (int64_t now = 0; now < end_time; now += 500) {
+        host_set_time(now);
+
+        while (next_arrival < arrivals.size() && arrivals[next_arrival].time <= now) {
+            const auto& arrival = arrivals[next_arrival++];
+
+            sockaddr_in source_addr{};
+            source_addr.sin_family = AF_INET;
+            source_addr.sin_port = htons(5000 + arrival.source);
+
+            generate_packet(arrival.packet_index, packet);
+            memcpy(original, packet, sizeof(packet));
+
+            mixer.append(&source_addr, packet, sizeof(packet), now);
+
+            CHECK(memcmp(original, packet, sizeof(packet)) == 0);
+        }
+
+        if (now >= next_take) {
+            next_take += TAKE_US;
+
+            mixer.take((uint8_t*)output, sizeof(output));
+
+            // Only look at the tone once it's playing steadily.
+
+            if (playing) {
+                for (size_t i = 0; i < TAKE_SAMPLES; i++) {
+                    max_step = max(max_step, abs(output[i] - last_sample));
+                    last_sample = output[i];
+                }
+            } else if (output[TAKE_SAMPLES - 1]) {
+                playing = true;
+                last_sample = output[TAKE_SAMPLES - 1];
+            }
+        }
+    }
+
+    concealed = mixer.get_concealed_samples();
+}
+
+int main() {
+    // Largest step between two samples of the tone.
+    const auto tone_step = (int)(AMPLITUDE * 2 * M_PI * FREQUENCY / CONFIG_DEVICE_I2S_SAMPLE_RATE) + 1;
+
+    uint32_t concealed;
+    int max_step;
+
+    run(1, 5, ESP_TIMER_MS(30), concealed, max_step);
+
+    printf("Single source: concealed %d samples, largest step %d (tone %d)\n", (int)concealed, max_step,
+           tone_step);
+
+    // Dropping quiet samples to hold the playout delay may skip a sample
+    // around a zero crossing; a sample out of place in a filled hole would
+    // show up as a larger step.
+
+    CHECK(concealed == 0);
+    CHECK(max_step <= tone_step * 2);
+
+    // Every other packet is late by a few packets, so each source has a few
+    // holes open at any time.
+
+    run(CONFIG_DEVICE_AUDIO_MAX_SOURCES, 2, ESP_TIMER_MS(90), concealed, max_step);
+
+    printf("%d sources: concealed %d samples\n", CONFIG_DEVICE_AUDIO_MAX_SOURCES, (int)concealed);
+
+    CHECK(concealed > 0);
+
+    return 0;
+}
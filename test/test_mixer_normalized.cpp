@@ -0,0 +1,274 @@
+#include "support.h"
+
+#include <random>
+#include <vector>
+
+#include "AudioMixer.h"
+#include "SoftLimiter.h"
+#include "test.h"
+
+// Checks normalized mixing against saturating mixing, with three sources
+// playing loud tones at the same time. The saturating mix clips; the
+// normalized mix doesn't, and it follows the ideal sum of the sources.
+//
+// A source joining and leaving the normalized mix changes the gain of the
+// others, which must ramp instead of step.
+//
+// The soft limiter is checked separately: below the threshold it passes
+// audio unchanged, and above it the output stays under the threshold.
+
+static constexpr int64_t PACKET_US = ESP_TIMER_MS(20);
+static constexpr size_t PACKET_SAMPLES = US_TO_SAMPLES(PACKET_US);
+static constexpr int64_t TAKE_US = ESP_TIMER_MS(CONFIG_DEVICE_AUDIO_CHUNK_MS);
+static constexpr size_t TAKE_SAMPLES = US_TO_SAMPLES(TAKE_US);
+static constexpr int PACKETS = 150;
+// Audio before this isn't looked at, so the sources are all playing.
+static constexpr size_t SETTLE_SAMPLES = US_TO_SAMPLES(ESP_TIMER_MS(500));
+static constexpr float PEAK = 16000;
+static constexpr float FREQUENCIES[] = {300, 470, 690};
+static constexpr int SOURCES = (int)size(FREQUENCIES);
+static constexpr int32_t LIMITER_THRESHOLD = 29204;
+static constexpr size_t LIMITER_DELAY_SAMPLES = US_TO_SAMPLES(2000);
+// The second source of the gain ramp test plays silence between these packets.
+static constexpr uint32_t JOIN_PACKET = 50;
+static constexpr uint32_t LEAVE_PACKET = 100;
+static constexpr int16_t JOIN_LEVEL = 8000;
+
+static float get_sample(int source, size_t index) {
+    const auto t = (float)index / CONFIG_DEVICE_I2S_SAMPLE_RATE;
+    return PEAK * sinf(2 * (float)M_PI * FREQUENCIES[source] * t);
+}
+
+static vector<int16_t> play(bool mix_normalized) {
+    AudioConfiguration audio_config{};
+    audio_config.audio_buffer_ms = 100;
+    audio_config.codec = AudioCodecType::PCM;
+    audio_config.frame_ms = 20;
+    audio_config.mix_normalized = mix_normalized;
+
+    AudioMixer mixer;
+    mixer.initialize(audio_config);
+
+    uint8_t packet[sizeof(AudioFrameHeader) + PACKET_SAMPLES * sizeof(int16_t)];
+    vector<int16_t> output;
+
+    int64_t next_take = TAKE_US / 2;
+    uint32_t packet_index = 0;
+
+    for (int64_t now = 0; now < PACKETS * PACKET_US; now += 500) {
+        host_set_time(now);
+
+        if (now == (int64_t)packet_index * PACKET_US) {
+            for (auto i = 0; i < SOURCES; i++) {
+                const auto header = (AudioFrameHeader*)packet;
+                header->packet_index = htonl(packet_index);
+                header->timestamp = htonl(packet_index * PACKET_SAMPLES);
+
+                const auto samples = (int16_t*)(packet + sizeof(AudioFrameHeader));
+                for (size_t j = 0; j < PACKET_SAMPLES; j++) {
+                    samples[j] = (int16_t)get_sample(i, packet_index * PACKET_SAMPLES + j);
+                }
+
+                sockaddr_in source_addr{};
+                source_addr.sin_family = AF_INET;
+                source_addr.sin_port = htons(5000 + i);
+
+                mixer.append(&source_addr, packet, sizeof(packet), now);
+            }
+
+            packet_index++;
+        }
+
+        if (now >= next_take) {
+            next_take += TAKE_US;
+
+            int16_t chunk[TAKE_SAMPLES];
+            mixer.take((uint8_t*)chunk, sizeof(chunk));
+
+            output.insert(output.end(), chunk, chunk + TAKE_SAMPLES);
+        }
+    }
+
+    return output;
+}
+
+static vector<int16_t> play_join() {
+    AudioConfiguration audio_config{};
+    audio_config.audio_buffer_ms = 100;
+    audio_config.codec = AudioCodecType::PCM;
+    audio_config.frame_ms = 20;
+    audio_config.mix_normalized = true;
+
+    AudioMixer mixer;
+    mixer.initialize(audio_config);
+
+    uint8_t packet[sizeof(AudioFrameHeader) + PACKET_SAMPLES * sizeof(int16_t)];
+    vector<int16_t> output;
+
+    int64_t next_take = TAKE_US / 2;
+    uint32_t packet_index = 0;
+
+    for (int64_t now = 0; now < PACKETS * PACKET_US; now += 500) {
+        host_set_time(now);
+
+        if (now == (int64_t)packet_index * PACKET_US) {
+            // The first source plays a constant level, so any change of its
+            // gain shows up directly in the output.
+
+            for (auto i = 0; i < 2; i++) {
+                if (i == 1 && (packet_index < JOIN_PACKET || packet_index >= LEAVE_PACKET)) {
+                    continue;
+                }
+
+                const auto header = (AudioFrameHeader*)packet;
+                header->packet_index = htonl(packet_index);
+                header->timestamp = htonl(packet_index * PACKET_SAMPLES);
+
+                const auto samples = (int16_t*)(packet + sizeof(AudioFrameHeader));
+                for (size_t j = 0; j < PACKET_SAMPLES; j++) {
+                    samples[j] = i == 0 ? JOIN_LEVEL : 0;
+                }
+
+                sockaddr_in source_addr{};
+                source_addr.sin_family = AF_INET;
+                source_addr.sin_port = htons(5000 + i);
+
+                mixer.append(&source_addr, packet, sizeof(packet), now);
+            }
+
+            packet_index++;
+        }
+
+        if (now >= next_take) {
+            next_take += TAKE_US;
+
+            int16_t chunk[TAKE_SAMPLES];
+            mixer.take((uint8_t*)chunk, sizeof(chunk));
+
+            output.insert(output.end(), chunk, chunk + TAKE_SAMPLES);
+        }
+    }
+
+    return output;
+}
+
+static int count_clipped(const vector<int16_t>& output) {
+    int clipped = 0;
+    for (size_t i = SETTLE_SAMPLES; i < output.size(); i++) {
+        if (output[i] == INT16_MAX || output[i] == INT16_MIN) {
+            clipped++;
+        }
+    }
+    return clipped;
+}
+
+static float correlate_with_sum(const vector<int16_t>& output) {
+    // The output lags the sources by the playout delay; take the lag that
+    // correlates best.
+
+    vector<float> sum(output.size());
+    for (size_t i = 0; i < sum.size(); i++) {
+        for (auto j = 0; j < SOURCES; j++) {
+            sum[i] += get_sample(j, i);
+        }
+    }
+
+    auto best = -1.0f;
+
+    for (size_t lag = 0; lag < SETTLE_SAMPLES; lag++) {
+        double xy = 0;
+        double xx = 0;
+        double yy = 0;
+
+        for (size_t i = SETTLE_SAMPLES; i < output.size(); i++) {
+            xy += (double)output[i] * sum[i - lag];
+            xx += (double)output[i] * output[i];
+            yy += (double)sum[i - lag] * sum[i - lag];
+        }
+
+        best = max(best, (float)(xy / sqrt(xx * yy)));
+    }
+
+    return best;
+}
+
+static void test_mixer() {
+    const auto saturated = play(false);
+    const auto normalized = play(true);
+
+    const auto saturated_clipped = count_clipped(saturated);
+    const auto normalized_clipped = count_clipped(normalized);
+    const auto normalized_correlation = correlate_with_sum(normalized);
+
+    printf("Saturating mix clipped %d samples, normalized mix clipped %d and correlated %.4f with the sum\n",
+           saturated_clipped, normalized_clipped, normalized_correlation);
+
+    CHECK(saturated_clipped > 0);
+    CHECK(normalized_clipped == 0);
+    CHECK(normalized_correlation > 0.999f);
+}
+
+static void test_gain_ramp() {
+    const auto output = play_join();
+
+    int16_t min_level = INT16_MAX;
+    int max_step = 0;
+
+    for (size_t i = SETTLE_SAMPLES; i < output.size(); i++) {
+        min_level = min(min_level, output[i]);
+        max_step = max(max_step, abs(output[i] - output[i - 1]));
+    }
+
+    printf("Joining source lowered the level to %d, largest step between samples %d\n", min_level, max_step);
+
+    // Two sources play at -3 dB, and the level gets there without a click.
+
+    CHECK(abs(min_level - (int)(JOIN_LEVEL / sqrtf(2))) < 10);
+    CHECK(output.back() == JOIN_LEVEL);
+    CHECK(max_step < 50);
+}
+
+static void test_limiter() {
+    mt19937 engine(1);
+
+    SoftLimiter limiter;
+    limiter.reset();
+
+    // Quiet audio comes out unchanged, two blocks later.
+
+    uniform_int_distribution<int32_t> quiet(-LIMITER_THRESHOLD, LIMITER_THRESHOLD);
+
+    vector<int32_t> input(US_TO_SAMPLES(ESP_TIMER_MS(100)));
+    for (auto& sample : input) {
+        sample = quiet(engine);
+    }
+
+    vector<int16_t> output(input.size());
+    limiter.process(input.data(), output.data(), input.size());
+
+    for (size_t i = LIMITER_DELAY_SAMPLES; i < input.size(); i++) {
+        CHECK(output[i] == input[i - LIMITER_DELAY_SAMPLES]);
+    }
+
+    // Loud audio stays under the threshold.
+
+    uniform_int_distribution<int32_t> loud(-LIMITER_THRESHOLD * 3, LIMITER_THRESHOLD * 3);
+
+    for (auto& sample : input) {
+        sample = loud(engine);
+    }
+
+    limiter.process(input.data(), output.data(), input.size());
+
+    for (size_t i = LIMITER_DELAY_SAMPLES; i < input.size(); i++) {
+        CHECK(abs(output[i]) <= LIMITER_THRESHOLD);
+    }
+}
+
+int main() {
+    test_mixer();
+    test_gain_ramp();
+    test_limiter();
+
+    return 0;
+}
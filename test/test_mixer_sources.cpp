@@ -0,0 +1,105 @@
+#include "support.h"
+
+#include "AudioMixer.h"
+#include "test.h"
+
+// Checks how the mixer hands out its fixed table of sources. Every source
+// sends the same constant level, so the saturating mix tells how many
+// sources are being played:
+//
+// - Every source gets a slot while there are free ones.
+// - With every slot taken by an active source, a new source is dropped.
+// - Once a source goes quiet and drains, a new source takes over its slot.
+
+static constexpr int64_t PACKET_US = ESP_TIMER_MS(20);
+static constexpr size_t PACKET_SAMPLES = US_TO_SAMPLES(PACKET_US);
+static constexpr int64_t TAKE_US = ESP_TIMER_MS(CONFIG_DEVICE_AUDIO_CHUNK_MS);
+static constexpr size_t TAKE_SAMPLES = US_TO_SAMPLES(TAKE_US);
+static constexpr int SOURCES = CONFIG_DEVICE_AUDIO_MAX_SOURCES + 1;
+// Loud enough to never be dropped or repeated to adapt the playout delay.
+static constexpr int16_t LEVEL = 400;
+// Packets per phase of the test.
+static constexpr int PHASE_PACKETS = 200;
+
+static_assert(LEVEL * SOURCES <= INT16_MAX, "the levels of all sources must add up without saturating");
+
+static void generate_packet(uint32_t packet_index, uint8_t* buffer) {
+    const auto header = (AudioFrameHeader*)buffer;
+    header->packet_index = htonl(packet_index);
+    header->timestamp = htonl(packet_index * PACKET_SAMPLES);
+
+    const auto samples = (int16_t*)(buffer + sizeof(AudioFrameHeader));
+
+    for (size_t i = 0; i < PACKET_SAMPLES; i++) {
+        samples[i] = LEVEL;
+    }
+}
+
+int main() {
+    AudioConfiguration audio_config{};
+    audio_config.audio_buffer_ms = 100;
+    audio_config.codec = AudioCodecType::PCM;
+    audio_config.frame_ms = 20;
+    audio_config.mix_normalized = false;
+
+    AudioMixer mixer;
+    mixer.initialize(audio_config);
+
+    // The first sources fill the table. Then the last source starts sending
+    // while they're all active. Then the first source goes quiet, and the
+    // last one takes over its slot.
+
+    struct Phase {
+        int first_source;
+        int last_source;
+    };
+
+    const Phase phases[] = {
+        {0, SOURCES - 2},
+        {0, SOURCES - 1},
+        {1, SOURCES - 1},
+    };
+
+    uint8_t packet[sizeof(AudioFrameHeader) + PACKET_SAMPLES * sizeof(int16_t)];
+    int16_t output[TAKE_SAMPLES];
+
+    int64_t next_take = TAKE_US / 2;
+    uint32_t packet_index = 0;
+
+    for (size_t i = 0; i < size(phases); i++) {
+        const auto& phase = phases[i];
+        const auto phase_end = (int64_t)(i + 1) * PHASE_PACKETS * PACKET_US;
+
+        for (int64_t now = (int64_t)i * PHASE_PACKETS * PACKET_US; now < phase_end; now += 500) {
+            host_set_time(now);
+
+            if (now == (int64_t)packet_index * PACKET_US) {
+                generate_packet(packet_index, packet);
+
+                for (auto j = phase.first_source; j <= phase.last_source; j++) {
+                    sockaddr_in source_addr{};
+                    source_addr.sin_family = AF_INET;
+                    source_addr.sin_port = htons(5000 + j);
+
+                    mixer.append(&source_addr, packet, sizeof(packet), now);
+                }
+
+                packet_index++;
+            }
+
+            if (now >= next_take) {
+                next_take += TAKE_US;
+
+                mixer.take((uint8_t*)output, sizeof(output));
+            }
+        }
+
+        printf("Phase %d: %d sources playing\n", (int)i, output[0] / LEVEL);
+
+        for (auto sample : output) {
+            CHECK(sample == LEVEL * CONFIG_DEVICE_AUDIO_MAX_SOURCES);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "support.h"
+
+#include <thread>
+
+#include "PacketQueue.h"
+#include "test.h"
+
+// Runs the producer and consumer of the packet queue on two threads, and
+// checks that every packet comes through once, in order and intact. The
+// producer pushes batches of varying size and retries what was dropped
+// because the queue was full.
+
+static constexpr uint32_t PACKETS = 20000;
+
+static size_t get_packet_len(uint32_t sequence) { return 4 + sequence % (UDPServer::PAYLOAD_LEN - 4); }
+
+static uint8_t get_packet_byte(uint32_t sequence, size_t index) { return (uint8_t)(sequence * 31 + index); }
+
+static void produce(PacketQueue& queue) {
+    sockaddr_in source_addr{};
+    source_addr.sin_family = AF_INET;
+
+    static uint8_t buffers[CONFIG_DEVICE_UDP_RECEIVE_BATCH][UDPServer::PAYLOAD_LEN];
+    UDPPacket packets[CONFIG_DEVICE_UDP_RECEIVE_BATCH];
+
+    uint32_t sequence = 0;
+
+    while (sequence < PACKETS) {
+        const auto count = min<size_t>(1 + sequence % CONFIG_DEVICE_UDP_RECEIVE_BATCH, PACKETS - sequence);
+
+        for (size_t i = 0; i < count; i++) {
+            const auto packet_sequence = sequence + (uint32_t)i;
+            const auto len = get_packet_len(packet_sequence);
+
+            memcpy(buffers[i], &packet_sequence, sizeof(packet_sequence));
+            for (size_t j = sizeof(packet_sequence); j < len; j++) {
+                buffers[i][j] = get_packet_byte(packet_sequence, j);
+            }
+
+            packets[i] = {&source_addr, buffers[i], len, nullptr};
+        }
+
+        const auto queued = queue.push(Span(packets, count), (int64_t)sequence);
+
+        sequence += (uint32_t)queued;
+
+        if (queued < count) {
+            this_thread::yield();
+        }
+    }
+}
+
+int main() {
+    PacketQueue queue;
+    queue.initialize(CONFIG_DEVICE_AUDIO_PACKET_QUEUE_LEN);
+
+    thread producer(produce, ref(queue));
+
+    uint32_t expected = 0;
+
+    while (expected < PACKETS) {
+        const auto packet = queue.front();
+        if (!packet) {
+            this_thread::yield();
+            continue;
+        }
+
+        uint32_t sequence;
+        CHECK(packet->buffer_len >= sizeof(sequence));
+        memcpy(&sequence, packet->buffer, sizeof(sequence));
+
+        CHECK(sequence == expected);
+        CHECK(packet->buffer_len == get_packet_len(sequence));
+        CHECK(packet->arrival_time <= (int64_t)sequence);
+        for (size_t i = sizeof(sequence); i < packet->buffer_len; i++) {
+            CHECK(packet->buffer[i] == get_packet_byte(sequence, i));
+        }
+
+        queue.pop();
+        expected++;
+    }
+
+    producer.join();
+
+    CHECK(!queue.front());
+
+    printf("%d packets came through, %d packets were dropped on a full queue and sent again\n", (int)PACKETS, (int)queue.get_dropped());
+
+    return 0;
+}
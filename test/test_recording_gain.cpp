@@ -0,0 +1,149 @@
+#include "support.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "RecordingGain.h"
+#include "test.h"
+
+// Checks the fixed point recording gain against the floating point
+// implementation it replaced, which is kept here as the reference. Audio
+// alternates between bursts of noise at random levels and silence, so the
+// peak both attacks and releases, for every microphone gain setting, a few
+// block lengths and smoothing factors. The output must stay within one LSB
+// of the reference.
+
+static constexpr size_t BLOCK_SAMPLES[] = {160, 256, 480, 512};
+static constexpr float SMOOTHING_FACTORS[] = {0.1f, 0.01f, 0.001f};
+static constexpr size_t SECONDS = 2;
+
+class ReferenceRecordingGain {
+    static constexpr int GAIN_BITS = 24;
+    static constexpr int32_t GAIN_UNITY = 1 << GAIN_BITS;
+
+    float _smoothing_factor{};
+    float _peak{1};
+    int32_t _gain{GAIN_UNITY};
+
+public:
+    explicit ReferenceRecordingGain(float smoothing_factor) : _smoothing_factor(smoothing_factor) {}
+
+    void process(const int32_t* source, int16_t* target, size_t samples, int shift) {
+        int32_t block_peak = 0;
+        int64_t block_sum = 0;
+
+        for (size_t i = 0; i < samples; i++) {
+            const auto abs_sample = abs((source[i] << 1) >> shift);
+
+            block_peak = max(block_peak, abs_sample);
+            block_sum += abs_sample;
+        }
+
+        if ((float)block_peak > _peak) {
+            _peak = (float)block_peak;
+        } else {
+            const auto decay = powf(1 - _smoothing_factor, (float)samples);
+            const auto level = (float)(block_sum / (int64_t)samples);
+
+            _peak = _peak * decay + level * (1 - decay);
+        }
+
+        _peak = max(_peak, 1.0f);
+
+        const auto peak = (int32_t)_peak;
+        const auto target_gain =
+            peak <= INT16_MAX ? GAIN_UNITY : (int32_t)(((int64_t)INT16_MAX << GAIN_BITS) / (int64_t)peak);
+
+        auto gain = min(_gain, target_gain);
+        const auto gain_step = (target_gain - gain) / (int32_t)samples;
+
+        for (size_t i = 0; i < samples; i++) {
+            const auto sample = (source[i] << 1) >> shift;
+            const auto scaled = (int32_t)(((int64_t)sample * gain) >> GAIN_BITS);
+
+            target[i] = (int16_t)clamp<int32_t>(scaled, INT16_MIN, INT16_MAX);
+
+            gain += gain_step;
+        }
+
+        _gain = target_gain;
+    }
+};
+
+static vector<int32_t> generate_source(mt19937& engine) {
+    // Bursts of 20 to 300 ms at levels from barely audible to full scale,
+    // with silence in between. The microphone writes 24 bits from bit 1.
+
+    uniform_int_distribution<size_t> burst_ms(20, 300);
+    uniform_real_distribution<float> level(4, 23);
+
+    const auto samples = US_TO_SAMPLES(ESP_TIMER_SECONDS(SECONDS));
+
+    vector<int32_t> source(samples);
+
+    auto talking = true;
+    for (size_t i = 0; i < samples;) {
+        const auto len = min(US_TO_SAMPLES(ESP_TIMER_MS(burst_ms(engine))), samples - i);
+        const auto amplitude = exp2f(level(engine));
+
+        normal_distribution<float> noise(0, amplitude / 3);
+
+        for (size_t j = 0; j < len; j++) {
+            const auto sample = talking ? clamp(noise(engine), -amplitude, amplitude) : 0.0f;
+
+            source[i + j] = (int32_t)sample * (1 << 7);
+        }
+
+        i += len;
+        talking = !talking;
+    }
+
+    return source;
+}
+
+int main() {
+    mt19937 engine(1);
+
+    const auto source = generate_source(engine);
+
+    vector<int16_t> target(source.size());
+    vector<int16_t> expected(source.size());
+
+    for (auto block_samples : BLOCK_SAMPLES) {
+        for (auto smoothing_factor : SMOOTHING_FACTORS) {
+            int max_error = 0;
+            size_t mismatches = 0;
+
+            for (auto microphone_gain_bits = 0; microphone_gain_bits <= 16; microphone_gain_bits++) {
+                const auto shift = 16 - microphone_gain_bits;
+
+                RecordingGain gain;
+                gain.begin(smoothing_factor, block_samples);
+
+                ReferenceRecordingGain reference(smoothing_factor);
+
+                for (size_t i = 0; i + block_samples <= source.size(); i += block_samples) {
+                    gain.process(&source[i], &target[i], block_samples, shift);
+                    reference.process(&source[i], &expected[i], block_samples, shift);
+                }
+
+                for (size_t i = 0; i < source.size(); i++) {
+                    const auto error = abs(target[i] - expected[i]);
+
+                    max_error = max(max_error, error);
+                    if (error) {
+                        mismatches++;
+                    }
+                }
+            }
+
+            printf("Blocks of %d samples, smoothing factor %.3f: %d samples differ, by at most %d\n",
+                   (int)block_samples, smoothing_factor, (int)mismatches, max_error);
+
+            CHECK(max_error <= 1);
+        }
+    }
+
+    return 0;
+}
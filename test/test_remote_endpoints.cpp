@@ -0,0 +1,90 @@
+#include "support.h"
+
+#include <chrono>
+#include <thread>
+
+#include "RemoteEndpoints.h"
+#include "test.h"
+
+// Hammers the endpoint set with adds and removes while reader threads send
+// to it, like the audio path does. Readers check every snapshot is
+// consistent; freeing a snapshot that's still read shows up under ASan.
+// The readers overlap, so there's hardly ever a moment without one. The
+// writer must not stall on that.
+
+static constexpr int READERS = 3;
+static constexpr int ENDPOINTS = 8;
+static constexpr int WRITES = 2000;
+static constexpr int64_t MAX_WRITE_US = ESP_TIMER_MS(100);
+
+static string get_name(int index) { return "10.0.0." + to_string(index) + ":5000"; }
+
+static RemoteEndpoints::Endpoint get_endpoint(int index) {
+    RemoteEndpoints::Endpoint endpoint{get_name(index)};
+    endpoint.addr.sin_family = AF_INET;
+    endpoint.addr.sin_port = htons(5000);
+    endpoint.addr.sin_addr.s_addr = htonl(0x0a000000 | index);
+    return endpoint;
+}
+
+static void read_endpoints(RemoteEndpoints& endpoints, atomic<bool>& stop, atomic<uint64_t>& reads) {
+    while (!stop) {
+        const auto snapshot = endpoints.read();
+
+        // Like sending a packet to every endpoint.
+
+        size_t count = 0;
+        for (const auto& endpoint : snapshot) {
+            const auto index = (int)(ntohl(endpoint.addr.sin_addr.s_addr) & 0xff);
+
+            CHECK(endpoint.endpoint == get_name(index));
+            CHECK(snapshot.get_addrs()[count].sin_addr.s_addr == endpoint.addr.sin_addr.s_addr);
+            count++;
+        }
+
+        CHECK(count == snapshot.size());
+        CHECK(count <= ENDPOINTS);
+
+        reads++;
+    }
+}
+
+int main() {
+    RemoteEndpoints endpoints;
+
+    atomic<bool> stop{};
+    atomic<uint64_t> reads{};
+
+    thread readers[READERS];
+    for (auto& reader : readers) {
+        reader = thread(read_endpoints, ref(endpoints), ref(stop), ref(reads));
+    }
+
+    int64_t max_write_us = 0;
+
+    for (auto i = 0; i < WRITES; i++) {
+        const auto index = i % ENDPOINTS;
+
+        const auto start = chrono::steady_clock::now();
+
+        if (endpoints.contains(get_name(index))) {
+            CHECK(endpoints.remove(get_name(index)));
+        } else {
+            CHECK(endpoints.add(get_endpoint(index)));
+        }
+
+        const auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+        max_write_us = max(max_write_us, (int64_t)elapsed.count());
+    }
+
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+
+    printf("%d writes, %d reads, slowest write %d us\n", WRITES, (int)reads, (int)max_write_us);
+
+    CHECK(max_write_us < MAX_WRITE_US);
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "support.h"
+
+#include "RTPSession.h"
+#include "test.h"
+
+// Receives streams from more sources than the session keeps statistics
+// for, and checks the receiver reports of the ones it does keep.
+
+static constexpr size_t SOURCES = CONFIG_DEVICE_AUDIO_MAX_SOURCES;
+static constexpr int64_t PACKET_US = ESP_TIMER_MS(20);
+
+static uint32_t read_u32(const uint8_t* buffer) {
+    return ((uint32_t)buffer[0] << 24) | ((uint32_t)buffer[1] << 16) | ((uint32_t)buffer[2] << 8) | buffer[3];
+}
+
+static size_t receive(RTPSession& session, int source, uint16_t sequence) {
+    uint8_t packet[RTP_HEADER_LEN + 320]{};
+
+    packet[0] = 0x80;
+    packet[1] = get_rtp_payload_type(AudioCodecType::PCM);
+    packet[2] = (uint8_t)(sequence >> 8);
+    packet[3] = (uint8_t)sequence;
+    const auto timestamp = htonl(sequence * 160u);
+    memcpy(packet + 4, &timestamp, sizeof(timestamp));
+    const auto ssrc = htonl(0x1000 + source);
+    memcpy(packet + 8, &ssrc, sizeof(ssrc));
+
+    sockaddr_in source_addr{};
+    source_addr.sin_family = AF_INET;
+    source_addr.sin_addr.s_addr = htonl(0x0a000001 + source);
+    source_addr.sin_port = htons(5000);
+
+    return session.packet_received(&source_addr, packet, sizeof(packet));
+}
+
+int main() {
+    RTPSession session;
+    session.begin(AudioCodecType::PCM);
+
+    // One more source than there are slots. The last one only starts after
+    // the first one stopped, and takes over its slot. Every other source
+    // loses one packet in ten.
+
+    const auto late_source = (int)SOURCES;
+    int reports[SOURCES + 1]{};
+
+    for (uint16_t sequence = 0; sequence < 600; sequence++) {
+        host_set_time(sequence * PACKET_US);
+
+        for (auto source = 0; source <= late_source; source++) {
+            if ((source == 0 && sequence >= 100) || (source == late_source && sequence < 150)) {
+                continue;
+            }
+            if (source % 2 && sequence % 10 == 5) {
+                continue;
+            }
+
+            if (!receive(session, source, sequence)) {
+                continue;
+            }
+
+            reports[source]++;
+
+            const auto block = session.get_receiver_report() + 8;
+            const auto lost = read_u32(block + 4) & 0xffffff;
+
+            CHECK(read_u32(block) == 0x1000u + source);
+            CHECK(read_u32(block + 8) == sequence);
+
+            if (source % 2) {
+                CHECK(lost == (sequence + 5u) / 10);
+            } else {
+                CHECK(lost == 0);
+            }
+        }
+    }
+
+    // Reports go out every five seconds, starting five seconds after the
+    // first packet.
+
+    CHECK(reports[0] == 0);
+    for (auto source = 1; source < late_source; source++) {
+        CHECK(reports[source] == 2);
+    }
+    CHECK(reports[late_source] == 1);
+
+    return 0;
+}
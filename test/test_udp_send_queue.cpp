@@ -0,0 +1,223 @@
+#include "support.h"
+
+#include <poll.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "UDPServer.h"
+#include "test.h"
+
+// Sends packets through the send queue from two threads, one building them
+// in place and one with the copying send(), to more destinations than fit
+// a slot. The send task sends them over loopback. Packets are dropped in
+// long bursts, when the queue is full, but every packet that arrives must
+// be intact and in order. Once the queue drains, every slot must be free
+// again.
+
+static constexpr int DESTINATIONS = 6;
+static constexpr uint32_t PACKETS = 5000;
+static constexpr uint32_t END = UINT32_MAX;
+// Packets are sent in bursts with a pause in between. Bursts longer than
+// the queue make it drop packets.
+static constexpr uint32_t BURST_PACKETS = 4;
+static constexpr uint32_t LONG_BURST_PACKETS = 40;
+static constexpr int64_t BURST_PAUSE_US = 500;
+// Every slot, the ones that may be held outside of the queue included.
+static constexpr size_t SEND_SLOTS = CONFIG_DEVICE_UDP_SEND_QUEUE_LEN + 4;
+
+struct Destination {
+    int sock;
+    sockaddr_in addr;
+    uint32_t next_sequence[2];
+    bool ended[2];
+    uint32_t received;
+};
+
+static size_t get_packet_len(uint32_t sequence) { return 5 + sequence % (UDPServer::PAYLOAD_LEN - 5); }
+
+static uint8_t get_packet_byte(uint32_t sequence, size_t index) { return (uint8_t)(sequence * 31 + index); }
+
+static size_t write_packet(uint8_t* packet, uint8_t producer, uint32_t sequence) {
+    const auto len = sequence == END ? 5 : get_packet_len(sequence);
+
+    packet[0] = producer;
+    memcpy(packet + 1, &sequence, sizeof(sequence));
+    for (size_t i = 5; i < len; i++) {
+        packet[i] = get_packet_byte(sequence, i);
+    }
+
+    return len;
+}
+
+static void produce(UDPServer& server, const sockaddr_in* to, uint8_t producer) {
+    static thread_local uint8_t buffer[UDPServer::PAYLOAD_LEN];
+
+    for (uint32_t sequence = 0; sequence < PACKETS; sequence++) {
+        const auto burst_packets = sequence / 1000 % 2 ? LONG_BURST_PACKETS : BURST_PACKETS;
+        if (sequence % burst_packets == 0) {
+            this_thread::sleep_for(chrono::microseconds(BURST_PAUSE_US));
+        }
+
+        if (producer == 0) {
+            const auto packet = server.allocate_packet();
+
+            // Now and then a packet isn't sent after all.
+            if (sequence % 17 == 0) {
+                server.release_packet(packet);
+                continue;
+            }
+
+            const auto len = write_packet(packet, producer, sequence);
+            server.send_packet(packet, len, to, DESTINATIONS);
+        } else {
+            const auto len = write_packet(buffer, producer, sequence);
+            server.send(to, DESTINATIONS, nullptr, 0, buffer, len);
+        }
+    }
+}
+
+static void receive(Destination& destination) {
+    uint8_t packet[UDPServer::PAYLOAD_LEN];
+
+    const auto len = recv(destination.sock, packet, sizeof(packet), MSG_DONTWAIT);
+    if (len <= 0) {
+        return;
+    }
+
+    CHECK(len >= 5);
+    CHECK(packet[0] < 2);
+
+    const auto producer = packet[0];
+    uint32_t sequence;
+    memcpy(&sequence, packet + 1, sizeof(sequence));
+
+    if (sequence == END) {
+        destination.ended[producer] = true;
+        return;
+    }
+
+    CHECK(!destination.ended[producer]);
+    CHECK(sequence >= destination.next_sequence[producer]);
+    CHECK((size_t)len == get_packet_len(sequence));
+    for (size_t i = 5; i < (size_t)len; i++) {
+        CHECK(packet[i] == get_packet_byte(sequence, i));
+    }
+
+    destination.next_sequence[producer] = sequence + 1;
+    destination.received++;
+}
+
+static bool all_ended(const Destination* destinations) {
+    for (auto i = 0; i < DESTINATIONS; i++) {
+        if (!destinations[i].ended[0] || !destinations[i].ended[1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    Destination destinations[DESTINATIONS]{};
+    sockaddr_in to[DESTINATIONS];
+    pollfd fds[DESTINATIONS];
+
+    for (auto i = 0; i < DESTINATIONS; i++) {
+        auto& destination = destinations[i];
+
+        destination.sock = socket(AF_INET, SOCK_DGRAM, 0);
+        CHECK(destination.sock >= 0);
+
+        int rcvbuf = 4 * 1024 * 1024;
+        setsockopt(destination.sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+        destination.addr.sin_family = AF_INET;
+        destination.addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        CHECK(bind(destination.sock, (sockaddr*)&destination.addr, sizeof(destination.addr)) == 0);
+
+        socklen_t addr_len = sizeof(destination.addr);
+        getsockname(destination.sock, (sockaddr*)&destination.addr, &addr_len);
+
+        to[i] = destination.addr;
+        fds[i] = {destination.sock, POLLIN, 0};
+    }
+
+    // Like on the device, the server is never torn down; its tasks keep
+    // running until the process exits.
+    auto& server = *new UDPServer(0);
+    server.begin();
+
+    // The socket is opened by the receive task. Until then, sends fail.
+
+    uint8_t probe[5];
+    const auto probe_len = write_packet(probe, 0, END);
+    while (true) {
+        server.send(to, 1, nullptr, 0, probe, probe_len);
+        if (poll(fds, 1, 10) > 0) {
+            break;
+        }
+    }
+    while (recv(destinations[0].sock, probe, sizeof(probe), MSG_DONTWAIT) > 0) {
+    }
+
+    thread producers[] = {
+        thread(produce, ref(server), to, 0),
+        thread(produce, ref(server), to, 1),
+    };
+
+    atomic<bool> produced{};
+    thread finisher([&]() {
+        for (auto& producer : producers) {
+            producer.join();
+        }
+
+        // The queue holds at most a few packets, so these can't be dropped.
+
+        uint8_t packet[5];
+        for (uint8_t producer = 0; producer < 2; producer++) {
+            const auto len = write_packet(packet, producer, END);
+            server.send(to, DESTINATIONS, nullptr, 0, packet, len);
+        }
+
+        produced = true;
+    });
+
+    while (!all_ended(destinations)) {
+        if (poll(fds, DESTINATIONS, 5000) <= 0) {
+            break;
+        }
+
+        for (auto i = 0; i < DESTINATIONS; i++) {
+            if (fds[i].revents & POLLIN) {
+                receive(destinations[i]);
+            }
+        }
+    }
+
+    finisher.join();
+
+    CHECK(produced);
+    CHECK(all_ended(destinations));
+
+    for (auto i = 0; i < DESTINATIONS; i++) {
+        printf("Destination %d received %d of %d packets\n", i, (int)destinations[i].received,
+               (int)(PACKETS * 2 - (PACKETS + 16) / 17));
+        CHECK(destinations[i].received > 0);
+    }
+
+    // With the queue drained, every slot is free. If one leaked, taking
+    // them all would find the queue empty and fail.
+
+    vTaskDelay(100);
+
+    uint8_t* packets[SEND_SLOTS];
+    for (auto& packet : packets) {
+        packet = server.allocate_packet();
+    }
+    for (auto packet : packets) {
+        server.release_packet(packet);
+    }
+
+    return 0;
+}